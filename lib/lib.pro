@@ -0,0 +1,24 @@
+TEMPLATE = lib
+TARGET = sailfishusermanager
+
+QT -= gui
+QT += dbus
+
+CONFIG += c++11 hide_symbols
+
+DEFINES += SAILFISHUSERMANAGER_LIBRARY QT_DEPRECATED_WARNINGS
+
+INCLUDEPATH += ../src
+
+SOURCES += \
+    sailfishusermanagerclient.cpp
+
+HEADERS += \
+    sailfishusermanagerclient.h
+
+target.path = $$[QT_INSTALL_LIBS]
+
+headers.files = sailfishusermanagerclient.h
+headers.path = /usr/include/sailfishusermanager
+
+INSTALLS += target headers
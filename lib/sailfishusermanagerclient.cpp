@@ -0,0 +1,507 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#include "sailfishusermanagerclient.h"
+
+#include <QDBusMessage>
+#include <QDBusMetaType>
+#include <QDBusPendingCallWatcher>
+#include <QDBusServiceWatcher>
+#include <QLoggingCategory>
+#include <QTimer>
+
+Q_LOGGING_CATEGORY(lcSUMClient, "org.sailfishos.usermanager.client", QtWarningMsg)
+
+namespace {
+const auto PROPERTIES_INTERFACE = QStringLiteral("org.freedesktop.DBus.Properties");
+const uint UNKNOWN_UID = ~0u;
+// Jobs reply when they are done, removing a large home takes a while
+const int JOB_TIMEOUT = 5 * 60 * 1000;
+// Failed reads are retried with growing delays
+const int MIN_RETRY_DELAY = 1000;
+const int MAX_RETRY_DELAY = 60 * 1000;
+}
+
+class SailfishUserManagerClientPrivate
+{
+public:
+    SailfishUserManagerClientPrivate(const QDBusConnection &connection) :
+        connection(connection),
+        ready(false),
+        currentUser(UNKNOWN_UID),
+        guestUserEnabled(false),
+        loadSerial(0),
+        loading(false),
+        propertiesAllowed(true),
+        retryDelay(MIN_RETRY_DELAY),
+        retryTimer(nullptr)
+    {
+    }
+
+    QDBusMessage methodCall(const QString &method) const
+    {
+        return QDBusMessage::createMethodCall(SAILFISH_USERMANAGER_DBUS_INTERFACE,
+                                              SAILFISH_USERMANAGER_DBUS_OBJECT_PATH,
+                                              SAILFISH_USERMANAGER_DBUS_INTERFACE, method);
+    }
+
+    int indexOf(uint uid) const
+    {
+        for (int i = 0; i < users.size(); i++) {
+            if (users.at(i).uid == uid)
+                return i;
+        }
+        return -1;
+    }
+
+    QDBusConnection connection;
+    QList<SailfishUserManagerEntry> users;
+    bool ready;
+    uint currentUser;
+    bool guestUserEnabled;
+    uint loadSerial;
+    bool loading;
+    // Bus policy may not allow reading properties, currentUser is called then
+    bool propertiesAllowed;
+    int retryDelay;
+    QTimer *retryTimer;
+};
+
+/*!
+  \class SailfishUserManagerClient
+  \brief Cached client side model of users managed by \l SailfishUserManager.
+
+  Reads users, current user and \e {guest user} state from the daemon once and
+  keeps them up to date with the daemon's signals, so reads are answered
+  locally without waking the daemon. \l ready becomes \c true when the initial
+  state has been read.
+
+  Changes are made with asynchronous calls that return a pending reply. The
+  cached state is updated from the daemon's signals, not from the replies.
+  The whole state is read again when the daemon starts, as users may have
+  been changed while it was not running. While it runs, the daemon signals
+  also changes made outside of it, so \c DirectoryGeneration changes do not
+  cause reads. Failed reads are retried.
+
+  Link with \c sailfishusermanager from the \c pkg-config package of the same
+  name.
+ */
+
+/*!
+  \brief Constructs SailfishUserManagerClient on the system bus.
+ */
+SailfishUserManagerClient::SailfishUserManagerClient(QObject *parent) :
+    QObject(parent),
+    d(new SailfishUserManagerClientPrivate(QDBusConnection::systemBus()))
+{
+    init();
+}
+
+/*!
+  \brief Constructs SailfishUserManagerClient on \a connection.
+ */
+SailfishUserManagerClient::SailfishUserManagerClient(const QDBusConnection &connection, QObject *parent) :
+    QObject(parent),
+    d(new SailfishUserManagerClientPrivate(connection))
+{
+    init();
+}
+
+SailfishUserManagerClient::~SailfishUserManagerClient()
+{
+    delete d;
+    d = nullptr;
+}
+
+void SailfishUserManagerClient::init()
+{
+    qDBusRegisterMetaType<SailfishUserManagerEntry>();
+    qDBusRegisterMetaType<QList<SailfishUserManagerEntry>>();
+
+    // Subscribe before loading so that no change is missed in between
+    const QString service(SAILFISH_USERMANAGER_DBUS_INTERFACE);
+    const QString path(SAILFISH_USERMANAGER_DBUS_OBJECT_PATH);
+    const QString interface(SAILFISH_USERMANAGER_DBUS_INTERFACE);
+    d->connection.connect(service, path, interface, QStringLiteral("userAdded"),
+                          this, SLOT(onUserAdded(SailfishUserManagerEntry)));
+    d->connection.connect(service, path, interface, QStringLiteral("userRemoved"),
+                          this, SLOT(onUserRemoved(uint)));
+    d->connection.connect(service, path, interface, QStringLiteral("userModified"),
+                          this, SLOT(onUserModified(uint,QString)));
+    d->connection.connect(service, path, interface, QStringLiteral("currentUserChanged"),
+                          this, SLOT(onCurrentUserChanged(uint)));
+    d->connection.connect(service, path, interface, QStringLiteral("guestUserEnabled"),
+                          this, SLOT(onGuestUserEnabled(bool)));
+    d->connection.connect(service, path, PROPERTIES_INTERFACE, QStringLiteral("PropertiesChanged"),
+                          this, SLOT(onPropertiesChanged(QString,QVariantMap,QStringList)));
+
+    QDBusServiceWatcher *serviceWatcher = new QDBusServiceWatcher(service, d->connection,
+                                                                  QDBusServiceWatcher::WatchForRegistration, this);
+    connect(serviceWatcher, &QDBusServiceWatcher::serviceRegistered,
+            this, &SailfishUserManagerClient::onServiceRegistered);
+
+    d->retryTimer = new QTimer(this);
+    d->retryTimer->setSingleShot(true);
+    connect(d->retryTimer, &QTimer::timeout, this, &SailfishUserManagerClient::load);
+
+    load();
+}
+
+/*
+ * Reads the whole state. Replies come after any signal the daemon sent
+ * before handling the calls, so they are at least as new as the cache.
+ */
+void SailfishUserManagerClient::load()
+{
+    const uint serial = ++d->loadSerial;
+    d->loading = true;
+    d->retryTimer->stop();
+
+    QDBusMessage state;
+    if (d->propertiesAllowed) {
+        state = QDBusMessage::createMethodCall(SAILFISH_USERMANAGER_DBUS_INTERFACE,
+                                               SAILFISH_USERMANAGER_DBUS_OBJECT_PATH,
+                                               PROPERTIES_INTERFACE, QStringLiteral("GetAll"));
+        state.setArguments(QVariantList() << QStringLiteral(SAILFISH_USERMANAGER_DBUS_INTERFACE));
+    } else {
+        state = d->methodCall(QStringLiteral("currentUser"));
+    }
+    QDBusPendingCall stateCall = d->connection.asyncCall(state);
+    QDBusPendingReply<QList<SailfishUserManagerEntry>> users
+            = d->connection.asyncCall(d->methodCall(QStringLiteral("users")));
+
+    // State is applied when both replies have arrived
+    QDBusPendingCallWatcher *stateWatcher = new QDBusPendingCallWatcher(stateCall, this);
+    QDBusPendingCallWatcher *usersWatcher = new QDBusPendingCallWatcher(users, this);
+    auto finished = [this, stateWatcher, usersWatcher, serial]() {
+        if (!stateWatcher->isFinished() || !usersWatcher->isFinished())
+            return;
+        stateWatcher->deleteLater();
+        usersWatcher->deleteLater();
+        if (serial != d->loadSerial)
+            return;
+        // Both watchers may see both finished, only the first one applies
+        d->loadSerial++;
+        d->loading = false;
+
+        QDBusPendingReply<QList<SailfishUserManagerEntry>> users = *usersWatcher;
+        if (d->propertiesAllowed && stateWatcher->isError()
+                && stateWatcher->error().type() == QDBusError::AccessDenied) {
+            qCDebug(lcSUMClient) << "Reading properties is not allowed, calling currentUser instead";
+            d->propertiesAllowed = false;
+            load();
+            return;
+        }
+        if (users.isError() || stateWatcher->isError()) {
+            const QDBusError error = users.isError() ? users.error() : stateWatcher->error();
+            qCWarning(lcSUMClient) << "Could not read users:" << error.name() << error.message()
+                                   << "retrying in" << d->retryDelay << "ms";
+            d->retryTimer->start(d->retryDelay);
+            d->retryDelay = qMin(2 * d->retryDelay, MAX_RETRY_DELAY);
+            return;
+        }
+        d->retryDelay = MIN_RETRY_DELAY;
+
+        d->users = users.value();
+        uint currentUser;
+        bool guestUserEnabled;
+        if (d->propertiesAllowed) {
+            QDBusPendingReply<QVariantMap> properties = *stateWatcher;
+            const QVariantMap values = properties.value();
+            currentUser = values.value(QStringLiteral("CurrentUser"), UNKNOWN_UID).toUInt();
+            guestUserEnabled = values.value(QStringLiteral("GuestUserEnabled")).toBool();
+        } else {
+            QDBusPendingReply<uint> reply = *stateWatcher;
+            currentUser = reply.value();
+            // Guest user is listed with other users when it is enabled
+            guestUserEnabled = d->indexOf(SAILFISH_USERMANAGER_GUEST_UID) >= 0;
+        }
+
+        emit usersChanged();
+        if (currentUser != d->currentUser) {
+            d->currentUser = currentUser;
+            emit currentUserChanged(currentUser);
+        }
+        if (guestUserEnabled != d->guestUserEnabled) {
+            d->guestUserEnabled = guestUserEnabled;
+            emit guestUserEnabledChanged(guestUserEnabled);
+        }
+        if (!d->ready) {
+            d->ready = true;
+            emit readyChanged();
+        }
+    };
+    connect(stateWatcher, &QDBusPendingCallWatcher::finished, this, finished);
+    connect(usersWatcher, &QDBusPendingCallWatcher::finished, this, finished);
+}
+
+/*!
+  \property SailfishUserManagerClient::ready
+  \brief Whether the initial state has been read from the daemon.
+ */
+bool SailfishUserManagerClient::isReady() const
+{
+    return d->ready;
+}
+
+/*!
+  \brief Returns cached list of users.
+ */
+QList<SailfishUserManagerEntry> SailfishUserManagerClient::users() const
+{
+    return d->users;
+}
+
+/*!
+  \brief Returns \c true if user with \a uid exists and fills \a entry if it
+  is given.
+ */
+bool SailfishUserManagerClient::user(uint uid, SailfishUserManagerEntry *entry) const
+{
+    int i = d->indexOf(uid);
+    if (i < 0)
+        return false;
+    if (entry)
+        *entry = d->users.at(i);
+    return true;
+}
+
+/*!
+  \property SailfishUserManagerClient::userCount
+  \brief Number of users, including \e {guest user} when it is enabled.
+ */
+int SailfishUserManagerClient::userCount() const
+{
+    return d->users.size();
+}
+
+/*!
+  \property SailfishUserManagerClient::currentUser
+  \brief \e UID of the user that is active on \c seat0.
+
+  This is \c{~0u} until \l ready is \c true.
+ */
+uint SailfishUserManagerClient::currentUser() const
+{
+    return d->currentUser;
+}
+
+/*!
+  \property SailfishUserManagerClient::guestUserEnabled
+  \brief Whether \e {guest user} is enabled.
+ */
+bool SailfishUserManagerClient::isGuestUserEnabled() const
+{
+    return d->guestUserEnabled;
+}
+
+/*!
+  \brief Adds user with \a name, reply contains \e UID of the new user.
+ */
+QDBusPendingReply<uint> SailfishUserManagerClient::addUser(const QString &name)
+{
+    QDBusMessage call = d->methodCall(QStringLiteral("addUser"));
+    call.setArguments(QVariantList() << name);
+    return d->connection.asyncCall(call, JOB_TIMEOUT);
+}
+
+/*!
+  \brief Removes user with \a uid.
+ */
+QDBusPendingReply<> SailfishUserManagerClient::removeUser(uint uid)
+{
+    QDBusMessage call = d->methodCall(QStringLiteral("removeUser"));
+    call.setArguments(QVariantList() << uid);
+    return d->connection.asyncCall(call, JOB_TIMEOUT);
+}
+
+/*!
+  \brief Changes name of user with \a uid to \a name.
+ */
+QDBusPendingReply<> SailfishUserManagerClient::modifyUser(uint uid, const QString &name)
+{
+    QDBusMessage call = d->methodCall(QStringLiteral("modifyUser"));
+    call.setArguments(QVariantList() << uid << name);
+    return d->connection.asyncCall(call);
+}
+
+/*!
+  \brief Switches user on \c seat0 to \a uid.
+ */
+QDBusPendingReply<> SailfishUserManagerClient::setCurrentUser(uint uid)
+{
+    QDBusMessage call = d->methodCall(QStringLiteral("setCurrentUser"));
+    call.setArguments(QVariantList() << uid);
+    return d->connection.asyncCall(call, JOB_TIMEOUT);
+}
+
+/*!
+  \brief Switches user on \a seat to \a uid.
+ */
+QDBusPendingReply<> SailfishUserManagerClient::setSeatCurrentUser(const QString &seat, uint uid)
+{
+    QDBusMessage call = d->methodCall(QStringLiteral("setSeatCurrentUser"));
+    call.setArguments(QVariantList() << seat << uid);
+    return d->connection.asyncCall(call, JOB_TIMEOUT);
+}
+
+/*!
+  \brief Adds user with \a uid to \a groups.
+ */
+QDBusPendingReply<> SailfishUserManagerClient::addToGroups(uint uid, const QStringList &groups)
+{
+    QDBusMessage call = d->methodCall(QStringLiteral("addToGroups"));
+    call.setArguments(QVariantList() << uid << groups);
+    return d->connection.asyncCall(call);
+}
+
+/*!
+  \brief Removes user with \a uid from \a groups.
+ */
+QDBusPendingReply<> SailfishUserManagerClient::removeFromGroups(uint uid, const QStringList &groups)
+{
+    QDBusMessage call = d->methodCall(QStringLiteral("removeFromGroups"));
+    call.setArguments(QVariantList() << uid << groups);
+    return d->connection.asyncCall(call);
+}
+
+/*!
+  \brief Enables \e {guest user} if \a enable is \c true, otherwise disables
+  it.
+ */
+QDBusPendingReply<> SailfishUserManagerClient::enableGuestUser(bool enable)
+{
+    QDBusMessage call = d->methodCall(QStringLiteral("enableGuestUser"));
+    call.setArguments(QVariantList() << enable);
+    return d->connection.asyncCall(call, JOB_TIMEOUT);
+}
+
+/*!
+  \brief Reads groups of user with \a uid, this is not cached.
+ */
+QDBusPendingReply<QStringList> SailfishUserManagerClient::usersGroups(uint uid)
+{
+    QDBusMessage call = d->methodCall(QStringLiteral("usersGroups"));
+    call.setArguments(QVariantList() << uid);
+    return d->connection.asyncCall(call);
+}
+
+/*!
+  \brief Reads \e UUID of user with \a uid, this is not cached.
+ */
+QDBusPendingReply<QString> SailfishUserManagerClient::userUuid(uint uid)
+{
+    QDBusMessage call = d->methodCall(QStringLiteral("userUuid"));
+    call.setArguments(QVariantList() << uid);
+    return d->connection.asyncCall(call);
+}
+
+void SailfishUserManagerClient::onUserAdded(const SailfishUserManagerEntry &user)
+{
+    if (!d->ready || d->indexOf(user.uid) >= 0)
+        return;
+    d->users.append(user);
+    emit userAdded(user);
+    emit usersChanged();
+}
+
+void SailfishUserManagerClient::onUserRemoved(uint uid)
+{
+    int i = d->indexOf(uid);
+    if (!d->ready || i < 0)
+        return;
+    d->users.removeAt(i);
+    emit userRemoved(uid);
+    emit usersChanged();
+}
+
+void SailfishUserManagerClient::onUserModified(uint uid, const QString &name)
+{
+    int i = d->indexOf(uid);
+    if (!d->ready || i < 0 || d->users.at(i).name == name)
+        return;
+    d->users[i].name = name;
+    emit userModified(uid, name);
+    emit usersChanged();
+}
+
+void SailfishUserManagerClient::onCurrentUserChanged(uint uid)
+{
+    if (!d->ready || d->currentUser == uid)
+        return;
+    d->currentUser = uid;
+    emit currentUserChanged(uid);
+}
+
+void SailfishUserManagerClient::onGuestUserEnabled(bool enabled)
+{
+    Q_UNUSED(enabled)
+
+    if (!d->ready)
+        return;
+    // Guest entry is not announced with userAdded, read it from the daemon
+    load();
+}
+
+void SailfishUserManagerClient::onPropertiesChanged(const QString &interface, const QVariantMap &changed,
+                                                    const QStringList &invalidated)
+{
+    Q_UNUSED(invalidated)
+
+    if (!d->ready || interface != QStringLiteral(SAILFISH_USERMANAGER_DBUS_INTERFACE))
+        return;
+
+    auto it = changed.constFind(QStringLiteral("CurrentUser"));
+    if (it != changed.constEnd())
+        onCurrentUserChanged(it->toUInt());
+}
+
+/*
+ * The daemon was started again, users may have changed while it was not
+ * running. A load in progress is answered by the new instance anyway.
+ */
+void SailfishUserManagerClient::onServiceRegistered()
+{
+    if (!d->loading)
+        load();
+}
+
+/*!
+  \fn void SailfishUserManagerClient::readyChanged()
+  \brief Emitted when \l ready changes.
+ */
+
+/*!
+  \fn void SailfishUserManagerClient::usersChanged()
+  \brief Emitted when the cached list of users has changed.
+ */
+
+/*!
+  \fn void SailfishUserManagerClient::userAdded(const SailfishUserManagerEntry &user)
+  \brief Emitted when \a user has been added.
+ */
+
+/*!
+  \fn void SailfishUserManagerClient::userRemoved(uint uid)
+  \brief Emitted when user with \a uid has been removed.
+ */
+
+/*!
+  \fn void SailfishUserManagerClient::userModified(uint uid, const QString &name)
+  \brief Emitted when name of user with \a uid has changed to \a name.
+ */
+
+/*!
+  \fn void SailfishUserManagerClient::currentUserChanged(uint uid)
+  \brief Emitted when user \a uid has become active on \c seat0.
+ */
+
+/*!
+  \fn void SailfishUserManagerClient::guestUserEnabledChanged(bool enabled)
+  \brief Emitted when \e {guest user} has been \a enabled or disabled.
+ */
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#ifndef SAILFISHUSERMANAGERCLIENT_H
+#define SAILFISHUSERMANAGERCLIENT_H
+
+#include <QDBusConnection>
+#include <QDBusPendingReply>
+#include <QList>
+#include <QObject>
+#include <QStringList>
+#include <QVariantMap>
+
+#include "sailfishusermanagerinterface.h"
+
+#if defined(SAILFISHUSERMANAGER_LIBRARY)
+#  define SAILFISHUSERMANAGER_EXPORT Q_DECL_EXPORT
+#else
+#  define SAILFISHUSERMANAGER_EXPORT Q_DECL_IMPORT
+#endif
+
+class SailfishUserManagerClientPrivate;
+
+class SAILFISHUSERMANAGER_EXPORT SailfishUserManagerClient : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(bool ready READ isReady NOTIFY readyChanged)
+    Q_PROPERTY(uint currentUser READ currentUser NOTIFY currentUserChanged)
+    Q_PROPERTY(bool guestUserEnabled READ isGuestUserEnabled NOTIFY guestUserEnabledChanged)
+    Q_PROPERTY(int userCount READ userCount NOTIFY usersChanged)
+
+public:
+    explicit SailfishUserManagerClient(QObject *parent = nullptr);
+    SailfishUserManagerClient(const QDBusConnection &connection, QObject *parent = nullptr);
+    ~SailfishUserManagerClient();
+
+    bool isReady() const;
+    QList<SailfishUserManagerEntry> users() const;
+    bool user(uint uid, SailfishUserManagerEntry *entry = nullptr) const;
+    int userCount() const;
+    uint currentUser() const;
+    bool isGuestUserEnabled() const;
+
+    QDBusPendingReply<uint> addUser(const QString &name);
+    QDBusPendingReply<> removeUser(uint uid);
+    QDBusPendingReply<> modifyUser(uint uid, const QString &name);
+    QDBusPendingReply<> setCurrentUser(uint uid);
+    QDBusPendingReply<> setSeatCurrentUser(const QString &seat, uint uid);
+    QDBusPendingReply<> addToGroups(uint uid, const QStringList &groups);
+    QDBusPendingReply<> removeFromGroups(uint uid, const QStringList &groups);
+    QDBusPendingReply<> enableGuestUser(bool enable);
+    QDBusPendingReply<QStringList> usersGroups(uint uid);
+    QDBusPendingReply<QString> userUuid(uint uid);
+
+signals:
+    void readyChanged();
+    void usersChanged();
+    void userAdded(const SailfishUserManagerEntry &user);
+    void userRemoved(uint uid);
+    void userModified(uint uid, const QString &name);
+    void currentUserChanged(uint uid);
+    void guestUserEnabledChanged(bool enabled);
+
+private slots:
+    void onUserAdded(const SailfishUserManagerEntry &user);
+    void onUserRemoved(uint uid);
+    void onUserModified(uint uid, const QString &name);
+    void onCurrentUserChanged(uint uid);
+    void onGuestUserEnabled(bool enabled);
+    void onPropertiesChanged(const QString &interface, const QVariantMap &changed, const QStringList &invalidated);
+    void onServiceRegistered();
+
+private:
+    void init();
+    void load();
+
+    SailfishUserManagerClientPrivate *d;
+};
+
+#endif // SAILFISHUSERMANAGERCLIENT_H
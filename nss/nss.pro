@@ -0,0 +1,22 @@
+TEMPLATE = lib
+
+CONFIG -= qt
+CONFIG += plugin no_plugin_name_prefix
+
+# glibc loads NSS modules as libnss_<service>.so.2
+TARGET = libnss_sailfish
+QMAKE_EXTENSION_SHLIB = so.2
+
+INCLUDEPATH += ../src
+
+SOURCES += \
+    nss_sailfish.c
+
+HEADERS += \
+    ../src/usersnapshot.h
+
+LIBS += -lpthread
+
+target.path = $$[QT_INSTALL_LIBS]
+
+INSTALLS += target
@@ -0,0 +1,432 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+/*
+ * NSS module for passwd and group databases that reads the user snapshot
+ * written by user-managerd. Lookups are hash table reads from a mapped file.
+ * If the snapshot is missing, invalid or older than /etc/passwd or
+ * /etc/group, the module returns NSS_STATUS_UNAVAIL so that the next module,
+ * e.g. files, answers instead. Enumeration is not provided.
+ *
+ *     passwd: sailfish files
+ *     group: sailfish files
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <nss.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "usersnapshot.h"
+
+/* Paths can be overridden when the module is built into a test */
+#ifndef PASSWD_PATH
+#define PASSWD_PATH "/etc/passwd"
+#endif
+#ifndef GROUP_PATH
+#define GROUP_PATH "/etc/group"
+#endif
+#ifndef SNAPSHOT_PATH
+#define SNAPSHOT_PATH USER_SNAPSHOT_PATH
+#endif
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static const char *s_base;
+static size_t s_size;
+static struct stat s_stat;
+
+static int same_source(const char *path, const struct user_snapshot_source *source)
+{
+    struct stat info;
+    return stat(path, &info) == 0
+            && (uint64_t)info.st_dev == source->device
+            && (uint64_t)info.st_ino == source->inode
+            && (uint64_t)info.st_size == source->size
+            && info.st_mtim.tv_sec == source->mtime_sec
+            && info.st_mtim.tv_nsec == source->mtime_nsec;
+}
+
+static int section_valid(uint32_t offset, uint32_t count, uint32_t size, uint32_t total)
+{
+    return offset <= total && count <= (total - offset) / size;
+}
+
+static int snapshot_valid(const char *base, size_t size)
+{
+    const struct user_snapshot_header *header = (const struct user_snapshot_header *)base;
+    if (size < sizeof(*header) || header->magic != USER_SNAPSHOT_MAGIC
+            || header->version != USER_SNAPSHOT_VERSION || header->size != size)
+        return 0;
+
+    /* Index size must be a power of two for masking */
+    if (header->index_size == 0 || (header->index_size & (header->index_size - 1)) != 0)
+        return 0;
+
+    if (!section_valid(header->users, header->user_count, sizeof(struct user_snapshot_user), size)
+            || !section_valid(header->groups, header->group_count, sizeof(struct user_snapshot_group), size)
+            || !section_valid(header->lists, header->list_count, sizeof(uint32_t), size)
+            || !section_valid(header->users_by_uid, header->index_size, sizeof(uint32_t), size)
+            || !section_valid(header->users_by_name, header->index_size, sizeof(uint32_t), size)
+            || !section_valid(header->groups_by_gid, header->index_size, sizeof(uint32_t), size)
+            || !section_valid(header->groups_by_name, header->index_size, sizeof(uint32_t), size)
+            || !section_valid(header->strings, header->strings_size, 1, size))
+        return 0;
+
+    /* Every string ends before the end of the table */
+    if (header->strings_size > 0 && base[header->strings + header->strings_size - 1] != '\0')
+        return 0;
+
+    return user_snapshot_hash_bytes(2166136261u, base + sizeof(*header),
+                                    size - sizeof(*header)) == header->checksum;
+}
+
+/* Maps a new snapshot if the file has been replaced, called with s_lock */
+static void remap(void)
+{
+    struct stat info;
+    int fd;
+    void *base;
+
+    if (stat(SNAPSHOT_PATH, &info) < 0) {
+        memset(&info, 0, sizeof(info));
+    } else if (s_base && info.st_dev == s_stat.st_dev && info.st_ino == s_stat.st_ino
+               && info.st_size == s_stat.st_size && info.st_mtim.tv_sec == s_stat.st_mtim.tv_sec
+               && info.st_mtim.tv_nsec == s_stat.st_mtim.tv_nsec) {
+        return;
+    }
+
+    if (s_base) {
+        munmap((void *)s_base, s_size);
+        s_base = NULL;
+        s_size = 0;
+    }
+
+    if (info.st_size <= 0)
+        return;
+
+    fd = open(SNAPSHOT_PATH, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    if (fstat(fd, &info) < 0 || info.st_size <= 0) {
+        close(fd);
+        return;
+    }
+    base = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return;
+
+    if (!snapshot_valid(base, info.st_size)) {
+        munmap(base, info.st_size);
+        return;
+    }
+
+    s_base = base;
+    s_size = info.st_size;
+    s_stat = info;
+}
+
+/* Locks and returns current snapshot, or unlocks and returns NULL */
+static const struct user_snapshot_header *acquire(void)
+{
+    const struct user_snapshot_header *header;
+
+    pthread_mutex_lock(&s_lock);
+    remap();
+    header = (const struct user_snapshot_header *)s_base;
+    if (!header || !same_source(PASSWD_PATH, &header->passwd) || !same_source(GROUP_PATH, &header->group)) {
+        pthread_mutex_unlock(&s_lock);
+        return NULL;
+    }
+    return header;
+}
+
+static void release(void)
+{
+    pthread_mutex_unlock(&s_lock);
+}
+
+static const uint32_t *table(const struct user_snapshot_header *header, uint32_t offset)
+{
+    return (const uint32_t *)((const char *)header + offset);
+}
+
+static const char *string(const struct user_snapshot_header *header, uint32_t offset)
+{
+    if (offset >= header->strings_size)
+        return "";
+    return (const char *)header + header->strings + offset;
+}
+
+static const struct user_snapshot_user *user_at(const struct user_snapshot_header *header, uint32_t index)
+{
+    if (index >= header->user_count)
+        return NULL;
+    return (const struct user_snapshot_user *)((const char *)header + header->users) + index;
+}
+
+static const struct user_snapshot_group *group_at(const struct user_snapshot_header *header, uint32_t index)
+{
+    if (index >= header->group_count)
+        return NULL;
+    return (const struct user_snapshot_group *)((const char *)header + header->groups) + index;
+}
+
+static const struct user_snapshot_user *find_user_by_uid(const struct user_snapshot_header *header, uid_t uid)
+{
+    const uint32_t *slots = table(header, header->users_by_uid);
+    uint32_t mask = header->index_size - 1;
+    uint32_t slot = user_snapshot_hash_id(uid) & mask;
+    uint32_t probes;
+    for (probes = 0; probes < header->index_size && slots[slot] != USER_SNAPSHOT_NONE; probes++) {
+        const struct user_snapshot_user *user = user_at(header, slots[slot]);
+        if (user && user->uid == uid)
+            return user;
+        slot = (slot + 1) & mask;
+    }
+    return NULL;
+}
+
+static const struct user_snapshot_user *find_user_by_name(const struct user_snapshot_header *header,
+                                                          const char *name)
+{
+    const uint32_t *slots = table(header, header->users_by_name);
+    uint32_t mask = header->index_size - 1;
+    uint32_t slot = user_snapshot_hash_name(name) & mask;
+    uint32_t probes;
+    for (probes = 0; probes < header->index_size && slots[slot] != USER_SNAPSHOT_NONE; probes++) {
+        const struct user_snapshot_user *user = user_at(header, slots[slot]);
+        if (user && strcmp(string(header, user->name), name) == 0)
+            return user;
+        slot = (slot + 1) & mask;
+    }
+    return NULL;
+}
+
+static const struct user_snapshot_group *find_group_by_gid(const struct user_snapshot_header *header, gid_t gid)
+{
+    const uint32_t *slots = table(header, header->groups_by_gid);
+    uint32_t mask = header->index_size - 1;
+    uint32_t slot = user_snapshot_hash_id(gid) & mask;
+    uint32_t probes;
+    for (probes = 0; probes < header->index_size && slots[slot] != USER_SNAPSHOT_NONE; probes++) {
+        const struct user_snapshot_group *group = group_at(header, slots[slot]);
+        if (group && group->gid == gid)
+            return group;
+        slot = (slot + 1) & mask;
+    }
+    return NULL;
+}
+
+static const struct user_snapshot_group *find_group_by_name(const struct user_snapshot_header *header,
+                                                            const char *name)
+{
+    const uint32_t *slots = table(header, header->groups_by_name);
+    uint32_t mask = header->index_size - 1;
+    uint32_t slot = user_snapshot_hash_name(name) & mask;
+    uint32_t probes;
+    for (probes = 0; probes < header->index_size && slots[slot] != USER_SNAPSHOT_NONE; probes++) {
+        const struct user_snapshot_group *group = group_at(header, slots[slot]);
+        if (group && strcmp(string(header, group->name), name) == 0)
+            return group;
+        slot = (slot + 1) & mask;
+    }
+    return NULL;
+}
+
+/* Copies string to buffer, returns NULL if it does not fit */
+static char *copy_string(const char *source, char **buffer, size_t *remaining)
+{
+    size_t length = strlen(source) + 1;
+    char *rv = *buffer;
+    if (length > *remaining)
+        return NULL;
+    memcpy(rv, source, length);
+    *buffer += length;
+    *remaining -= length;
+    return rv;
+}
+
+static enum nss_status fill_passwd(const struct user_snapshot_header *header,
+                                   const struct user_snapshot_user *user, struct passwd *pwd,
+                                   char *buffer, size_t buflen, int *errnop)
+{
+    pwd->pw_uid = user->uid;
+    pwd->pw_gid = user->gid;
+    if (!(pwd->pw_name = copy_string(string(header, user->name), &buffer, &buflen))
+            || !(pwd->pw_passwd = copy_string("x", &buffer, &buflen))
+            || !(pwd->pw_gecos = copy_string(string(header, user->gecos), &buffer, &buflen))
+            || !(pwd->pw_dir = copy_string(string(header, user->home), &buffer, &buflen))
+            || !(pwd->pw_shell = copy_string(string(header, user->shell), &buffer, &buflen))) {
+        *errnop = ERANGE;
+        return NSS_STATUS_TRYAGAIN;
+    }
+    return NSS_STATUS_SUCCESS;
+}
+
+static enum nss_status fill_group(const struct user_snapshot_header *header,
+                                  const struct user_snapshot_group *group, struct group *grp,
+                                  char *buffer, size_t buflen, int *errnop)
+{
+    const uint32_t *lists = table(header, header->lists);
+    size_t padding = (sizeof(char *) - ((uintptr_t)buffer % sizeof(char *))) % sizeof(char *);
+    size_t pointers = (group->member_count + 1) * sizeof(char *);
+    uint32_t i;
+
+    if (group->members > header->list_count || group->member_count > header->list_count - group->members
+            || padding + pointers > buflen) {
+        *errnop = ERANGE;
+        return NSS_STATUS_TRYAGAIN;
+    }
+    grp->gr_mem = (char **)(buffer + padding);
+    buffer += padding + pointers;
+    buflen -= padding + pointers;
+
+    grp->gr_gid = group->gid;
+    if (!(grp->gr_name = copy_string(string(header, group->name), &buffer, &buflen))
+            || !(grp->gr_passwd = copy_string("x", &buffer, &buflen))) {
+        *errnop = ERANGE;
+        return NSS_STATUS_TRYAGAIN;
+    }
+    for (i = 0; i < group->member_count; i++) {
+        if (!(grp->gr_mem[i] = copy_string(string(header, lists[group->members + i]), &buffer, &buflen))) {
+            *errnop = ERANGE;
+            return NSS_STATUS_TRYAGAIN;
+        }
+    }
+    grp->gr_mem[group->member_count] = NULL;
+    return NSS_STATUS_SUCCESS;
+}
+
+enum nss_status _nss_sailfish_getpwuid_r(uid_t uid, struct passwd *pwd, char *buffer, size_t buflen,
+                                         int *errnop)
+{
+    const struct user_snapshot_header *header = acquire();
+    const struct user_snapshot_user *user;
+    enum nss_status rv = NSS_STATUS_NOTFOUND;
+
+    if (!header) {
+        *errnop = ENOENT;
+        return NSS_STATUS_UNAVAIL;
+    }
+    user = find_user_by_uid(header, uid);
+    if (user)
+        rv = fill_passwd(header, user, pwd, buffer, buflen, errnop);
+    release();
+    return rv;
+}
+
+enum nss_status _nss_sailfish_getpwnam_r(const char *name, struct passwd *pwd, char *buffer, size_t buflen,
+                                         int *errnop)
+{
+    const struct user_snapshot_header *header = acquire();
+    const struct user_snapshot_user *user;
+    enum nss_status rv = NSS_STATUS_NOTFOUND;
+
+    if (!header) {
+        *errnop = ENOENT;
+        return NSS_STATUS_UNAVAIL;
+    }
+    user = find_user_by_name(header, name);
+    if (user)
+        rv = fill_passwd(header, user, pwd, buffer, buflen, errnop);
+    release();
+    return rv;
+}
+
+enum nss_status _nss_sailfish_getgrgid_r(gid_t gid, struct group *grp, char *buffer, size_t buflen,
+                                         int *errnop)
+{
+    const struct user_snapshot_header *header = acquire();
+    const struct user_snapshot_group *group;
+    enum nss_status rv = NSS_STATUS_NOTFOUND;
+
+    if (!header) {
+        *errnop = ENOENT;
+        return NSS_STATUS_UNAVAIL;
+    }
+    group = find_group_by_gid(header, gid);
+    if (group)
+        rv = fill_group(header, group, grp, buffer, buflen, errnop);
+    release();
+    return rv;
+}
+
+enum nss_status _nss_sailfish_getgrnam_r(const char *name, struct group *grp, char *buffer, size_t buflen,
+                                         int *errnop)
+{
+    const struct user_snapshot_header *header = acquire();
+    const struct user_snapshot_group *group;
+    enum nss_status rv = NSS_STATUS_NOTFOUND;
+
+    if (!header) {
+        *errnop = ENOENT;
+        return NSS_STATUS_UNAVAIL;
+    }
+    group = find_group_by_name(header, name);
+    if (group)
+        rv = fill_group(header, group, grp, buffer, buflen, errnop);
+    release();
+    return rv;
+}
+
+/* Supplementary groups of a managed user, other users are left to files */
+enum nss_status _nss_sailfish_initgroups_dyn(const char *name, gid_t skip, long int *start, long int *size,
+                                             gid_t **groupsp, long int limit, int *errnop)
+{
+    const struct user_snapshot_header *header = acquire();
+    const struct user_snapshot_user *user;
+    const uint32_t *lists;
+    uint32_t i;
+    enum nss_status rv = NSS_STATUS_SUCCESS;
+
+    if (!header) {
+        *errnop = ENOENT;
+        return NSS_STATUS_UNAVAIL;
+    }
+    user = find_user_by_name(header, name);
+    if (!user || user->groups > header->list_count || user->group_count > header->list_count - user->groups) {
+        release();
+        return NSS_STATUS_NOTFOUND;
+    }
+
+    lists = table(header, header->lists);
+    for (i = 0; i < user->group_count; i++) {
+        const struct user_snapshot_group *group = group_at(header, lists[user->groups + i]);
+        if (!group || group->gid == skip)
+            continue;
+
+        if (*start == *size) {
+            long int newSize;
+            gid_t *groups;
+            if (limit > 0 && *size == limit)
+                break;
+            newSize = *size > 0 ? *size * 2 : 16;
+            if (limit > 0 && newSize > limit)
+                newSize = limit;
+            groups = realloc(*groupsp, newSize * sizeof(gid_t));
+            if (!groups) {
+                *errnop = ENOMEM;
+                rv = NSS_STATUS_TRYAGAIN;
+                break;
+            }
+            *groupsp = groups;
+            *size = newSize;
+        }
+        (*groupsp)[(*start)++] = group->gid;
+    }
+    release();
+    return rv;
+}
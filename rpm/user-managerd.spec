@@ -7,6 +7,7 @@ Source0: %{name}-%{version}.tar.gz
 URL: https://github.com/sailfishos/user-managerd/
 BuildRequires: pkgconfig(Qt5Core)
 BuildRequires: pkgconfig(Qt5DBus)
+BuildRequires: pkgconfig(Qt5Concurrent)
 BuildRequires: pkgconfig(libuser)
 BuildRequires: pkgconfig(sailfishaccesscontrol) >= 0.0.3
 BuildRequires: pkgconfig(libsystemd)
@@ -32,10 +33,18 @@ Summary: Sailfish User Manager Daemon documentation
 %description doc
 %{summary}.
 
+%package nss
+Summary: NSS module for Sailfish users
+Requires: user-managerd
+
+%description nss
+%{summary}.
+
 %files
 %defattr(-,root,root,-)
 %license LICENSE
 %{_bindir}/%{name}
+%{_libdir}/libsailfishusermanager.so.*
 %{_unitdir}/dbus-org.sailfishos.usermanager.service
 %{_unitdir}/home-sailfish_guest.mount
 %{_unitdir}/*/home-sailfish_guest.mount
@@ -47,9 +56,16 @@ Summary: Sailfish User Manager Daemon documentation
 %{_datadir}/user-managerd/remove.d
 %{_datadir}/user-managerd/create.d
 %{_datadir}/user-managerd/pre-switch.d
+%{_libdir}/user-managerd/hooks
+
+%files nss
+%defattr(-,root,root,-)
+%license LICENSE
+%{_libdir}/libnss_sailfish.so.2
 
 %files devel
 %{_prefix}/include/sailfishusermanager
+%{_libdir}/libsailfishusermanager.so
 %{_libdir}/pkgconfig/sailfishusermanager.pc
 
 %files doc
@@ -68,6 +84,7 @@ make %{?_smp_mflags}
 mkdir -p %{buildroot}%{_datadir}/user-managerd/remove.d
 mkdir -p %{buildroot}%{_datadir}/user-managerd/create.d
 mkdir -p %{buildroot}%{_datadir}/user-managerd/pre-switch.d
+mkdir -p %{buildroot}%{_libdir}/user-managerd/hooks
 mkdir -p %{buildroot}%{_unitdir}/user@105000.service.wants/
 ln -s ../home-sailfish_guest.mount %{buildroot}%{_unitdir}/user@105000.service.wants/
 mkdir -p %{buildroot}%{_unitdir}/autologin@105000.service.wants/
@@ -81,10 +98,16 @@ cp -R doc/html/* %{buildroot}/%{_docdir}/%{name}/
 systemctl stop dbus-org.sailfishos.usermanager.service || :
 
 %post
+/sbin/ldconfig
 systemctl daemon-reload
 sed -i 's/^\#USERDEL_CMD.*/USERDEL_CMD \/usr\/sbin\/userdel_local.sh/' /etc/login.defs
 
+%post nss -p /sbin/ldconfig
+
+%postun nss -p /sbin/ldconfig
+
 %postun
+/sbin/ldconfig
 if [ $1 -eq 0 ]; then
     sed -i 's/^USERDEL_CMD.*/\#USERDEL_CMD/' /etc/login.defs
 fi
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#include "accountlanes.h"
+#include "libuserhelper.h"
+#include "logging.h"
+
+#include <QThread>
+#include <QThreadPool>
+
+namespace {
+const int MAX_READERS = 4;
+// Generations of consecutive writes remembered for written()
+const int MAX_WRITTEN = 64;
+}
+
+AccountLanes::AccountLanes(QObject *parent) :
+    QObject(parent),
+    m_lu(new LibUserHelper()),
+    m_writer(new QThreadPool),
+    m_readers(new QThreadPool),
+    m_writing(false)
+{
+    // libuser is not thread safe, keep a single writer thread alive
+    m_writer->setMaxThreadCount(1);
+    m_writer->setExpiryTimeout(-1);
+    m_readers->setMaxThreadCount(qBound(1, QThread::idealThreadCount(), MAX_READERS));
+
+    // Nothing runs in the lanes yet
+    publish(0);
+}
+
+AccountLanes::~AccountLanes()
+{
+    // Writes are never abandoned half way
+    m_writer->waitForDone();
+    m_readers->waitForDone();
+    delete m_readers;
+    m_readers = nullptr;
+    delete m_writer;
+    m_writer = nullptr;
+    delete m_lu;
+    m_lu = nullptr;
+}
+
+/*
+ * Returns the latest snapshot. If account files were changed outside of the
+ * daemon, the caller parses them into a new snapshot instead of waiting for
+ * the writer lane, and publishes it unless the writer published meanwhile.
+ */
+AccountLanes::Snapshot AccountLanes::snapshot() const
+{
+    Snapshot current = std::atomic_load(&m_snapshot);
+    if (current->isCurrent())
+        return current;
+
+    std::shared_ptr<AccountReader> fresh = std::make_shared<AccountReader>(*current);
+    fresh->refresh();
+    std::atomic_compare_exchange_strong(&m_snapshot, &current, Snapshot(fresh));
+    return fresh;
+}
+
+QThreadPool *AccountLanes::readers() const
+{
+    return m_readers;
+}
+
+// Whether a write is running or queued, accessed from the thread of the lanes
+bool AccountLanes::writing() const
+{
+    return m_writing;
+}
+
+/*
+ * Queued writes are started one at a time, so that a caller with many
+ * writes queued waits for a turn after each of them.
+ */
+void AccountLanes::enqueue(const QString &caller, const std::function<void()> &start)
+{
+    if (!m_queued.contains(caller))
+        m_turns.append(caller);
+    m_queued[caller].enqueue(start);
+    if (!m_writing)
+        next();
+}
+
+// Starts the next queued write, called when the previous one is done
+void AccountLanes::next()
+{
+    if (m_turns.isEmpty()) {
+        m_writing = false;
+        return;
+    }
+
+    const QString caller = m_turns.takeFirst();
+    QQueue<std::function<void()>> &queue = m_queued[caller];
+    const std::function<void()> start = queue.dequeue();
+    if (queue.isEmpty())
+        m_queued.remove(caller);
+    else
+        m_turns.append(caller);
+
+    m_writing = true;
+    start();
+}
+
+/*
+ * Returns true if account databases went from generation from to generation
+ * to only by writes of the lanes, e.g. to update derived state incrementally
+ * instead of rebuilding it. Only a limited number of generations is kept.
+ */
+bool AccountLanes::written(quint64 from, quint64 to) const
+{
+    QMutexLocker locker(&m_writtenMutex);
+    const int first = m_written.indexOf(from);
+    return first >= 0 && m_written.indexOf(to, first) >= 0;
+}
+
+// Generation before a write in the writer lane, 0 if changed outside of it
+quint64 AccountLanes::base() const
+{
+    const AccountReader *accounts = m_lu->accounts();
+    return accounts->isCurrent() ? accounts->generation() : 0;
+}
+
+// Called in the writer lane after every write
+void AccountLanes::publish(quint64 base)
+{
+    AccountReader *accounts = m_lu->accounts();
+    accounts->refresh();
+    std::atomic_store(&m_snapshot, Snapshot(std::make_shared<AccountReader>(*accounts)));
+
+    QMutexLocker locker(&m_writtenMutex);
+    if (base == 0) {
+        m_written.clear();
+        return;
+    }
+    if (m_written.isEmpty() || m_written.last() != base)
+        m_written = QVector<quint64>() << base;
+    else if (m_written.count() >= MAX_WRITTEN)
+        m_written.removeFirst();
+    m_written.append(accounts->generation());
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#ifndef ACCOUNTLANES_H
+#define ACCOUNTLANES_H
+
+#include "accountreader.h"
+
+#include <QFutureWatcher>
+#include <QHash>
+#include <QMutex>
+#include <QObject>
+#include <QPointer>
+#include <QQueue>
+#include <QStringList>
+#include <QVector>
+#include <QtConcurrentRun>
+
+#include <functional>
+#include <memory>
+
+class LibUserHelper;
+class QThreadPool;
+
+// Execution lanes for account databases. Writes through libuser run one at
+// a time in the writer lane, which publishes an immutable snapshot of the
+// databases after each write. Reads take the latest snapshot from any thread
+// without waiting for writes. Coalesced D-Bus reads are computed in the
+// reader lane. Writes are queued per caller and callers are served in turns.
+class AccountLanes : public QObject
+{
+    Q_OBJECT
+
+public:
+    typedef std::shared_ptr<const AccountReader> Snapshot;
+
+    explicit AccountLanes(QObject *parent = nullptr);
+    ~AccountLanes();
+
+    Snapshot snapshot() const;
+    QThreadPool *readers() const;
+    bool writing() const;
+    bool written(quint64 from, quint64 to) const;
+
+    // Queues work of caller to the writer lane and runs done with its result
+    // in the thread of context. Must be called from the thread of the lanes.
+    template<typename T>
+    void write(const QString &caller, const std::function<T(LibUserHelper *)> &work, QObject *context,
+               const std::function<void(T)> &done);
+
+private slots:
+    void next();
+
+private:
+    quint64 base() const;
+    void publish(quint64 base);
+    void enqueue(const QString &caller, const std::function<void()> &start);
+
+    LibUserHelper *m_lu;
+    QThreadPool *m_writer;
+    QThreadPool *m_readers;
+    // Only accessed with std::atomic_load, std::atomic_store and std::atomic_compare_exchange_strong
+    mutable Snapshot m_snapshot;
+    // Writes not started yet by caller and callers in turn order
+    QHash<QString, QQueue<std::function<void()>>> m_queued;
+    QStringList m_turns;
+    bool m_writing;
+    // Generations of consecutive writes with no outside changes in between
+    mutable QMutex m_writtenMutex;
+    QVector<quint64> m_written;
+};
+
+template<typename T>
+void AccountLanes::write(const QString &caller, const std::function<T(LibUserHelper *)> &work, QObject *context,
+                         const std::function<void(T)> &done)
+{
+    QFutureWatcher<T> *watcher = new QFutureWatcher<T>(context);
+    QObject::connect(watcher, &QFutureWatcherBase::finished, context, [watcher, done]() {
+        watcher->deleteLater();
+        done(watcher->result());
+    });
+    // Work is done even if context is gone before it starts
+    QPointer<QFutureWatcher<T>> guard(watcher);
+    LibUserHelper *lu = m_lu;
+    enqueue(caller, [this, guard, lu, work]() {
+        QFuture<T> future = QtConcurrent::run(m_writer, [this, lu, work]() {
+            const quint64 generation = base();
+            T result = work(lu);
+            publish(generation);
+            QMetaObject::invokeMethod(this, "next", Qt::QueuedConnection);
+            return result;
+        });
+        if (guard)
+            guard->setFuture(future);
+    });
+}
+
+#endif // ACCOUNTLANES_H
@@ -0,0 +1,516 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#include "accountreader.h"
+#include "logging.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const int PASSWD_FIELDS = 7;
+const int GROUP_FIELDS = 4;
+
+class MappedFile
+{
+public:
+    explicit MappedFile(const QString &path) :
+        m_data(nullptr),
+        m_size(0)
+    {
+        int fd = open(path.toUtf8().constData(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            if (errno != ENOENT)
+                qCWarning(lcSUM) << "Could not open" << path << strerror(errno);
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                m_data = static_cast<const char *>(data);
+                m_size = st.st_size;
+            } else {
+                qCWarning(lcSUM) << "Could not map" << path << strerror(errno);
+            }
+        }
+        close(fd);
+    }
+
+    ~MappedFile()
+    {
+        if (m_data)
+            munmap(const_cast<char *>(m_data), m_size);
+    }
+
+    const char *begin() const { return m_data; }
+    const char *end() const { return m_data + m_size; }
+
+private:
+    Q_DISABLE_COPY(MappedFile)
+
+    const char *m_data;
+    size_t m_size;
+};
+
+// Splits line to colon separated fields, returns true if there were exactly count fields
+bool splitFields(const char *begin, const char *end, const char **fields, int count)
+{
+    int i = 0;
+    fields[i++] = begin;
+    for (const char *p = begin; p < end; p++) {
+        if (*p == ':') {
+            if (i == count)
+                return false;
+            fields[i++] = p + 1;
+        }
+    }
+    fields[count] = end + 1; // Field i ends at fields[i + 1] - 1
+    return i == count;
+}
+
+bool parseId(const char *begin, const char *end, quint32 *id)
+{
+    if (begin == end || end - begin > 10)
+        return false;
+    quint64 value = 0;
+    for (const char *p = begin; p < end; p++) {
+        if (*p < '0' || *p > '9')
+            return false;
+        value = value * 10 + (*p - '0');
+    }
+    if (value > 0xffffffffULL)
+        return false;
+    *id = quint32(value);
+    return true;
+}
+
+bool skipLine(const char *begin, const char *end)
+{
+    // Empty lines, comments and NIS compat entries are not accounts
+    return begin == end || *begin == '#' || *begin == '+' || *begin == '-';
+}
+
+} // namespace
+
+AccountReader::AccountReader(const QString &passwdPath, const QString &groupPath) :
+    m_generation(0)
+{
+    m_passwd = { passwdPath, 0, 0, 0, 0, false, false };
+    m_group = { groupPath, 0, 0, 0, 0, false, false };
+}
+
+// Updates state from the file, returns true if it differs from earlier state
+bool AccountReader::stat(FileState *state)
+{
+    struct stat st;
+    bool exists = ::stat(state->path.toUtf8().constData(), &st) == 0;
+    qint64 mtime = exists ? qint64(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec : 0;
+
+    if (state->loaded && state->exists == exists
+            && (!exists || (state->device == st.st_dev && state->inode == st.st_ino
+                            && state->size == st.st_size && state->mtime == mtime)))
+        return false;
+
+    state->exists = exists;
+    state->device = exists ? st.st_dev : 0;
+    state->inode = exists ? st.st_ino : 0;
+    state->size = exists ? st.st_size : 0;
+    state->mtime = mtime;
+    return true;
+}
+
+bool AccountReader::changed(FileState *state)
+{
+    // Stat before reading, a later replacement is then noticed on next refresh
+    bool rv = stat(state) || !state->loaded;
+    state->loaded = true;
+    return rv;
+}
+
+/*
+ * Generation is derived from identities of the files, so that it stays the
+ * same for the same files over daemon restarts and copies refreshed in other
+ * threads, and changes whenever refresh() would load something. Zero is
+ * never a generation.
+ */
+quint64 AccountReader::generationOf(const FileState &passwd, const FileState &group)
+{
+    quint64 hash = 14695981039346656037ULL;
+    auto mix = [&hash](quint64 value) {
+        for (int i = 0; i < 8; i++) {
+            hash ^= (value >> (8 * i)) & 0xff;
+            hash *= 1099511628211ULL;
+        }
+    };
+    for (const FileState *state : { &passwd, &group }) {
+        mix(state->exists);
+        mix(state->device);
+        mix(state->inode);
+        mix(state->size);
+        mix(state->mtime);
+    }
+    return hash ? hash : 1;
+}
+
+void AccountReader::refresh()
+{
+    bool reloaded = false;
+    if (changed(&m_passwd)) {
+        loadUsers();
+        reloaded = true;
+    }
+    if (changed(&m_group)) {
+        loadGroups();
+        reloaded = true;
+    }
+    if (reloaded)
+        m_generation = generationOf(m_passwd, m_group);
+}
+
+// Returns true if refresh() would not load anything
+bool AccountReader::isCurrent() const
+{
+    FileState passwd = m_passwd;
+    FileState group = m_group;
+    return passwd.loaded && group.loaded && !stat(&passwd) && !stat(&group);
+}
+
+quint64 AccountReader::generation() const
+{
+    return m_generation;
+}
+
+quint32 AccountReader::addString(QByteArray *strings, const char *begin, const char *end)
+{
+    quint32 offset = strings->size();
+    strings->append(begin, end - begin);
+    strings->append('\0');
+    return offset;
+}
+
+const char *AccountReader::userString(quint32 offset) const
+{
+    return m_userStrings.constData() + offset;
+}
+
+const char *AccountReader::groupString(quint32 offset) const
+{
+    return m_groupStrings.constData() + offset;
+}
+
+void AccountReader::loadUsers()
+{
+    qCDebug(lcSUM) << "Loading users from" << m_passwd.path;
+
+    m_userStrings.clear();
+    m_users.clear();
+    m_usersByUid.clear();
+    m_usersByName.clear();
+
+    MappedFile file(m_passwd.path);
+    if (!file.begin())
+        return;
+
+    m_userStrings.reserve(file.end() - file.begin());
+
+    const char *fields[PASSWD_FIELDS + 1];
+    for (const char *line = file.begin(); line < file.end();) {
+        const char *lineEnd = static_cast<const char *>(memchr(line, '\n', file.end() - line));
+        if (!lineEnd)
+            lineEnd = file.end();
+
+        UserRecord record;
+        if (!skipLine(line, lineEnd) && splitFields(line, lineEnd, fields, PASSWD_FIELDS)
+                && parseId(fields[2], fields[3] - 1, &record.uid)
+                && parseId(fields[3], fields[4] - 1, &record.gid)) {
+            record.name = addString(&m_userStrings, fields[0], fields[1] - 1);
+            record.gecos = addString(&m_userStrings, fields[4], fields[5] - 1);
+            record.home = addString(&m_userStrings, fields[5], fields[6] - 1);
+            record.shell = addString(&m_userStrings, fields[6], fields[7] - 1);
+            m_users.append(record);
+        }
+
+        line = lineEnd + 1;
+    }
+
+    m_usersByUid.resize(m_users.size());
+    for (int i = 0; i < m_users.size(); i++)
+        m_usersByUid[i] = i;
+    m_usersByName = m_usersByUid;
+
+    // Stable sorts, the first entry in file wins like in nss_files
+    std::stable_sort(m_usersByUid.begin(), m_usersByUid.end(), [this](quint32 a, quint32 b) {
+        return m_users.at(a).uid < m_users.at(b).uid;
+    });
+    std::stable_sort(m_usersByName.begin(), m_usersByName.end(), [this](quint32 a, quint32 b) {
+        return strcmp(userString(m_users.at(a).name), userString(m_users.at(b).name)) < 0;
+    });
+}
+
+void AccountReader::loadGroups()
+{
+    qCDebug(lcSUM) << "Loading groups from" << m_group.path;
+
+    m_groupStrings.clear();
+    m_groups.clear();
+    m_groupsByGid.clear();
+    m_groupsByName.clear();
+    m_groupsOfUser.clear();
+    m_membersOfGroup.clear();
+
+    MappedFile file(m_group.path);
+    if (!file.begin())
+        return;
+
+    m_groupStrings.reserve(file.end() - file.begin());
+
+    const char *fields[GROUP_FIELDS + 1];
+    for (const char *line = file.begin(); line < file.end();) {
+        const char *lineEnd = static_cast<const char *>(memchr(line, '\n', file.end() - line));
+        if (!lineEnd)
+            lineEnd = file.end();
+
+        GroupRecord record;
+        if (!skipLine(line, lineEnd) && splitFields(line, lineEnd, fields, GROUP_FIELDS)
+                && parseId(fields[2], fields[3] - 1, &record.gid)) {
+            record.name = addString(&m_groupStrings, fields[0], fields[1] - 1);
+            const QString group = QString::fromUtf8(fields[0], fields[1] - 1 - fields[0]);
+            QStringList &members = m_membersOfGroup[group];
+            const char *member = fields[3];
+            const char *membersEnd = fields[4] - 1;
+            while (member < membersEnd) {
+                const char *memberEnd = static_cast<const char *>(memchr(member, ',', membersEnd - member));
+                if (!memberEnd)
+                    memberEnd = membersEnd;
+                if (memberEnd > member) {
+                    const QString user = QString::fromUtf8(member, memberEnd - member);
+                    members.append(user);
+                    m_groupsOfUser[user].append(group);
+                }
+                member = memberEnd + 1;
+            }
+            m_groups.append(record);
+        }
+
+        line = lineEnd + 1;
+    }
+
+    m_groupsByGid.resize(m_groups.size());
+    for (int i = 0; i < m_groups.size(); i++)
+        m_groupsByGid[i] = i;
+    m_groupsByName = m_groupsByGid;
+
+    std::stable_sort(m_groupsByGid.begin(), m_groupsByGid.end(), [this](quint32 a, quint32 b) {
+        return m_groups.at(a).gid < m_groups.at(b).gid;
+    });
+    std::stable_sort(m_groupsByName.begin(), m_groupsByName.end(), [this](quint32 a, quint32 b) {
+        return strcmp(groupString(m_groups.at(a).name), groupString(m_groups.at(b).name)) < 0;
+    });
+}
+
+int AccountReader::userIndex(uint uid) const
+{
+    auto it = std::lower_bound(m_usersByUid.constBegin(), m_usersByUid.constEnd(), uid,
+                               [this](quint32 index, uint uid) {
+        return m_users.at(index).uid < uid;
+    });
+    if (it == m_usersByUid.constEnd() || m_users.at(*it).uid != uid)
+        return -1;
+    return *it;
+}
+
+int AccountReader::userIndex(const char *name) const
+{
+    auto it = std::lower_bound(m_usersByName.constBegin(), m_usersByName.constEnd(), name,
+                               [this](quint32 index, const char *name) {
+        return strcmp(userString(m_users.at(index).name), name) < 0;
+    });
+    if (it == m_usersByName.constEnd() || strcmp(userString(m_users.at(*it).name), name))
+        return -1;
+    return *it;
+}
+
+int AccountReader::groupIndex(uint gid) const
+{
+    auto it = std::lower_bound(m_groupsByGid.constBegin(), m_groupsByGid.constEnd(), gid,
+                               [this](quint32 index, uint gid) {
+        return m_groups.at(index).gid < gid;
+    });
+    if (it == m_groupsByGid.constEnd() || m_groups.at(*it).gid != gid)
+        return -1;
+    return *it;
+}
+
+int AccountReader::groupIndex(const char *name) const
+{
+    auto it = std::lower_bound(m_groupsByName.constBegin(), m_groupsByName.constEnd(), name,
+                               [this](quint32 index, const char *name) {
+        return strcmp(groupString(m_groups.at(index).name), name) < 0;
+    });
+    if (it == m_groupsByName.constEnd() || strcmp(groupString(m_groups.at(*it).name), name))
+        return -1;
+    return *it;
+}
+
+AccountReader::User AccountReader::toUser(int index) const
+{
+    const UserRecord &record = m_users.at(index);
+    User user;
+    user.uid = record.uid;
+    user.gid = record.gid;
+    user.name = QString::fromUtf8(userString(record.name));
+    user.gecos = QString::fromUtf8(userString(record.gecos));
+    user.home = QString::fromUtf8(userString(record.home));
+    user.shell = QString::fromUtf8(userString(record.shell));
+    return user;
+}
+
+bool AccountReader::findUser(uint uid, User *user) const
+{
+    int index = userIndex(uid);
+    if (index < 0)
+        return false;
+    if (user)
+        *user = toUser(index);
+    return true;
+}
+
+bool AccountReader::findUser(const QString &name, User *user) const
+{
+    int index = userIndex(name.toUtf8().constData());
+    if (index < 0)
+        return false;
+    if (user)
+        *user = toUser(index);
+    return true;
+}
+
+bool AccountReader::findGroup(const QString &name, uint *gid) const
+{
+    int index = groupIndex(name.toUtf8().constData());
+    if (index < 0)
+        return false;
+    if (gid)
+        *gid = m_groups.at(index).gid;
+    return true;
+}
+
+QString AccountReader::groupName(uint gid) const
+{
+    int index = groupIndex(gid);
+    if (index < 0)
+        return QString();
+    return QString::fromUtf8(groupString(m_groups.at(index).name));
+}
+
+QStringList AccountReader::groupMembers(const QString &group) const
+{
+    return m_membersOfGroup.value(group);
+}
+
+QStringList AccountReader::groupsOfUser(const QString &user) const
+{
+    QStringList rv;
+    const QByteArray name = user.toUtf8();
+    int index = userIndex(name.constData());
+    if (index < 0)
+        return rv;
+
+    // Primary group first, like lu_groups_enumerate_by_user() does
+    QString primary;
+    int primaryIndex = groupIndex(m_users.at(index).gid);
+    if (primaryIndex >= 0) {
+        primary = QString::fromUtf8(groupString(m_groups.at(primaryIndex).name));
+        rv.append(primary);
+    }
+
+    for (const QString &group : m_groupsOfUser.value(user)) {
+        if (group != primary && !rv.contains(group))
+            rv.append(group);
+    }
+    return rv;
+}
+
+int AccountReader::memberCount(const QString &group) const
+{
+    auto it = m_membersOfGroup.constFind(group);
+    return it == m_membersOfGroup.constEnd() ? 0 : it->count();
+}
+
+QStringList AccountReader::userNames() const
+{
+    QStringList rv;
+    rv.reserve(m_users.size());
+    for (const UserRecord &record : m_users)
+        rv.append(QString::fromUtf8(userString(record.name)));
+    return rv;
+}
+
+QStringList AccountReader::groupNames() const
+{
+    QStringList rv;
+    rv.reserve(m_groups.size());
+    for (const GroupRecord &record : m_groups)
+        rv.append(QString::fromUtf8(groupString(record.name)));
+    return rv;
+}
+
+QVector<uint> AccountReader::userIds() const
+{
+    QVector<uint> rv;
+    rv.reserve(m_users.size());
+    for (const UserRecord &record : m_users)
+        rv.append(record.uid);
+    return rv;
+}
+
+QVector<uint> AccountReader::groupIds() const
+{
+    QVector<uint> rv;
+    rv.reserve(m_groups.size());
+    for (const GroupRecord &record : m_groups)
+        rv.append(record.gid);
+    return rv;
+}
+
+/*
+ * Applies a membership change that was just written through libuser. The
+ * caller refreshes before writing, so the index is updated in place and the
+ * new group file is adopted without parsing it again.
+ */
+void AccountReader::setMember(const QString &user, const QString &group, bool member)
+{
+    if (!m_group.loaded)
+        return; // Nothing to update, everything is loaded on next refresh
+
+    if (member) {
+        QStringList &members = m_membersOfGroup[group];
+        if (!members.contains(user))
+            members.append(user);
+        QStringList &groups = m_groupsOfUser[user];
+        if (!groups.contains(group))
+            groups.append(group);
+    } else {
+        auto members = m_membersOfGroup.find(group);
+        if (members != m_membersOfGroup.end())
+            members->removeAll(user);
+        auto groups = m_groupsOfUser.find(user);
+        if (groups != m_groupsOfUser.end())
+            groups->removeAll(group);
+    }
+
+    if (stat(&m_group))
+        m_generation = generationOf(m_passwd, m_group);
+}
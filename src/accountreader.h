@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#ifndef ACCOUNTREADER_H
+#define ACCOUNTREADER_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include <sys/types.h>
+
+// Read-only view to passwd and group files. Files are memory-mapped and
+// parsed into flat record arrays with string offsets to a single string
+// table, lookups are binary searches over sorted index arrays. refresh()
+// parses files again only when their inode, size or mtime changes. Group
+// memberships are kept in a bidirectional index built in the same pass,
+// which is updated in place for membership changes made by the daemon.
+// All writes must still go through libuser.
+//
+// Lookups are const and do not refresh, so a refreshed copy can be shared
+// between threads as an immutable snapshot. Copies share the parsed data.
+class AccountReader
+{
+public:
+    struct User {
+        uint uid;
+        uint gid;
+        QString name;
+        QString gecos;
+        QString home;
+        QString shell;
+    };
+
+    explicit AccountReader(const QString &passwdPath = QStringLiteral("/etc/passwd"),
+                           const QString &groupPath = QStringLiteral("/etc/group"));
+
+    void refresh();
+    bool isCurrent() const;
+    quint64 generation() const;
+
+    bool findUser(uint uid, User *user) const;
+    bool findUser(const QString &name, User *user) const;
+    bool findGroup(const QString &name, uint *gid = nullptr) const;
+    QString groupName(uint gid) const;
+    QStringList groupMembers(const QString &group) const;
+    QStringList groupsOfUser(const QString &user) const;
+    int memberCount(const QString &group) const;
+    void setMember(const QString &user, const QString &group, bool member);
+    QStringList userNames() const;
+    QStringList groupNames() const;
+    QVector<uint> userIds() const;
+    QVector<uint> groupIds() const;
+
+private:
+    struct FileState {
+        QString path;
+        dev_t device;
+        ino_t inode;
+        off_t size;
+        qint64 mtime;
+        bool exists;
+        bool loaded;
+    };
+
+    struct UserRecord {
+        quint32 uid;
+        quint32 gid;
+        quint32 name;
+        quint32 gecos;
+        quint32 home;
+        quint32 shell;
+    };
+
+    struct GroupRecord {
+        quint32 gid;
+        quint32 name;
+    };
+
+    static bool stat(FileState *state);
+    static bool changed(FileState *state);
+    static quint64 generationOf(const FileState &passwd, const FileState &group);
+    static quint32 addString(QByteArray *strings, const char *begin, const char *end);
+    void loadUsers();
+    void loadGroups();
+    const char *userString(quint32 offset) const;
+    const char *groupString(quint32 offset) const;
+    int userIndex(uint uid) const;
+    int userIndex(const char *name) const;
+    int groupIndex(uint gid) const;
+    int groupIndex(const char *name) const;
+    User toUser(int index) const;
+
+    FileState m_passwd;
+    FileState m_group;
+    quint64 m_generation;
+
+    // Flat tables, string fields are offsets to string tables
+    QByteArray m_userStrings;
+    QByteArray m_groupStrings;
+    QVector<UserRecord> m_users;
+    QVector<GroupRecord> m_groups;
+    QVector<quint32> m_usersByUid;
+    QVector<quint32> m_usersByName;
+    QVector<quint32> m_groupsByGid;
+    QVector<quint32> m_groupsByName;
+
+    // Membership index, user to groups and group to members
+    QHash<QString, QStringList> m_groupsOfUser;
+    QHash<QString, QStringList> m_membersOfGroup;
+};
+
+#endif // ACCOUNTREADER_H
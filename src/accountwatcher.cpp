@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#include "accountwatcher.h"
+#include "logging.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QTimer>
+
+namespace {
+// useradd and friends rewrite several files in a row
+const int DEBOUNCE_INTERVAL = 500;
+}
+
+AccountWatcher::AccountWatcher(const QStringList &paths, QObject *parent) :
+    QObject(parent),
+    m_paths(paths),
+    m_watcher(new QFileSystemWatcher(this)),
+    m_debounce(new QTimer(this))
+{
+    m_debounce->setSingleShot(true);
+    m_debounce->setInterval(DEBOUNCE_INTERVAL);
+    connect(m_debounce, &QTimer::timeout, this, [this]() {
+        watch();
+        emit changed();
+    });
+
+    connect(m_watcher, &QFileSystemWatcher::fileChanged, this, &AccountWatcher::schedule);
+    connect(m_watcher, &QFileSystemWatcher::directoryChanged, this, &AccountWatcher::schedule);
+    watch();
+}
+
+// Reports a change after the debounce interval, restarted by every change
+void AccountWatcher::schedule()
+{
+    m_debounce->start();
+}
+
+/*
+ * Watches files again after they were replaced. A file that was renamed
+ * over is no longer watched, or is still watched through its old inode.
+ */
+void AccountWatcher::watch()
+{
+    for (const QString &path : m_paths) {
+        const QString directory = QFileInfo(path).path();
+        if (!m_watcher->directories().contains(directory) && !m_watcher->addPath(directory))
+            qCWarning(lcSUM) << "Could not watch" << directory;
+
+        if (m_watcher->files().contains(path))
+            m_watcher->removePath(path);
+        if (QFile::exists(path) && !m_watcher->addPath(path))
+            qCWarning(lcSUM) << "Could not watch" << path;
+    }
+}
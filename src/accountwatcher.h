@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#ifndef ACCOUNTWATCHER_H
+#define ACCOUNTWATCHER_H
+
+#include <QObject>
+#include <QStringList>
+
+class QFileSystemWatcher;
+class QTimer;
+
+// Watches account database files and tells when they may have changed.
+// Tools replace the files by renaming new ones over them, so their
+// directories are watched too. A burst of changes is reported once after
+// the files have been quiet for a while.
+class AccountWatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit AccountWatcher(const QStringList &paths, QObject *parent = nullptr);
+
+    void schedule();
+
+signals:
+    void changed();
+
+private:
+    void watch();
+
+    QStringList m_paths;
+    QFileSystemWatcher *m_watcher;
+    QTimer *m_debounce;
+};
+
+#endif // ACCOUNTWATCHER_H
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#include "admission.h"
+#include "config.h"
+
+#include <QTextStream>
+
+namespace {
+
+const char *KIND_NAMES[] = { "read", "write" };
+// Callers are kept at least this long after their last call
+const qint64 IDLE_TIMEOUT = 10 * 60 * 1000;
+
+Q_GLOBAL_STATIC(Admission, admission)
+
+}
+
+Admission *Admission::instance()
+{
+    return admission();
+}
+
+Admission::Admission() :
+    m_lastPrune(0)
+{
+    const Config config = Config::load();
+    m_rate[Read] = config.readRate;
+    m_burst[Read] = config.readBurst;
+    m_rate[Write] = config.writeRate;
+    m_burst[Write] = config.writeBurst;
+    m_rejected[Read] = m_rejected[Write] = 0;
+    m_clock.start();
+}
+
+/*
+ * Takes a token from the bucket of caller, returns false if there is none.
+ * New callers start with full buckets.
+ */
+bool Admission::admit(const QString &caller, Kind kind)
+{
+    QMutexLocker locker(&m_mutex);
+    const qint64 now = m_clock.elapsed();
+    if (now - m_lastPrune > IDLE_TIMEOUT)
+        prune(now);
+
+    auto it = m_callers.find(caller);
+    if (it == m_callers.end()) {
+        Caller entry;
+        for (int i = Read; i <= Write; i++) {
+            entry.buckets[i] = { m_burst[i], now };
+            entry.admitted[i] = 0;
+            entry.rejected[i] = 0;
+        }
+        it = m_callers.insert(caller, entry);
+    }
+
+    Bucket &bucket = it->buckets[kind];
+    bucket.tokens = qMin(m_burst[kind], bucket.tokens + (now - bucket.stamp) * m_rate[kind] / 1000.0);
+    bucket.stamp = now;
+    if (bucket.tokens < 1.0) {
+        it->rejected[kind]++;
+        m_rejected[kind]++;
+        return false;
+    }
+
+    bucket.tokens -= 1.0;
+    it->admitted[kind]++;
+    return true;
+}
+
+// Forgets callers that have not called in a while, their buckets would be full anyway
+void Admission::prune(qint64 now)
+{
+    m_lastPrune = now;
+    for (auto it = m_callers.begin(); it != m_callers.end();) {
+        if (now - qMax(it->buckets[Read].stamp, it->buckets[Write].stamp) > IDLE_TIMEOUT)
+            it = m_callers.erase(it);
+        else
+            ++it;
+    }
+}
+
+QString Admission::dump() const
+{
+    QMutexLocker locker(&m_mutex);
+    QString rv;
+    QTextStream out(&rv);
+    for (int i = Read; i <= Write; i++) {
+        out << "admission." << KIND_NAMES[i]
+            << " rate=" << m_rate[i]
+            << " burst=" << m_burst[i]
+            << " rejected=" << m_rejected[i]
+            << '\n';
+    }
+    for (auto it = m_callers.constBegin(); it != m_callers.constEnd(); ++it) {
+        out << "admission.caller " << it.key();
+        for (int i = Read; i <= Write; i++) {
+            out << ' ' << KIND_NAMES[i] << "_admitted=" << it->admitted[i]
+                << ' ' << KIND_NAMES[i] << "_rejected=" << it->rejected[i];
+        }
+        out << '\n';
+    }
+    out.flush();
+    return rv;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+
+// Per-caller admission control for D-Bus methods. Every unique bus name has
+// a token bucket for reads and another for writes, a call is rejected when
+// its bucket is empty. Buckets refill at a steady rate up to a burst size
+// and idle callers are forgotten. Thread safe.
+class Admission
+{
+public:
+    enum Kind {
+        Read,
+        Write
+    };
+
+    static Admission *instance();
+
+    Admission();
+
+    bool admit(const QString &caller, Kind kind);
+    QString dump() const;
+
+private:
+    struct Bucket {
+        double tokens;
+        qint64 stamp;
+    };
+
+    struct Caller {
+        Bucket buckets[2];
+        quint64 admitted[2];
+        quint64 rejected[2];
+    };
+
+    void prune(qint64 now);
+
+    mutable QMutex m_mutex;
+    QElapsedTimer m_clock;
+    qint64 m_lastPrune;
+    // Tokens per second and bucket size by kind
+    double m_rate[2];
+    double m_burst[2];
+    QHash<QString, Caller> m_callers;
+    quint64 m_rejected[2];
+};
+
+#endif // ADMISSION_H
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#include "config.h"
+#include "logging.h"
+#include "sandbox.h"
+#include "sailfishusermanagerinterface.h"
+
+#include <QSettings>
+
+namespace {
+const auto CONFIG_FILE = QStringLiteral("/etc/user-managerd.conf");
+const int MAX_USERS_LIMIT = 99999; // Size of the user uid range
+const int DEFAULT_HOOK_BUDGET = 500;
+const int MAX_HOOK_BUDGET = 60 * 1000;
+// Calls per second and burst size per caller
+const int DEFAULT_READ_RATE = 20;
+const int DEFAULT_READ_BURST = 100;
+const int DEFAULT_WRITE_RATE = 2;
+const int DEFAULT_WRITE_BURST = 20;
+const int MAX_RATE = 100000;
+// Seconds
+const int DEFAULT_IDLE_TIMEOUT = 60;
+const int DEFAULT_MAX_IDLE_TIMEOUT = 15 * 60;
+const int MAX_IDLE_TIMEOUT = 24 * 60 * 60;
+
+// Reads key into value if it is set and within [min, max]
+void readInt(const QSettings &settings, const QString &key, int min, int max, int *value)
+{
+    if (!settings.contains(key))
+        return;
+
+    bool ok;
+    int read = settings.value(key).toInt(&ok);
+    if (ok && read >= min && read <= max)
+        *value = read;
+    else
+        qCWarning(lcSUM) << "Invalid" << key << "in" << settings.fileName() << "using default" << *value;
+}
+}
+
+Config Config::load()
+{
+    const QString path = Sandbox::path(CONFIG_FILE);
+    Config config;
+    config.maxUsers = SAILFISH_USERMANAGER_MAX_USERS;
+    config.hookBudget = DEFAULT_HOOK_BUDGET;
+    config.readRate = DEFAULT_READ_RATE;
+    config.readBurst = DEFAULT_READ_BURST;
+    config.writeRate = DEFAULT_WRITE_RATE;
+    config.writeBurst = DEFAULT_WRITE_BURST;
+    config.idleTimeout = DEFAULT_IDLE_TIMEOUT;
+    config.maxIdleTimeout = DEFAULT_MAX_IDLE_TIMEOUT;
+    config.sequentialUserCreation = false;
+
+    QSettings settings(path, QSettings::IniFormat);
+    readInt(settings, QStringLiteral("MaxUsers"), 1, MAX_USERS_LIMIT, &config.maxUsers);
+    readInt(settings, QStringLiteral("HookBudget"), 1, MAX_HOOK_BUDGET, &config.hookBudget);
+    readInt(settings, QStringLiteral("ReadRate"), 1, MAX_RATE, &config.readRate);
+    readInt(settings, QStringLiteral("ReadBurst"), 1, MAX_RATE, &config.readBurst);
+    readInt(settings, QStringLiteral("WriteRate"), 1, MAX_RATE, &config.writeRate);
+    readInt(settings, QStringLiteral("WriteBurst"), 1, MAX_RATE, &config.writeBurst);
+    readInt(settings, QStringLiteral("IdleTimeout"), 1, MAX_IDLE_TIMEOUT, &config.idleTimeout);
+    readInt(settings, QStringLiteral("MaxIdleTimeout"), 0, MAX_IDLE_TIMEOUT, &config.maxIdleTimeout);
+    config.sequentialUserCreation = settings.value(QStringLiteral("SequentialUserCreation"), false).toBool();
+
+    return config;
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <QString>
+
+// Daemon settings, missing or invalid values fall back to defaults
+struct Config {
+    int maxUsers;
+    // Milliseconds each hook plugin may take per event
+    int hookBudget;
+    // Calls per second each D-Bus caller may make and calls it may burst
+    int readRate;
+    int readBurst;
+    int writeRate;
+    int writeBurst;
+    // Seconds to wait for calls before quitting and at most to stay resident
+    int idleTimeout;
+    int maxIdleTimeout;
+    // Runs user creation stages one after another, for comparing timings
+    bool sequentialUserCreation;
+
+    static Config load();
+};
+
+#endif // CONFIG_H
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#include "debuginterface.h"
+#include "debug_adaptor.h"
+#include "admission.h"
+#include "flightrecorder.h"
+#include "logging.h"
+#include "metrics.h"
+#include "sandbox.h"
+#include "tracer.h"
+
+#include <QDBusConnection>
+#include <QSocketNotifier>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+const auto DEBUG_OBJECT_PATH = QStringLiteral("/debug");
+}
+
+int DebugInterface::s_signalFd[2] = { -1, -1 };
+
+DebugInterface::DebugInterface(QObject *parent) :
+    QObject(parent),
+    m_notifier(nullptr)
+{
+    // Starts tracing if requested in environment
+    Tracer::instance();
+
+    new DebugAdaptor(this);
+    if (!Sandbox::bus().registerObject(DEBUG_OBJECT_PATH, this))
+        qCWarning(lcSUM) << "Cannot register D-Bus object at" << DEBUG_OBJECT_PATH;
+
+    // Signal handler only writes to a socket, the dump is done on event loop.
+    // A full socket must not block the handler, pending dumps are enough then.
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0, s_signalFd) == 0) {
+        m_notifier = new QSocketNotifier(s_signalFd[1], QSocketNotifier::Read, this);
+        connect(m_notifier, &QSocketNotifier::activated, this, &DebugInterface::onSignal);
+
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = &DebugInterface::signalHandler;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        if (sigaction(SIGUSR1, &action, nullptr) < 0)
+            qCWarning(lcSUM) << "Could not install SIGUSR1 handler";
+    } else {
+        qCWarning(lcSUM) << "Could not create signal socket";
+    }
+}
+
+DebugInterface::~DebugInterface()
+{
+    signal(SIGUSR1, SIG_DFL);
+    if (s_signalFd[0] >= 0) {
+        close(s_signalFd[0]);
+        close(s_signalFd[1]);
+        s_signalFd[0] = s_signalFd[1] = -1;
+    }
+}
+
+void DebugInterface::signalHandler(int signal)
+{
+    const int savedErrno = errno;
+    char value = signal;
+    if (write(s_signalFd[0], &value, sizeof(value)) < 0) {
+        // EAGAIN means dumps are pending already, nothing to do otherwise
+    }
+    errno = savedErrno;
+}
+
+void DebugInterface::onSignal()
+{
+    char value;
+    if (read(s_signalFd[1], &value, sizeof(value)) != sizeof(value))
+        return;
+
+    fputs(Metrics::instance()->dump().toUtf8().constData(), stderr);
+    fputs(Admission::instance()->dump().toUtf8().constData(), stderr);
+    fflush(stderr);
+}
+
+/*!
+  \brief Returns metrics as text, for internal use only.
+  \internal
+ */
+QString DebugInterface::metrics()
+{
+    return Metrics::instance()->dump();
+}
+
+/*!
+  \brief Clears collected metrics, for internal use only.
+  \internal
+ */
+void DebugInterface::resetMetrics()
+{
+    Metrics::instance()->reset();
+}
+
+/*!
+  \brief Returns rate limits and admitted and rejected calls per caller as
+  text, for internal use only.
+  \internal
+ */
+QString DebugInterface::admission()
+{
+    return Admission::instance()->dump();
+}
+
+/*!
+  \brief Starts writing trace events to \a path, for internal use only.
+  \internal
+ */
+bool DebugInterface::startTrace(const QString &path)
+{
+    return Tracer::instance()->start(path);
+}
+
+/*!
+  \brief Stops writing trace events, for internal use only.
+  \internal
+ */
+void DebugInterface::stopTrace()
+{
+    Tracer::instance()->stop();
+}
+
+/*!
+  \brief Writes flight recorder events to a file and returns its path, for
+  internal use only.
+  \internal
+ */
+QString DebugInterface::dumpFlightRecorder()
+{
+    return QString::fromLatin1(FlightRecorder::dump(FlightRecorder::Request));
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#ifndef DEBUGINTERFACE_H
+#define DEBUGINTERFACE_H
+
+#include <QObject>
+#include <QString>
+
+class QSocketNotifier;
+
+// Diagnostics over D-Bus at /debug and as a text dump to stderr on SIGUSR1
+class DebugInterface : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit DebugInterface(QObject *parent = nullptr);
+    ~DebugInterface();
+
+public slots:
+    QString metrics();
+    void resetMetrics();
+    QString admission();
+    bool startTrace(const QString &path);
+    void stopTrace();
+    QString dumpFlightRecorder();
+
+private slots:
+    void onSignal();
+
+private:
+    static void signalHandler(int signal);
+    static int s_signalFd[2];
+
+    QSocketNotifier *m_notifier;
+};
+
+#endif // DEBUGINTERFACE_H
@@ -0,0 +1,378 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#include "filetree.h"
+#include "logging.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QList>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThread>
+#include <QThreadPool>
+#include <QVector>
+
+#include <atomic>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+namespace {
+
+// More threads than this only contend on the directory inode locks
+const int MAX_THREADS = 4;
+// Files unlinked with one io_uring submission
+const int BATCH_SIZE = 64;
+const int DIRECTORY_FLAGS = O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC;
+
+class RemoverPool : public QThreadPool
+{
+public:
+    RemoverPool()
+    {
+        setMaxThreadCount(qBound(1, QThread::idealThreadCount(), MAX_THREADS));
+    }
+};
+
+Q_GLOBAL_STATIC(RemoverPool, removerPool)
+
+struct Removal {
+    FileTree::Progress progress;
+    std::atomic<bool> failed;
+};
+
+bool isDirectory(int dirfd, const struct dirent *entry)
+{
+    if (entry->d_type != DT_UNKNOWN)
+        return entry->d_type == DT_DIR;
+
+    // Some file systems do not fill d_type
+    struct stat info;
+    return fstatat(dirfd, entry->d_name, &info, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(info.st_mode);
+}
+
+#ifdef HAVE_LIBURING
+// One ring per worker thread, not used after the kernel rejects unlinkat
+struct Ring {
+    struct io_uring ring;
+    bool usable;
+
+    Ring() : usable(io_uring_queue_init(BATCH_SIZE, &ring, 0) == 0) {}
+    ~Ring()
+    {
+        if (usable)
+            io_uring_queue_exit(&ring);
+    }
+};
+
+thread_local Ring t_ring;
+#endif
+
+// Collects files of one directory and unlinks them together
+class UnlinkBatch
+{
+public:
+    UnlinkBatch(int dirfd, Removal *removal) : m_dirfd(dirfd), m_removal(removal), m_abandoned(false) {}
+    ~UnlinkBatch() { flush(); }
+
+    void add(const char *name)
+    {
+        m_names.append(QByteArray(name));
+        if (m_names.count() >= BATCH_SIZE)
+            flush();
+    }
+
+    void flush()
+    {
+        if (m_names.isEmpty())
+            return;
+
+        quint64 bytes = 0;
+        if (m_removal->progress) {
+            for (const QByteArray &name : m_names) {
+                struct stat info;
+                if (fstatat(m_dirfd, name.constData(), &info, AT_SYMLINK_NOFOLLOW) == 0 && !S_ISLNK(info.st_mode))
+                    bytes += info.st_size;
+            }
+        }
+
+        quint64 removed = unlinkAll();
+        if (removed != quint64(m_names.count()))
+            m_removal->failed = true;
+        if (m_removal->progress)
+            m_removal->progress(bytes, removed);
+        m_names.clear();
+    }
+
+    // Unlinks of the directory may still be in flight, it must be left open
+    bool abandoned() const
+    {
+        return m_abandoned;
+    }
+
+private:
+    bool unlinkName(const QByteArray &name) const
+    {
+        return unlinkat(m_dirfd, name.constData(), 0) == 0 || errno == ENOENT;
+    }
+
+    quint64 unlinkAll()
+    {
+#ifdef HAVE_LIBURING
+        if (t_ring.usable && !m_abandoned)
+            return unlinkRing();
+#endif
+        quint64 removed = 0;
+        for (const QByteArray &name : m_names) {
+            if (unlinkName(name))
+                removed++;
+        }
+        return removed;
+    }
+
+#ifdef HAVE_LIBURING
+    /*
+     * Entries that were not submitted stay in the ring and requests that
+     * could not be waited for may still complete, the ring is not used by
+     * the thread after either happens.
+     */
+    quint64 unlinkRing()
+    {
+        struct io_uring *ring = &t_ring.ring;
+        for (int i = 0; i < m_names.count(); i++) {
+            struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+            io_uring_prep_unlinkat(sqe, m_dirfd, m_names.at(i).constData(), 0);
+            sqe->user_data = i;
+        }
+        const int submitted = io_uring_submit(ring);
+        if (submitted != m_names.count()) {
+            qCWarning(lcSUM) << "Submitted" << submitted << "of" << m_names.count() << "unlinks to io_uring";
+            t_ring.usable = false;
+        }
+
+        quint64 removed = 0;
+        QVector<bool> completed(m_names.count(), false);
+        int waited = 0;
+        while (waited < submitted) {
+            struct io_uring_cqe *cqe;
+            int rv = io_uring_wait_cqe(ring, &cqe);
+            if (rv == -EINTR)
+                continue;
+            if (rv < 0) {
+                // Names and directory must outlive requests that are still
+                // in flight, the rest is unlinked below
+                qCWarning(lcSUM) << "Waiting for io_uring completion failed:" << strerror(-rv);
+                QList<QByteArray> *inFlight = new QList<QByteArray>(m_names);
+                Q_UNUSED(inFlight);
+                t_ring.usable = false;
+                m_abandoned = true;
+                break;
+            }
+            int index = cqe->user_data;
+            int result = cqe->res;
+            io_uring_cqe_seen(ring, cqe);
+            completed[index] = true;
+            waited++;
+
+            if (result == -EINVAL || result == -EOPNOTSUPP) {
+                // Kernel older than 5.11, fall back to plain unlinkat
+                t_ring.usable = false;
+                if (unlinkName(m_names.at(index)))
+                    removed++;
+            } else if (result == 0 || result == -ENOENT) {
+                removed++;
+            }
+        }
+
+        // Not submitted or not waited for, unlinking twice is harmless
+        for (int i = 0; i < m_names.count(); i++) {
+            if (!completed.at(i) && unlinkName(m_names.at(i)))
+                removed++;
+        }
+        return removed;
+    }
+#endif
+
+    int m_dirfd;
+    Removal *m_removal;
+    QList<QByteArray> m_names;
+    bool m_abandoned;
+};
+
+void removeSubtree(int parentfd, const QByteArray &name, Removal *removal);
+
+class SubtreeTask : public QRunnable
+{
+public:
+    SubtreeTask(int parentfd, const QByteArray &name, Removal *removal, QSemaphore *done) :
+        m_parentfd(parentfd), m_name(name), m_removal(removal), m_done(done)
+    {
+    }
+
+    void run() override
+    {
+        removeSubtree(m_parentfd, m_name, m_removal);
+        m_done->release();
+    }
+
+private:
+    int m_parentfd;
+    QByteArray m_name;
+    Removal *m_removal;
+    QSemaphore *m_done;
+};
+
+/*
+ * Removes everything in dirfd and closes it. Subdirectories are handed to
+ * idle pool threads and removed here when there are none. Tasks are only
+ * started on idle threads so waiting for them can not deadlock.
+ */
+void removeContents(int dirfd, Removal *removal)
+{
+    DIR *dir = fdopendir(dirfd);
+    if (!dir) {
+        close(dirfd);
+        removal->failed = true;
+        return;
+    }
+
+    QSemaphore done;
+    int started = 0;
+    UnlinkBatch batch(dirfd, removal);
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        if (!isDirectory(dirfd, entry)) {
+            batch.add(entry->d_name);
+            continue;
+        }
+
+        QByteArray name(entry->d_name);
+        SubtreeTask *task = new SubtreeTask(dirfd, name, removal, &done);
+        if (removerPool()->tryStart(task)) {
+            started++;
+        } else {
+            delete task;
+            removeSubtree(dirfd, name, removal);
+        }
+    }
+    batch.flush();
+
+    // Subtrees refer to dirfd until they are done
+    done.acquire(started);
+    // Reused descriptor number could make unlinks in flight hit another directory
+    if (!batch.abandoned())
+        closedir(dir);
+}
+
+void removeSubtree(int parentfd, const QByteArray &name, Removal *removal)
+{
+    int fd = openat(parentfd, name.constData(), DIRECTORY_FLAGS);
+    if (fd < 0) {
+        // Replaced with something else than a directory, remove that instead
+        if ((errno == ENOTDIR || errno == ELOOP) && unlinkat(parentfd, name.constData(), 0) == 0) {
+            if (removal->progress)
+                removal->progress(0, 1);
+        } else if (errno != ENOENT) {
+            removal->failed = true;
+        }
+        return;
+    }
+
+    removeContents(fd, removal);
+    if (unlinkat(parentfd, name.constData(), AT_REMOVEDIR) < 0 && errno != ENOENT)
+        removal->failed = true;
+}
+
+bool measureContents(int dirfd, quint64 *bytes, quint64 *files)
+{
+    DIR *dir = fdopendir(dirfd);
+    if (!dir) {
+        close(dirfd);
+        return false;
+    }
+
+    bool success = true;
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        struct stat info;
+        if (fstatat(dirfd, entry->d_name, &info, AT_SYMLINK_NOFOLLOW) < 0) {
+            success = false;
+        } else if (S_ISDIR(info.st_mode)) {
+            int fd = openat(dirfd, entry->d_name, DIRECTORY_FLAGS);
+            success = fd >= 0 && measureContents(fd, bytes, files) && success;
+        } else {
+            *bytes += S_ISLNK(info.st_mode) ? 0 : info.st_size;
+            (*files)++;
+        }
+    }
+    closedir(dir);
+    return success;
+}
+
+} // namespace
+
+/*
+ * Removes path and everything under it. Returns true if path does not exist
+ * afterwards. Symbolic links, including path itself, are removed and not
+ * followed.
+ */
+bool FileTree::remove(const QString &path, const Progress &progress)
+{
+    const QByteArray nativePath = QFile::encodeName(path);
+    struct stat info;
+    if (lstat(nativePath.constData(), &info) < 0)
+        return errno == ENOENT;
+
+    if (!S_ISDIR(info.st_mode))
+        return unlink(nativePath.constData()) == 0;
+
+    QFileInfo fileInfo(QDir::cleanPath(path));
+    if (fileInfo.fileName().isEmpty())
+        return false;
+
+    int parentfd = open(QFile::encodeName(fileInfo.absolutePath()).constData(), DIRECTORY_FLAGS & ~O_NOFOLLOW);
+    if (parentfd < 0)
+        return false;
+
+    Removal removal;
+    removal.progress = progress;
+    removal.failed = false;
+    removeSubtree(parentfd, QFile::encodeName(fileInfo.fileName()), &removal);
+    close(parentfd);
+    return !removal.failed;
+}
+
+// Adds sizes and number of files under path, directories are not counted
+bool FileTree::measure(const QString &path, quint64 *bytes, quint64 *files)
+{
+    int fd = open(QFile::encodeName(path).constData(), DIRECTORY_FLAGS);
+    if (fd < 0)
+        return false;
+
+    return measureContents(fd, bytes, files);
+}
+
+int FileTree::maxThreads()
+{
+    return removerPool()->maxThreadCount();
+}
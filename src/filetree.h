@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#ifndef FILETREE_H
+#define FILETREE_H
+
+#include <QString>
+
+#include <functional>
+
+// Walks directory trees by file descriptor with openat() and fdopendir()
+// instead of building and resolving a full path for every entry.
+// Directories are opened with O_NOFOLLOW relative to their parent, so
+// symbolic links are removed or counted as links but never followed out of
+// the tree. Removal deletes sibling subtrees in parallel on a bounded thread
+// pool and, when built with liburing, unlinks files of a directory in
+// batches through io_uring.
+class FileTree
+{
+public:
+    // Called from worker threads after a batch of files has been removed
+    typedef std::function<void(quint64 bytes, quint64 files)> Progress;
+
+    static bool remove(const QString &path, const Progress &progress = Progress());
+    static bool measure(const QString &path, quint64 *bytes, quint64 *files);
+    static int maxThreads();
+};
+
+#endif // FILETREE_H
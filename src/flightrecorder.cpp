@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#include "flightrecorder.h"
+#include "logging.h"
+#include "sandbox.h"
+
+#include <QDir>
+#include <QFile>
+
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+static_assert(sizeof(FlightRecorder::Record) == 64, "Record must stay 64 bytes");
+
+namespace {
+
+const int SLOTS = 1024; // Power of two
+// Shared with the user snapshot which must stay readable for everyone
+const auto DUMP_DIR = QStringLiteral("/run/user-managerd");
+const char *DUMP_FILES[] = {
+    "flightrecorder-request.bin",
+    "flightrecorder-switch-failure.bin",
+    "flightrecorder-crash.bin"
+};
+const int REASONS = sizeof(DUMP_FILES) / sizeof(DUMP_FILES[0]);
+// Resolved before the crash handler is installed, dump() can not allocate
+char dumpPaths[REASONS][PATH_MAX];
+const int CRASH_SIGNALS[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+
+// Sequence is odd while the slot is being written, seqlock style
+struct Slot {
+    std::atomic<quint64> sequence;
+    FlightRecorder::Record record;
+};
+
+Slot ring[SLOTS];
+std::atomic<quint64> head(0);
+
+quint64 now(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return quint64(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+quint32 threadId()
+{
+    static thread_local quint32 tid = syscall(SYS_gettid);
+    return tid;
+}
+
+Slot *beginRecord(FlightRecorder::Phase phase, uint uid, int error)
+{
+    quint64 n = head.fetch_add(1, std::memory_order_relaxed);
+    Slot *slot = &ring[n & (SLOTS - 1)];
+    slot->sequence.store(2 * n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->record.sequence = n;
+    slot->record.timestamp = now(CLOCK_MONOTONIC);
+    slot->record.uid = uid;
+    slot->record.error = error;
+    slot->record.thread = threadId();
+    slot->record.phase = phase;
+    return slot;
+}
+
+void endRecord(Slot *slot)
+{
+    slot->sequence.store(2 * slot->record.sequence + 2, std::memory_order_release);
+}
+
+bool writeAll(int fd, const void *data, size_t size)
+{
+    const char *p = static_cast<const char *>(data);
+    while (size) {
+        ssize_t written = write(fd, p, size);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += written;
+        size -= written;
+    }
+    return true;
+}
+
+} // namespace
+
+void FlightRecorder::record(const char *operation, Phase phase, uint uid, int error)
+{
+    Slot *slot = beginRecord(phase, uid, error);
+    strncpy(slot->record.operation, operation, sizeof(slot->record.operation) - 1);
+    slot->record.operation[sizeof(slot->record.operation) - 1] = '\0';
+    endRecord(slot);
+}
+
+void FlightRecorder::record(const QString &operation, Phase phase, uint uid, int error)
+{
+    Slot *slot = beginRecord(phase, uid, error);
+    // Latin-1 copy by hand, no temporary byte array
+    int length = qMin(operation.length(), int(sizeof(slot->record.operation)) - 1);
+    for (int i = 0; i < length; i++)
+        slot->record.operation[i] = operation.at(i).toLatin1();
+    slot->record.operation[length] = '\0';
+    endRecord(slot);
+}
+
+/*
+ * Writes events to a file in DUMP_DIR and returns its path or nullptr on
+ * failure. Only async-signal-safe functions are used here.
+ */
+const char *FlightRecorder::dump(Reason reason)
+{
+    const char *path = dumpPaths[reason];
+    if (!path[0])
+        return nullptr;
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return nullptr;
+
+    quint64 end = head.load(std::memory_order_acquire);
+    quint64 begin = end > quint64(SLOTS) ? end - SLOTS : 0;
+
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "SUMFREC", 8);
+    header.version = 1;
+    header.recordSize = sizeof(Record);
+    header.reason = reason;
+    header.monotonic = now(CLOCK_MONOTONIC);
+    header.realtime = now(CLOCK_REALTIME);
+
+    // Count is patched after records are written, torn slots are skipped
+    bool ok = writeAll(fd, &header, sizeof(header));
+    for (quint64 n = begin; ok && n < end; n++) {
+        const Slot &slot = ring[n & (SLOTS - 1)];
+        quint64 sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence != 2 * n + 2)
+            continue; // Being written or already overwritten
+        Record record;
+        memcpy(&record, &slot.record, sizeof(record));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) != sequence)
+            continue;
+        ok = writeAll(fd, &record, sizeof(record));
+        header.recordCount++;
+    }
+
+    if (ok && lseek(fd, 0, SEEK_SET) == 0)
+        ok = writeAll(fd, &header, sizeof(header));
+    close(fd);
+
+    return ok ? path : nullptr;
+}
+
+void FlightRecorder::crashHandler(int signal)
+{
+    dump(Crash);
+    // SA_RESETHAND restored the default action, let it terminate the process
+    raise(signal);
+}
+
+void FlightRecorder::installCrashHandler()
+{
+    const QString directory = Sandbox::path(DUMP_DIR);
+    if (!QDir().mkpath(directory) || chmod(QFile::encodeName(directory).constData(), 0755) < 0)
+        qCWarning(lcSUM) << "Could not create flight recorder directory:" << strerror(errno);
+    for (int reason = 0; reason < REASONS; reason++) {
+        const QByteArray path = QFile::encodeName(directory + '/' + QLatin1String(DUMP_FILES[reason]));
+        if (path.size() < PATH_MAX)
+            memcpy(dumpPaths[reason], path.constData(), path.size() + 1);
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = &FlightRecorder::crashHandler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESETHAND | SA_NODEFER;
+    for (int signal : CRASH_SIGNALS) {
+        if (sigaction(signal, &action, nullptr) < 0)
+            qCWarning(lcSUM) << "Could not install crash handler for signal" << signal;
+    }
+}
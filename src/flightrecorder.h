@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#ifndef FLIGHTRECORDER_H
+#define FLIGHTRECORDER_H
+
+#include <QString>
+
+// Always on, fixed size ring buffer of structured events for post-mortem
+// diagnosis. Recording is lock-free and does not allocate. Dumps are binary
+// files in /run/user-managerd, dumping is async-signal-safe so that it can
+// be done from a crash handler.
+class FlightRecorder
+{
+public:
+    enum Phase {
+        Begin,
+        End,
+        Failed,
+        Event
+    };
+
+    enum Reason {
+        Request,
+        SwitchFailure,
+        Crash
+    };
+
+    static const int OPERATION_LENGTH = 36;
+
+    // On-disk record, dump is a Header followed by records oldest first
+    struct Record {
+        quint64 sequence;
+        quint64 timestamp; // CLOCK_MONOTONIC nanoseconds
+        quint32 uid;
+        qint32 error;      // errno or zero
+        quint32 thread;
+        quint8 phase;
+        char operation[OPERATION_LENGTH - 1]; // NUL terminated, truncated
+    };
+
+    struct Header {
+        char magic[8];
+        quint32 version;
+        quint32 recordSize;
+        quint32 recordCount;
+        quint32 reason;
+        quint64 monotonic;   // Dump time on CLOCK_MONOTONIC
+        quint64 realtime;    // Dump time on CLOCK_REALTIME
+    };
+
+    static void record(const char *operation, Phase phase, uint uid = 0, int error = 0);
+    static void record(const QString &operation, Phase phase, uint uid = 0, int error = 0);
+    static const char *dump(Reason reason);
+    static void installCrashHandler();
+
+private:
+    static void crashHandler(int signal);
+};
+
+#endif // FLIGHTRECORDER_H
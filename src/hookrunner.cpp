@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#include "hookrunner.h"
+#include "config.h"
+#include "job.h"
+#include "logging.h"
+#include "metrics.h"
+#include "sandbox.h"
+
+#include <QCollator>
+#include <QDir>
+#include <QPluginLoader>
+#include <QSemaphore>
+#include <QtConcurrentRun>
+
+#include <algorithm>
+#include <memory>
+
+#ifndef HOOK_PLUGIN_DIR
+#define HOOK_PLUGIN_DIR "/usr/lib/user-managerd/hooks"
+#endif
+
+namespace {
+
+const char *EVENT_NAMES[] = { "create", "remove", "pre-switch" };
+
+Q_GLOBAL_STATIC(HookRunner, hookRunner)
+
+}
+
+HookRunner *HookRunner::instance()
+{
+    return hookRunner();
+}
+
+HookRunner::HookRunner() :
+    m_loaded(false),
+    m_budget(0),
+    m_pool(new QThreadPool)
+{
+}
+
+HookRunner::~HookRunner()
+{
+    // A plugin that never returned still uses its thread and library
+    if (!m_pool->waitForDone(0))
+        return;
+    delete m_pool;
+    m_pool = nullptr;
+    for (Plugin *plugin : m_plugins)
+        delete plugin->loader;
+    qDeleteAll(m_plugins);
+}
+
+/*
+ * Loads plugins in numeric order of their file names, called with m_mutex.
+ * Plugins are never unloaded, the daemon exits when idle anyway.
+ */
+void HookRunner::load()
+{
+    m_loaded = true;
+    m_budget = Config::load().hookBudget;
+
+    QDir directory(Sandbox::path(QStringLiteral(HOOK_PLUGIN_DIR)), QStringLiteral("*.so"), QDir::NoSort, QDir::Files);
+    QStringList entryList = directory.entryList();
+    QCollator collator(QLocale::C);
+    collator.setNumericMode(true);
+    std::sort(entryList.begin(), entryList.end(), collator);
+
+    for (const QString &entry : entryList) {
+        QPluginLoader *loader = new QPluginLoader(directory.absoluteFilePath(entry));
+        SailfishUserManagerHook *hook = qobject_cast<SailfishUserManagerHook *>(loader->instance());
+        if (!hook) {
+            qCWarning(lcSUM) << "Could not load hook plugin" << entry << loader->errorString();
+            delete loader;
+            continue;
+        }
+        Plugin *plugin = new Plugin;
+        plugin->name = entry;
+        plugin->loader = loader;
+        plugin->hook = hook;
+        m_plugins.append(plugin);
+    }
+
+    // One thread per plugin is enough, busy plugins are not called
+    m_pool->setMaxThreadCount(qMax(1, m_plugins.count()));
+    if (!m_plugins.isEmpty())
+        qCDebug(lcSUM) << "Loaded" << m_plugins.count() << "hook plugins with budget of" << m_budget << "ms";
+}
+
+/*
+ * Calls plugins one after another and returns after each has returned or
+ * run out of its budget.
+ */
+void HookRunner::run(const SailfishUserManagerHookEvent &event, Job *job)
+{
+    QList<Plugin *> plugins;
+    SailfishUserManagerHookEvent budgeted = event;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (!m_loaded)
+            load();
+        plugins = m_plugins;
+        budgeted.budget = m_budget;
+    }
+
+    if (job)
+        job->addTotal(0, plugins.count());
+
+    for (Plugin *plugin : plugins) {
+        MetricsScope scope(QStringLiteral("hook.%1/%2").arg(EVENT_NAMES[event.type]).arg(plugin->name));
+        if (!plugin->busy.testAndSetOrdered(0, 1)) {
+            qCWarning(lcSUM) << "Hook plugin" << plugin->name << "is still running a previous event, skipped";
+            scope.fail(QStringLiteral("Busy"));
+        } else {
+            // Semaphore is shared with the call that may outlive this wait
+            std::shared_ptr<QSemaphore> done = std::make_shared<QSemaphore>();
+            std::shared_ptr<QAtomicInt> result = std::make_shared<QAtomicInt>(0);
+            QtConcurrent::run(m_pool, [plugin, budgeted, done, result]() {
+                result->store(plugin->hook->handleEvent(budgeted) ? 1 : 0);
+                plugin->busy.store(0);
+                done->release();
+            });
+
+            if (!done->tryAcquire(1, budgeted.budget)) {
+                qCWarning(lcSUM) << "Hook plugin" << plugin->name << "did not return within" << budgeted.budget << "ms";
+                scope.fail(QStringLiteral("Timeout"));
+            } else if (!result->load()) {
+                qCWarning(lcSUM) << "Hook plugin" << plugin->name << "failed for" << event.uid;
+                scope.fail();
+            }
+        }
+        if (job)
+            job->addProcessed(0, 1);
+    }
+}
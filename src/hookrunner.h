@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#ifndef HOOKRUNNER_H
+#define HOOKRUNNER_H
+
+#include "sailfishusermanagerhook.h"
+
+#include <QAtomicInt>
+#include <QList>
+#include <QMutex>
+#include <QString>
+
+class Job;
+class QPluginLoader;
+class QThreadPool;
+
+// Loads hook plugins on first use and calls them with a time budget. Calls
+// run in a thread pool of their own, a plugin that runs over its budget is
+// skipped until its call returns. Thread safe.
+class HookRunner
+{
+public:
+    static HookRunner *instance();
+
+    HookRunner();
+    ~HookRunner();
+
+    void run(const SailfishUserManagerHookEvent &event, Job *job = nullptr);
+
+private:
+    struct Plugin {
+        QString name;
+        QPluginLoader *loader;
+        SailfishUserManagerHook *hook;
+        QAtomicInt busy;
+    };
+
+    void load();
+
+    QMutex m_mutex;
+    bool m_loaded;
+    int m_budget;
+    QList<Plugin *> m_plugins;
+    QThreadPool *m_pool;
+};
+
+#endif // HOOKRUNNER_H
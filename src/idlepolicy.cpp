@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#include "idlepolicy.h"
+#include "logging.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTimer>
+
+namespace {
+// Weight of the latest gap in the moving average
+const int GAP_WEIGHT_PERCENT = 30;
+// Gaps longer than this are not activations that residency could save
+const qint64 MAX_GAP = 24 * 60 * 60 * 1000LL;
+}
+
+IdlePolicy::IdlePolicy(const QString &statePath, int timeout, int maxTimeout, QObject *parent) :
+    QObject(parent),
+    m_statePath(statePath),
+    m_timeout(timeout),
+    m_maxTimeout(maxTimeout),
+    m_timer(new QTimer(this)),
+    m_trimmed(false),
+    m_averageGap(0)
+{
+    load();
+    m_idle.start();
+
+    // Checked every timeout, residency is a multiple of it at most
+    connect(m_timer, &QTimer::timeout, this, &IdlePolicy::onTick);
+    m_timer->start(m_timeout);
+}
+
+IdlePolicy::~IdlePolicy()
+{
+    save();
+}
+
+// Called for every incoming call and finished operation
+void IdlePolicy::activity()
+{
+    // Without residency this call would have started the daemon again
+    const qint64 idle = m_idle.elapsed();
+    if (idle > m_timeout)
+        addGap(idle);
+
+    m_idle.restart();
+    m_trimmed = false;
+    m_timer->start();
+}
+
+/*
+ * Milliseconds of idle time after which the daemon should quit. Staying
+ * for twice the average gap catches most of the next activations without
+ * keeping the daemon for good when calls stop.
+ */
+int IdlePolicy::residentTimeout() const
+{
+    if (m_averageGap <= 0 || m_averageGap > m_maxTimeout)
+        return m_timeout;
+    return int(qBound(qint64(m_timeout), 2 * m_averageGap, qint64(m_maxTimeout)));
+}
+
+void IdlePolicy::onTick()
+{
+    const qint64 idle = m_idle.elapsed();
+    if (idle >= residentTimeout()) {
+        emit expired();
+    } else if (!m_trimmed && idle >= m_timeout) {
+        qCDebug(lcSUM) << "Staying resident for" << residentTimeout() << "ms, average gap" << m_averageGap << "ms";
+        m_trimmed = true;
+        emit trim();
+    }
+}
+
+void IdlePolicy::addGap(qint64 gap)
+{
+    if (gap <= 0 || gap > MAX_GAP)
+        return;
+    m_averageGap = m_averageGap ? (m_averageGap * (100 - GAP_WEIGHT_PERCENT) + gap * GAP_WEIGHT_PERCENT) / 100
+                                : gap;
+}
+
+/*
+ * State file has wall clock time of the last activity and the average gap,
+ * the gap since the last activity of the previous run is added to it.
+ */
+void IdlePolicy::load()
+{
+    QFile state(m_statePath);
+    if (!state.open(QIODevice::ReadOnly))
+        return;
+
+    const QList<QByteArray> fields = state.readLine().trimmed().split(' ');
+    bool ok = fields.size() == 2;
+    const qint64 lastActivity = ok ? fields.at(0).toLongLong(&ok) : 0;
+    const qint64 averageGap = ok ? fields.at(1).toLongLong(&ok) : 0;
+    if (!ok) {
+        qCWarning(lcSUM) << "Ignoring invalid idle state in" << m_statePath;
+        return;
+    }
+
+    m_averageGap = averageGap;
+    addGap(QDateTime::currentMSecsSinceEpoch() - lastActivity);
+}
+
+void IdlePolicy::save() const
+{
+    QDir().mkpath(QFileInfo(m_statePath).path());
+    QFile state(m_statePath);
+    const qint64 lastActivity = QDateTime::currentMSecsSinceEpoch() - m_idle.elapsed();
+    if (!state.open(QIODevice::WriteOnly | QIODevice::Truncate)
+            || state.write(QByteArray::number(lastActivity) + ' ' + QByteArray::number(m_averageGap) + '\n') < 0)
+        qCWarning(lcSUM) << "Could not store idle state:" << state.errorString();
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#ifndef IDLEPOLICY_H
+#define IDLEPOLICY_H
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QString>
+
+class QTimer;
+
+// Decides when the daemon quits after its last call. The time between the
+// last call of an activation and the first call of the next one is learned
+// across restarts. If the daemon is usually called again within maxTimeout,
+// it stays resident for about twice that time instead of quitting after
+// timeout, and asks to trim memory when it has been idle for timeout.
+class IdlePolicy : public QObject
+{
+    Q_OBJECT
+
+public:
+    IdlePolicy(const QString &statePath, int timeout, int maxTimeout, QObject *parent = nullptr);
+    ~IdlePolicy();
+
+    void activity();
+    int residentTimeout() const;
+
+signals:
+    void expired();
+    void trim();
+
+private:
+    void onTick();
+    void addGap(qint64 gap);
+    void load();
+    void save() const;
+
+    QString m_statePath;
+    int m_timeout;
+    int m_maxTimeout;
+    QTimer *m_timer;
+    QElapsedTimer m_idle;
+    bool m_trimmed;
+    // Moving average of gaps between activations in milliseconds, 0 if unknown
+    qint64 m_averageGap;
+};
+
+#endif // IDLEPOLICY_H
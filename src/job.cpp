@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#include "job.h"
+#include "logging.h"
+#include "sailfishusermanagerinterface.h"
+#include "sandbox.h"
+#include "tracer.h"
+
+#include <QDBusConnectionInterface>
+#include <QDBusMessage>
+#include <QStringList>
+#include <QTimer>
+
+#include <unistd.h>
+
+namespace {
+const auto JOB_PATH = QStringLiteral("/jobs/%1");
+const auto JOB_INTERFACE = QStringLiteral("org.sailfishos.usermanager.Job");
+const auto PROPERTIES_INTERFACE = QStringLiteral("org.freedesktop.DBus.Properties");
+const int PUBLISH_INTERVAL = 250;
+const char *STATE_NAMES[] = { "waiting", "running", "finished", "failed", "cancelled" };
+}
+
+Job::Job(uint id, const QString &type, uint uid, const QString &owner, QObject *parent) :
+    QObject(parent),
+    m_id(id),
+    m_type(type),
+    m_uid(uid),
+    m_owner(owner),
+    m_state(Waiting),
+    m_progress(0),
+    m_bytesProcessed(0),
+    m_bytesTotal(0),
+    m_filesProcessed(0),
+    m_filesTotal(0),
+    m_cancel(CancelAllowed),
+    m_publishTimer(new QTimer(this))
+{
+    m_timer.start();
+    m_publishTimer->setInterval(PUBLISH_INTERVAL);
+    connect(m_publishTimer, &QTimer::timeout, this, &Job::publish);
+    m_published = properties();
+    if (Tracer::instance()->enabled())
+        Tracer::instance()->asyncBegin(QStringLiteral("job.") + m_type, m_id);
+}
+
+Job::~Job()
+{
+}
+
+uint Job::id() const
+{
+    return m_id;
+}
+
+QString Job::type() const
+{
+    return m_type;
+}
+
+uint Job::uid() const
+{
+    return m_uid;
+}
+
+// Unique D-Bus name of the caller that started the job, empty if internal
+QString Job::owner() const
+{
+    return m_owner;
+}
+
+QDBusObjectPath Job::path() const
+{
+    return QDBusObjectPath(JOB_PATH.arg(m_id));
+}
+
+Job::State Job::state() const
+{
+    return m_state;
+}
+
+QString Job::stateName() const
+{
+    return QString::fromLatin1(STATE_NAMES[m_state]);
+}
+
+// Progress never goes backwards and reaches 100 only when finished
+uint Job::progress() const
+{
+    if (m_state == Finished)
+        return 100;
+
+    const quint64 total = m_filesTotal;
+    if (total > 0) {
+        const uint percent = qMin<quint64>(m_filesProcessed * 100 / total, 99);
+        if (percent > m_progress)
+            m_progress = percent;
+    }
+    return m_progress;
+}
+
+qulonglong Job::bytesProcessed() const
+{
+    return m_bytesProcessed;
+}
+
+qulonglong Job::bytesTotal() const
+{
+    return m_bytesTotal;
+}
+
+qulonglong Job::filesProcessed() const
+{
+    return m_filesProcessed;
+}
+
+qulonglong Job::filesTotal() const
+{
+    return m_filesTotal;
+}
+
+bool Job::cancellable() const
+{
+    return m_cancel == CancelAllowed && (m_state == Waiting || m_state == Running);
+}
+
+qint64 Job::elapsed() const
+{
+    return m_timer.nsecsElapsed();
+}
+
+void Job::addTotal(quint64 bytes, quint64 files)
+{
+    m_bytesTotal += bytes;
+    m_filesTotal += files;
+}
+
+void Job::addProcessed(quint64 bytes, quint64 files)
+{
+    m_bytesProcessed += bytes;
+    m_filesProcessed += files;
+}
+
+bool Job::cancelRequested() const
+{
+    return m_cancel == CancelRequested;
+}
+
+// Called when the operation can not be undone anymore, returns false if
+// cancel was requested before that
+bool Job::disableCancel()
+{
+    int expected = CancelAllowed;
+    return m_cancel.compare_exchange_strong(expected, CancelDisabled) || expected == CancelDisabled;
+}
+
+void Job::start()
+{
+    m_state = Running;
+    m_publishTimer->start();
+    publish();
+}
+
+void Job::setProgress(uint percent)
+{
+    m_progress = qMax(m_progress, qMin(percent, 99u));
+}
+
+void Job::finish(State state)
+{
+    m_state = state;
+    m_publishTimer->stop();
+    publish();
+    if (Tracer::instance()->enabled())
+        Tracer::instance()->asyncEnd(QStringLiteral("job.") + m_type, m_id,
+                                     state == Finished ? QString() : stateName());
+    emit finished();
+}
+
+/*
+ * Requests cancellation, allowed for the client that started the job and
+ * root. Operation ends up in cancelled state when it reaches the next point
+ * where it can be stopped.
+ */
+void Job::Cancel()
+{
+    if (calledFromDBus()) {
+        const QString caller = message().service();
+        const uint callerUid = connection().interface()->serviceUid(caller);
+        if (caller != m_owner && callerUid != 0 && !(Sandbox::enabled() && callerUid == getuid())) {
+            auto text = QStringLiteral("Only the owner of the job can cancel it");
+            qCWarning(lcSUM) << "Access denied:" << text;
+            sendErrorReply(QDBusError::AccessDenied, text);
+            return;
+        }
+    }
+
+    int expected = CancelAllowed;
+    if (m_state > Running
+            || (!m_cancel.compare_exchange_strong(expected, CancelRequested) && expected != CancelRequested)) {
+        auto text = QStringLiteral("Job can not be cancelled anymore");
+        qCWarning(lcSUM) << text << m_id;
+        if (calledFromDBus())
+            sendErrorReply(QStringLiteral(SailfishUserManagerErrorJobNotCancellable), text);
+        return;
+    }
+
+    qCDebug(lcSUM) << "Cancel requested for job" << m_id << m_type;
+    publish();
+}
+
+QVariantMap Job::properties() const
+{
+    QVariantMap rv;
+    rv.insert(QStringLiteral("State"), stateName());
+    rv.insert(QStringLiteral("Progress"), progress());
+    rv.insert(QStringLiteral("BytesProcessed"), bytesProcessed());
+    rv.insert(QStringLiteral("BytesTotal"), bytesTotal());
+    rv.insert(QStringLiteral("FilesProcessed"), filesProcessed());
+    rv.insert(QStringLiteral("FilesTotal"), filesTotal());
+    rv.insert(QStringLiteral("Cancellable"), cancellable());
+    return rv;
+}
+
+void Job::publish()
+{
+    QVariantMap changed;
+    const QVariantMap current = properties();
+    for (auto it = current.constBegin(); it != current.constEnd(); ++it) {
+        if (m_published.value(it.key()) != it.value())
+            changed.insert(it.key(), it.value());
+    }
+    if (changed.isEmpty())
+        return;
+
+    m_published = current;
+    QDBusMessage changedSignal = QDBusMessage::createSignal(path().path(), PROPERTIES_INTERFACE,
+                                                            QStringLiteral("PropertiesChanged"));
+    changedSignal << JOB_INTERFACE << changed << QStringList();
+    Sandbox::bus().send(changedSignal);
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#ifndef JOB_H
+#define JOB_H
+
+#include <QDBusContext>
+#include <QDBusObjectPath>
+#include <QElapsedTimer>
+#include <QObject>
+#include <QString>
+#include <QVariantMap>
+
+#include <atomic>
+
+class QTimer;
+
+// Long running operation exported at /jobs/<id>. Counters are updated from
+// worker threads and published as PropertiesChanged from the event loop at
+// most every PUBLISH_INTERVAL. Job can be cancelled until the operation
+// reaches a point where it can not be undone.
+class Job : public QObject, protected QDBusContext
+{
+    Q_OBJECT
+    Q_PROPERTY(uint Id READ id)
+    Q_PROPERTY(QString Type READ type)
+    Q_PROPERTY(uint Uid READ uid)
+    Q_PROPERTY(QString State READ stateName)
+    Q_PROPERTY(uint Progress READ progress)
+    Q_PROPERTY(qulonglong BytesProcessed READ bytesProcessed)
+    Q_PROPERTY(qulonglong BytesTotal READ bytesTotal)
+    Q_PROPERTY(qulonglong FilesProcessed READ filesProcessed)
+    Q_PROPERTY(qulonglong FilesTotal READ filesTotal)
+    Q_PROPERTY(bool Cancellable READ cancellable)
+
+public:
+    enum State {
+        Waiting,
+        Running,
+        Finished,
+        Failed,
+        Cancelled
+    };
+
+    Job(uint id, const QString &type, uint uid, const QString &owner, QObject *parent = nullptr);
+    ~Job();
+
+    uint id() const;
+    QString type() const;
+    uint uid() const;
+    QString owner() const;
+    QDBusObjectPath path() const;
+    State state() const;
+    QString stateName() const;
+    uint progress() const;
+    qulonglong bytesProcessed() const;
+    qulonglong bytesTotal() const;
+    qulonglong filesProcessed() const;
+    qulonglong filesTotal() const;
+    bool cancellable() const;
+    qint64 elapsed() const;
+
+    // Thread safe
+    void addTotal(quint64 bytes, quint64 files);
+    void addProcessed(quint64 bytes, quint64 files);
+    bool cancelRequested() const;
+    bool disableCancel();
+
+    void start();
+    void setProgress(uint percent);
+    void finish(State state);
+
+public slots:
+    void Cancel();
+
+signals:
+    void finished();
+
+private slots:
+    void publish();
+
+private:
+    QVariantMap properties() const;
+
+    enum CancelState {
+        CancelAllowed,
+        CancelRequested,
+        CancelDisabled
+    };
+
+    uint m_id;
+    QString m_type;
+    uint m_uid;
+    QString m_owner;
+    State m_state;
+    mutable uint m_progress;
+    std::atomic<quint64> m_bytesProcessed;
+    std::atomic<quint64> m_bytesTotal;
+    std::atomic<quint64> m_filesProcessed;
+    std::atomic<quint64> m_filesTotal;
+    std::atomic<int> m_cancel;
+    QElapsedTimer m_timer;
+    QTimer *m_publishTimer;
+    QVariantMap m_published;
+};
+
+#endif // JOB_H
@@ -8,23 +8,41 @@
  */
 
 #include "libuserhelper.h"
+#include "accountreader.h"
 #include "logging.h"
+#include "metrics.h"
+#include "sandbox.h"
 
 #include <libuser/user.h>
 #include <QUuid>
 
-LibUserHelper::LibUserHelper()
+LibUserHelper::LibUserHelper() :
+    m_accounts(new AccountReader(Sandbox::path(QStringLiteral("/etc/passwd")),
+                                 Sandbox::path(QStringLiteral("/etc/group"))))
 {
 }
 
+LibUserHelper::~LibUserHelper()
+{
+    delete m_accounts;
+    m_accounts = nullptr;
+}
+
+AccountReader *LibUserHelper::accounts() const
+{
+    return m_accounts;
+}
+
 uint LibUserHelper::addGroup(const QString &group, int gid)
 {
+    MetricsScope scope("libuser.addGroup");
     struct lu_error *error = nullptr;
     struct lu_context *context = lu_start(NULL, lu_user, NULL, NULL, NULL, NULL, &error);
 
     if (!context) {
         qCWarning(lcSUM) << "Error creating context:" << lu_strerror(error);
         lu_error_free(&error);
+        scope.fail();
         return 0;
     }
 
@@ -51,17 +69,22 @@ uint LibUserHelper::addGroup(const QString &group, int gid)
     lu_ent_free(ent_group);
     lu_end(context);
 
+    if (!rv)
+        scope.fail();
+
     return rv;
 }
 
 bool LibUserHelper::removeGroup(uint gid)
 {
+    MetricsScope scope("libuser.removeGroup");
     struct lu_error *error = nullptr;
     struct lu_context *context = lu_start(NULL, lu_user, NULL, NULL, NULL, NULL, &error);
 
     if (!context) {
         qCWarning(lcSUM) << "Error creating context:" << lu_strerror(error);
         lu_error_free(&error);
+        scope.fail();
         return 0;
     }
 
@@ -83,16 +106,24 @@ bool LibUserHelper::removeGroup(uint gid)
     lu_ent_free(ent_group);
     lu_end(context);
 
+    if (!rv)
+        scope.fail();
+
     return rv;
 }
 
 bool LibUserHelper::addUserToGroup(const QString &user, const QString &group)
 {
+    MetricsScope scope("libuser.addUserToGroup");
+    // Index must be current for the in place update below
+    m_accounts->refresh();
+
     struct lu_error *error = nullptr;
     struct lu_context *context = lu_start(NULL, lu_user, NULL, NULL, NULL, NULL, &error);
     if (!context) {
         qCWarning(lcSUM) << "Error creating context:" << lu_strerror(error);
         lu_error_free(&error);
+        scope.fail();
         return false;
     }
 
@@ -120,16 +151,26 @@ bool LibUserHelper::addUserToGroup(const QString &user, const QString &group)
     lu_ent_free(ent);
     lu_end(context);
 
+    if (rv)
+        m_accounts->setMember(user, group, true);
+    else
+        scope.fail();
+
     return rv;
 }
 
 bool LibUserHelper::removeUserFromGroup(const QString &user, const QString &group)
 {
+    MetricsScope scope("libuser.removeUserFromGroup");
+    // Index must be current for the in place update below
+    m_accounts->refresh();
+
     struct lu_error *error = nullptr;
     struct lu_context *context = lu_start(NULL, lu_user, NULL, NULL, NULL, NULL, &error);
     if (!context) {
         qCWarning(lcSUM) << "Error creating context:" << lu_strerror(error);
         lu_error_free(&error);
+        scope.fail();
         return false;
     }
 
@@ -157,13 +198,20 @@ bool LibUserHelper::removeUserFromGroup(const QString &user, const QString &grou
     lu_ent_free(ent);
     lu_end(context);
 
+    if (rv)
+        m_accounts->setMember(user, group, false);
+    else
+        scope.fail();
+
     return rv;
 }
 
 uint LibUserHelper::addUser(const QString &user, const QString& name, uint uid, const QString &home)
 {
+    MetricsScope scope("libuser.addUser");
     if (name.contains(',') || name.contains(':')) {
         qCWarning(lcSUM) << "Invalid user name, comma or colon is not allowed";
+        scope.fail();
         return 0;
     }
     struct lu_error *error = nullptr;
@@ -171,12 +219,15 @@ uint LibUserHelper::addUser(const QString &user, const QString& name, uint uid,
     if (!context) {
         qCWarning(lcSUM) << "Error creating context:" << lu_strerror(error);
         lu_error_free(&error);
+        scope.fail();
         return 0;
     }
 
     uint gid = addGroup(user, uid);
-    if (!gid)
+    if (!gid) {
+        scope.fail();
         return 0;
+    }
 
     uint rv = 0;
     struct lu_ent *ent_user = lu_ent_new();
@@ -219,16 +270,21 @@ uint LibUserHelper::addUser(const QString &user, const QString& name, uint uid,
     lu_ent_free(ent_user);
     lu_end(context);
 
+    if (!rv)
+        scope.fail();
+
     return rv;
 }
 
 bool LibUserHelper::removeUser(uint uid)
 {
+    MetricsScope scope("libuser.removeUser");
     struct lu_error *error = nullptr;
     struct lu_context *context = lu_start(NULL, lu_user, NULL, NULL, NULL, NULL, &error);
     if (!context) {
         qCWarning(lcSUM) << "Error creating context:" << lu_strerror(error);
         lu_error_free(&error);
+        scope.fail();
         return false;
     }
 
@@ -299,13 +355,18 @@ bool LibUserHelper::removeUser(uint uid)
     lu_ent_free(entGroup);
     lu_end(context);
 
+    if (!rv)
+        scope.fail();
+
     return rv;
 }
 
 bool LibUserHelper::modifyUser(uint uid, const QString &newName) const
 {
+    MetricsScope scope("libuser.modifyUser");
     if (newName.contains(',') || newName.contains(':')) {
         qCWarning(lcSUM) << "Invalid new user name, comma or colon is not allowed";
+        scope.fail();
         return false;
     }
     struct lu_error *error = nullptr;
@@ -313,6 +374,7 @@ bool LibUserHelper::modifyUser(uint uid, const QString &newName) const
     if (!context) {
         qCWarning(lcSUM) << "Error creating context:" << lu_strerror(error);
         lu_error_free(&error);
+        scope.fail();
         return false;
     }
 
@@ -348,78 +410,58 @@ bool LibUserHelper::modifyUser(uint uid, const QString &newName) const
     lu_ent_free(ent);
     lu_end(context);
 
+    if (!rv)
+        scope.fail();
+
     return rv;
 }
 
 QString LibUserHelper::homeDir(uint uid)
 {
-    struct lu_error *error = nullptr;
-    struct lu_context *context = lu_start(NULL, lu_user, NULL, NULL, NULL, NULL, &error);
-    if (!context) {
-        qCWarning(lcSUM) << "Error creating context:" << lu_strerror(error);
-        lu_error_free(&error);
-        return QString();
-    }
-
-    QString rv;
-    struct lu_ent *ent = lu_ent_new();
-    if (lu_user_lookup_id(context, uid, ent, &error)) {
-        rv = lu_ent_get_first_string(ent, LU_HOMEDIRECTORY);
-    } else {
+    MetricsScope scope("libuser.homeDir");
+    m_accounts->refresh();
+    AccountReader::User user;
+    if (!m_accounts->findUser(uid, &user)) {
         qCWarning(lcSUM) << "Could not find user";
-        if (error)
-            lu_error_free(&error);
+        scope.fail();
+        return QString();
     }
 
-    lu_ent_free(ent);
-    lu_end(context);
-
-    return rv;
+    return user.home;
 }
 
 QStringList LibUserHelper::groups(uint uid)
 {
-    struct lu_error *error = nullptr;
-    struct lu_context *context = lu_start(NULL, lu_user, NULL, NULL, NULL, NULL, &error);
-    if (!context) {
-        qCWarning(lcSUM) << "Error creating context:" << lu_strerror(error);
-        lu_error_free(&error);
-        return QStringList();
-    }
-
-    QStringList rv;
-    struct lu_ent *ent = lu_ent_new();
-    if (lu_user_lookup_id(context, uid, ent, &error)) {
-        const char *user = lu_ent_get_first_string(ent, LU_USERNAME);
-        GValueArray *groups = lu_groups_enumerate_by_user(context, user, &error);
-        if (groups) {
-            for (uint i = 0; i < groups->n_values; i++) {
-                rv.append(g_value_get_string(g_value_array_get_nth(groups, i)));
-            }
-            g_value_array_free(groups);
-        } else {
-            qCWarning(lcSUM) << "Error getting users groups:" << lu_strerror(error);
-            lu_error_free(&error);
-        }
-    } else {
+    MetricsScope scope("libuser.groups");
+    m_accounts->refresh();
+    AccountReader::User user;
+    if (!m_accounts->findUser(uid, &user)) {
         qCWarning(lcSUM) << "Could not find user";
-        if (error)
-            lu_error_free(&error);
+        scope.fail();
+        return QStringList();
     }
 
-    lu_ent_free(ent);
-    lu_end(context);
-
-    return rv;
+    return m_accounts->groupsOfUser(user.name);
 }
 
 QString LibUserHelper::getUserUuid(uint uid) const
 {
+    MetricsScope scope("libuser.getUserUuid");
+    m_accounts->refresh();
+    AccountReader::User user;
+    if (m_accounts->findUser(uid, &user)) {
+        const auto list = user.gecos.split(',');
+        if (list.size() > 1 && !list[1].isEmpty())
+            return list[1];
+    }
+
+    // Not found or needs a new uuid, go through libuser
     struct lu_error *error = nullptr;
     struct lu_context *context = lu_start(NULL, lu_user, NULL, NULL, NULL, NULL, &error);
     if (!context) {
         qCWarning(lcSUM) << "Error creating context:" << lu_strerror(error);
         lu_error_free(&error);
+        scope.fail();
         return QString();
     }
 
@@ -462,5 +504,8 @@ QString LibUserHelper::getUserUuid(uint uid) const
     lu_ent_free(ent);
     lu_end(context);
 
+    if (userUuid.isEmpty())
+        scope.fail();
+
     return userUuid;
 }
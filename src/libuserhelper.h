@@ -12,10 +12,15 @@
 
 #include <QString>
 
+class AccountReader;
+
+// Account database writes through libuser. Not thread safe, the daemon
+// uses it only from the writer lane of AccountLanes.
 class LibUserHelper
 {
 public:
     LibUserHelper();
+    ~LibUserHelper();
     uint addGroup(const QString &group, int gid = 0);
     bool removeGroup(uint gid);
     bool addUserToGroup(const QString &user, const QString &group);
@@ -26,6 +31,12 @@ public:
     QString homeDir(uint uid);
     QStringList groups(uint uid);
     QString getUserUuid(uint uid) const;
+    AccountReader *accounts() const;
+
+private:
+    Q_DISABLE_COPY(LibUserHelper)
+
+    AccountReader *m_accounts;
 };
 
 #endif // LIBUSERHELPER_H
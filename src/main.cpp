@@ -9,13 +9,18 @@
 
 #include <QCoreApplication>
 
+#include "flightrecorder.h"
 #include "sailfishusermanager.h"
+#include "sandbox.h"
 
 int main(int argc, char *argv[])
 {
     QCoreApplication app(argc, argv);
     if (argc > 2 && !strcmp(argv[1], "--removeUserFiles"))
         return SailfishUserManager::removeUserFiles(argv[2]);
+    if (argc > 2 && !strcmp(argv[1], "--sandbox") && !Sandbox::setup(QString::fromLocal8Bit(argv[2])))
+        return EXIT_FAILURE;
+    FlightRecorder::installCrashHandler();
     SailfishUserManager daemon;
     return app.exec();
 }
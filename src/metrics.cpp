@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#include "metrics.h"
+#include "flightrecorder.h"
+#include "tracer.h"
+
+#include <QTextStream>
+
+namespace {
+thread_local MetricsScope *currentScope = nullptr;
+}
+
+Metrics::Metrics()
+{
+}
+
+Metrics *Metrics::instance()
+{
+    static Metrics metrics;
+    return &metrics;
+}
+
+int Metrics::bucket(qint64 nsecs)
+{
+    qint64 usecs = nsecs / 1000;
+    int i = 0;
+    while (usecs && i < BUCKETS - 1) {
+        usecs >>= 1;
+        i++;
+    }
+    return i;
+}
+
+void Metrics::record(const QString &operation, qint64 nsecs, const QString &error)
+{
+    QMutexLocker locker(&m_mutex);
+    auto it = m_operations.find(operation);
+    if (it == m_operations.end()) {
+        Operation empty = { 0, 0, 0, 0, 0, { 0 }, QHash<QString, quint64>() };
+        it = m_operations.insert(operation, empty);
+    }
+
+    Operation &op = *it;
+    if (!op.calls || nsecs < op.minNsecs)
+        op.minNsecs = nsecs;
+    if (nsecs > op.maxNsecs)
+        op.maxNsecs = nsecs;
+    op.calls++;
+    op.totalNsecs += nsecs;
+    op.histogram[bucket(nsecs)]++;
+    if (!error.isEmpty()) {
+        op.errors++;
+        op.errorNames[error]++;
+    }
+}
+
+// Upper bound of the bucket where the percentile falls, in microseconds
+qint64 Metrics::percentile(const Operation &operation, int percent)
+{
+    quint64 target = (operation.calls * percent + 99) / 100;
+    quint64 seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += operation.histogram[i];
+        if (seen >= target)
+            return qint64(1) << i;
+    }
+    return operation.maxNsecs / 1000;
+}
+
+QString Metrics::dump() const
+{
+    QMutexLocker locker(&m_mutex);
+    QString rv;
+    QTextStream out(&rv);
+    for (auto it = m_operations.constBegin(); it != m_operations.constEnd(); ++it) {
+        const Operation &op = it.value();
+        out << it.key()
+            << " calls=" << op.calls
+            << " errors=" << op.errors
+            << " mean_us=" << (op.calls ? op.totalNsecs / qint64(op.calls) / 1000 : 0)
+            << " min_us=" << op.minNsecs / 1000
+            << " p50_us=" << percentile(op, 50)
+            << " p90_us=" << percentile(op, 90)
+            << " p99_us=" << percentile(op, 99)
+            << " max_us=" << op.maxNsecs / 1000
+            << '\n';
+        for (auto error = op.errorNames.constBegin(); error != op.errorNames.constEnd(); ++error)
+            out << it.key() << " error " << error.key() << '=' << error.value() << '\n';
+        out << it.key() << " histogram_us";
+        for (int i = 0; i < BUCKETS; i++) {
+            if (op.histogram[i])
+                out << " <" << (qint64(1) << i) << '=' << op.histogram[i];
+        }
+        out << '\n';
+    }
+    out.flush();
+    return rv;
+}
+
+void Metrics::reset()
+{
+    QMutexLocker locker(&m_mutex);
+    m_operations.clear();
+}
+
+MetricsScope::MetricsScope(const QString &operation) :
+    m_operation(operation),
+    m_traceStart(Tracer::instance()->enabled() ? Tracer::timestamp() : -1),
+    m_parent(currentScope),
+    m_deferred(false)
+{
+    currentScope = this;
+    FlightRecorder::record(m_operation, FlightRecorder::Begin);
+    m_timer.start();
+}
+
+MetricsScope::~MetricsScope()
+{
+    if (!m_deferred)
+        finish(m_operation, m_timer.nsecsElapsed(), m_traceStart, m_error);
+    currentScope = m_parent;
+}
+
+void MetricsScope::finish(const QString &operation, qint64 nsecs, qint64 traceStart, const QString &error)
+{
+    FlightRecorder::record(operation, error.isEmpty() ? FlightRecorder::End : FlightRecorder::Failed);
+    Metrics::instance()->record(operation, nsecs, error);
+    if (traceStart >= 0)
+        Tracer::instance()->complete(operation, traceStart, nsecs / 1000, error);
+}
+
+void MetricsScope::fail(const QString &error)
+{
+    m_error = error;
+}
+
+// Sets error to the innermost scope and to enclosing scopes without error,
+// an error reply from a nested call fails the outer call as well
+void MetricsScope::setError(const QString &error)
+{
+    for (MetricsScope *scope = currentScope; scope; scope = scope->m_parent) {
+        if (scope->m_error.isEmpty())
+            scope->m_error = error;
+    }
+}
+
+DelayedReply::DelayedReply(MetricsScope *scope, const QDBusConnection &connection, const QDBusMessage &request) :
+    m_operation(scope->m_operation),
+    m_timer(scope->m_timer),
+    m_traceStart(scope->m_traceStart),
+    m_connection(connection),
+    m_request(request)
+{
+    scope->m_deferred = true;
+}
+
+void DelayedReply::send(const QVariantList &arguments) const
+{
+    m_connection.send(m_request.createReply(arguments));
+    MetricsScope::finish(m_operation, m_timer.nsecsElapsed(), m_traceStart, QString());
+}
+
+void DelayedReply::sendError(const QString &name, const QString &message) const
+{
+    m_connection.send(m_request.createErrorReply(name, message));
+    MetricsScope::finish(m_operation, m_timer.nsecsElapsed(), m_traceStart, name);
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+#include <QString>
+#include <QVariantList>
+
+// Call counts, error counts by error name and latency histograms for
+// D-Bus methods and internal operations. Thread safe.
+class Metrics
+{
+public:
+    static Metrics *instance();
+
+    void record(const QString &operation, qint64 nsecs, const QString &error = QString());
+    QString dump() const;
+    void reset();
+
+private:
+    Metrics();
+
+    // Bucket i counts latencies in [2^(i-1), 2^i) microseconds, bucket 0 is below 1 us
+    static const int BUCKETS = 32;
+
+    struct Operation {
+        quint64 calls;
+        quint64 errors;
+        qint64 totalNsecs;
+        qint64 minNsecs;
+        qint64 maxNsecs;
+        quint64 histogram[BUCKETS];
+        QHash<QString, quint64> errorNames;
+    };
+
+    static int bucket(qint64 nsecs);
+    static qint64 percentile(const Operation &operation, int percent);
+
+    mutable QMutex m_mutex;
+    QMap<QString, Operation> m_operations;
+};
+
+// Measures the time of its lifetime and records it to Metrics, to
+// FlightRecorder, and as a trace event if tracing is enabled. Errors are
+// recorded with setError() on the innermost scope of the current thread or
+// with fail() on a specific scope.
+class MetricsScope
+{
+public:
+    explicit MetricsScope(const QString &operation);
+    ~MetricsScope();
+
+    void fail(const QString &error = QStringLiteral("Failed"));
+    static void setError(const QString &error);
+
+private:
+    Q_DISABLE_COPY(MetricsScope)
+    friend class DelayedReply;
+
+    static void finish(const QString &operation, qint64 nsecs, qint64 traceStart, const QString &error);
+
+    QString m_operation;
+    QString m_error;
+    QElapsedTimer m_timer;
+    qint64 m_traceStart;
+    MetricsScope *m_parent;
+    bool m_deferred;
+};
+
+// Reply to a D-Bus call that is sent after the call has returned. Takes
+// over recording from the scope of the call, so that the latency and the
+// error are recorded when the reply is sent. Copies share nothing, only one
+// of them may be sent.
+class DelayedReply
+{
+public:
+    DelayedReply(MetricsScope *scope, const QDBusConnection &connection, const QDBusMessage &request);
+
+    void send(const QVariantList &arguments = QVariantList()) const;
+    void sendError(const QString &name, const QString &message) const;
+
+private:
+    QString m_operation;
+    QElapsedTimer m_timer;
+    qint64 m_traceStart;
+    QDBusConnection m_connection;
+    QDBusMessage m_request;
+};
+
+#endif // METRICS_H
@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#include "quotamonitor.h"
+#include "logging.h"
+
+#include <QFile>
+#include <QSocketNotifier>
+
+#include <errno.h>
+#include <linux/genetlink.h>
+#include <linux/netlink.h>
+#include <linux/quota.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+namespace {
+
+const char QUOTA_FAMILY_NAME[] = "VFS_DQUOT";
+const char QUOTA_EVENTS_GROUP[] = "events";
+const int BUFFER_SIZE = 8192;
+
+// Calls visit(type, payload, payloadLength) for every attribute in data
+template<typename Visitor>
+void forEachAttribute(const char *data, int length, Visitor visit)
+{
+    while (length >= NLA_HDRLEN) {
+        const struct nlattr *attr = reinterpret_cast<const struct nlattr *>(data);
+        if (attr->nla_len < NLA_HDRLEN || attr->nla_len > length)
+            return;
+        visit(attr->nla_type & NLA_TYPE_MASK, data + NLA_HDRLEN, attr->nla_len - NLA_HDRLEN);
+        int aligned = NLA_ALIGN(attr->nla_len);
+        data += aligned;
+        length -= aligned;
+    }
+}
+
+template<typename T>
+T attributeValue(const char *payload, int length)
+{
+    T value = 0;
+    if (length >= int(sizeof(T)))
+        memcpy(&value, payload, sizeof(T));
+    return value;
+}
+
+bool warningName(uint warning, QString *resource, QString *limit)
+{
+    switch (warning) {
+    case QUOTA_NL_IHARDWARN:
+    case QUOTA_NL_ISOFTLONGWARN:
+    case QUOTA_NL_ISOFTWARN:
+    case QUOTA_NL_IHARDBELOW:
+    case QUOTA_NL_ISOFTBELOW:
+        *resource = QStringLiteral("inodes");
+        break;
+    case QUOTA_NL_BHARDWARN:
+    case QUOTA_NL_BSOFTLONGWARN:
+    case QUOTA_NL_BSOFTWARN:
+    case QUOTA_NL_BHARDBELOW:
+    case QUOTA_NL_BSOFTBELOW:
+        *resource = QStringLiteral("blocks");
+        break;
+    default:
+        return false;
+    }
+
+    switch (warning) {
+    case QUOTA_NL_IHARDWARN:
+    case QUOTA_NL_BHARDWARN:
+        *limit = QStringLiteral("hard");
+        break;
+    case QUOTA_NL_ISOFTLONGWARN:
+    case QUOTA_NL_BSOFTLONGWARN:
+        *limit = QStringLiteral("grace-expired");
+        break;
+    case QUOTA_NL_ISOFTWARN:
+    case QUOTA_NL_BSOFTWARN:
+        *limit = QStringLiteral("soft");
+        break;
+    case QUOTA_NL_IHARDBELOW:
+    case QUOTA_NL_BHARDBELOW:
+        *limit = QStringLiteral("below-hard");
+        break;
+    default:
+        *limit = QStringLiteral("below-soft");
+        break;
+    }
+    return true;
+}
+
+} // namespace
+
+QuotaMonitor::QuotaMonitor(const QString &path, QObject *parent) :
+    QObject(parent),
+    m_socket(-1),
+    m_family(-1),
+    m_device(0),
+    m_notifier(nullptr)
+{
+    struct stat info;
+    if (stat(QFile::encodeName(path).constData(), &info) < 0) {
+        qCWarning(lcSUM) << "Can not listen to quota warnings, could not stat" << path << strerror(errno);
+        return;
+    }
+    m_device = info.st_dev;
+
+    m_socket = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+    if (m_socket < 0) {
+        qCWarning(lcSUM) << "Can not listen to quota warnings, could not open netlink socket:" << strerror(errno);
+        return;
+    }
+
+    if (!subscribe()) {
+        close(m_socket);
+        m_socket = -1;
+        return;
+    }
+
+    m_notifier = new QSocketNotifier(m_socket, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, &QuotaMonitor::readMessages);
+}
+
+QuotaMonitor::~QuotaMonitor()
+{
+    delete m_notifier;
+    m_notifier = nullptr;
+    if (m_socket >= 0)
+        close(m_socket);
+}
+
+bool QuotaMonitor::isValid() const
+{
+    return m_notifier != nullptr;
+}
+
+/*
+ * Resolves quota family and its multicast group from the generic netlink
+ * controller and joins the group. Socket is blocking until this is done.
+ */
+bool QuotaMonitor::subscribe()
+{
+    struct sockaddr_nl address;
+    memset(&address, 0, sizeof(address));
+    address.nl_family = AF_NETLINK;
+    if (bind(m_socket, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) < 0) {
+        qCWarning(lcSUM) << "Can not listen to quota warnings, could not bind netlink socket:" << strerror(errno);
+        return false;
+    }
+
+    struct {
+        struct nlmsghdr header;
+        struct genlmsghdr genl;
+        char attributes[NLA_HDRLEN + NLA_ALIGN(sizeof(QUOTA_FAMILY_NAME))];
+    } request;
+    memset(&request, 0, sizeof(request));
+    struct nlattr *name = reinterpret_cast<struct nlattr *>(request.attributes);
+    name->nla_type = CTRL_ATTR_FAMILY_NAME;
+    name->nla_len = NLA_HDRLEN + sizeof(QUOTA_FAMILY_NAME);
+    memcpy(request.attributes + NLA_HDRLEN, QUOTA_FAMILY_NAME, sizeof(QUOTA_FAMILY_NAME));
+    request.header.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN) + NLA_ALIGN(name->nla_len);
+    request.header.nlmsg_type = GENL_ID_CTRL;
+    request.header.nlmsg_flags = NLM_F_REQUEST;
+    request.header.nlmsg_seq = 1;
+    request.genl.cmd = CTRL_CMD_GETFAMILY;
+    request.genl.version = 1;
+
+    if (send(m_socket, &request, request.header.nlmsg_len, 0) < 0) {
+        qCWarning(lcSUM) << "Can not listen to quota warnings, could not query family:" << strerror(errno);
+        return false;
+    }
+
+    char buffer[BUFFER_SIZE];
+    int length = recv(m_socket, buffer, sizeof(buffer), 0);
+    const struct nlmsghdr *header = reinterpret_cast<const struct nlmsghdr *>(buffer);
+    if (length < 0 || !NLMSG_OK(header, length) || header->nlmsg_type != GENL_ID_CTRL) {
+        // Kernel without CONFIG_QUOTA_NETLINK_INTERFACE replies with an error
+        qCWarning(lcSUM) << "Can not listen to quota warnings, kernel does not provide them";
+        return false;
+    }
+
+    int group = -1;
+    forEachAttribute(static_cast<const char *>(NLMSG_DATA(header)) + GENL_HDRLEN,
+                     header->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN),
+                     [this, &group](int type, const char *payload, int payloadLength) {
+        if (type == CTRL_ATTR_FAMILY_ID) {
+            m_family = attributeValue<quint16>(payload, payloadLength);
+        } else if (type == CTRL_ATTR_MCAST_GROUPS) {
+            forEachAttribute(payload, payloadLength, [&group](int, const char *groupPayload, int groupLength) {
+                QByteArray groupName;
+                int groupId = -1;
+                forEachAttribute(groupPayload, groupLength,
+                                 [&groupName, &groupId](int groupType, const char *value, int valueLength) {
+                    if (groupType == CTRL_ATTR_MCAST_GRP_NAME)
+                        groupName = QByteArray(value, qstrnlen(value, valueLength));
+                    else if (groupType == CTRL_ATTR_MCAST_GRP_ID)
+                        groupId = attributeValue<quint32>(value, valueLength);
+                });
+                if (groupName == QUOTA_EVENTS_GROUP)
+                    group = groupId;
+            });
+        }
+    });
+
+    if (m_family < 0 || group < 0) {
+        qCWarning(lcSUM) << "Can not listen to quota warnings, multicast group not found";
+        return false;
+    }
+
+    if (setsockopt(m_socket, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &group, sizeof(group)) < 0) {
+        qCWarning(lcSUM) << "Can not listen to quota warnings, could not join group:" << strerror(errno);
+        return false;
+    }
+
+    return true;
+}
+
+void QuotaMonitor::readMessages()
+{
+    char buffer[BUFFER_SIZE];
+    int length;
+    while ((length = recv(m_socket, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+        const struct nlmsghdr *header = reinterpret_cast<const struct nlmsghdr *>(buffer);
+        for (; NLMSG_OK(header, length); header = NLMSG_NEXT(header, length)) {
+            if (header->nlmsg_type == m_family)
+                handleMessage(static_cast<const char *>(NLMSG_DATA(header)),
+                              header->nlmsg_len - NLMSG_LENGTH(0));
+        }
+    }
+    if (length < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        // ENOBUFS means that warnings were dropped, there is nothing to recover
+        qCWarning(lcSUM) << "Reading quota warnings failed:" << strerror(errno);
+    }
+}
+
+void QuotaMonitor::handleMessage(const char *data, int length)
+{
+    if (length < GENL_HDRLEN)
+        return;
+    const struct genlmsghdr *genl = reinterpret_cast<const struct genlmsghdr *>(data);
+    if (genl->cmd != QUOTA_NL_C_WARNING)
+        return;
+
+    uint quotaType = USRQUOTA + 1;
+    quint64 id = 0;
+    uint warningType = QUOTA_NL_NOWARN;
+    uint major = 0;
+    uint minor = 0;
+    forEachAttribute(data + GENL_HDRLEN, length - GENL_HDRLEN,
+                     [&](int type, const char *payload, int payloadLength) {
+        switch (type) {
+        case QUOTA_NL_A_QTYPE:
+            quotaType = attributeValue<quint32>(payload, payloadLength);
+            break;
+        case QUOTA_NL_A_EXCESS_ID:
+            id = attributeValue<quint64>(payload, payloadLength);
+            break;
+        case QUOTA_NL_A_WARNING:
+            warningType = attributeValue<quint32>(payload, payloadLength);
+            break;
+        case QUOTA_NL_A_DEV_MAJOR:
+            major = attributeValue<quint32>(payload, payloadLength);
+            break;
+        case QUOTA_NL_A_DEV_MINOR:
+            minor = attributeValue<quint32>(payload, payloadLength);
+            break;
+        }
+    });
+
+    QString resource;
+    QString limit;
+    if (quotaType != USRQUOTA || makedev(major, minor) != m_device || !warningName(warningType, &resource, &limit))
+        return;
+
+    qCDebug(lcSUM) << "Quota warning for" << id << resource << limit;
+    emit warning(uint(id), resource, limit);
+}
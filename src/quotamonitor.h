@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#ifndef QUOTAMONITOR_H
+#define QUOTAMONITOR_H
+
+#include <QObject>
+#include <QString>
+
+#include <sys/types.h>
+
+class QSocketNotifier;
+
+// Listens to quota warnings that the kernel multicasts on VFS_DQUOT generic
+// netlink family. Only user quota warnings for the file system of the given
+// path are reported. Kept in its own file as <linux/quota.h> can not be
+// included together with <sys/quota.h>.
+class QuotaMonitor : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit QuotaMonitor(const QString &path, QObject *parent = nullptr);
+    ~QuotaMonitor();
+
+    bool isValid() const;
+
+signals:
+    // resource is "blocks" or "inodes", limit is one of "soft", "hard",
+    // "grace-expired", "below-soft" and "below-hard"
+    void warning(uint uid, const QString &resource, const QString &limit);
+
+private slots:
+    void readMessages();
+
+private:
+    bool subscribe();
+    void handleMessage(const char *data, int length);
+
+    int m_socket;
+    int m_family;
+    dev_t m_device;
+    QSocketNotifier *m_notifier;
+};
+
+#endif // QUOTAMONITOR_H
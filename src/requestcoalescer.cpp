@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#include "requestcoalescer.h"
+#include "logging.h"
+
+#include <QFutureWatcher>
+#include <QTimer>
+#include <QtConcurrentRun>
+
+RequestCoalescer::Reply RequestCoalescer::Reply::value(const QVariant &value)
+{
+    Reply reply;
+    reply.arguments << value;
+    return reply;
+}
+
+RequestCoalescer::Reply RequestCoalescer::Reply::error(const QString &name, const QString &message)
+{
+    Reply reply;
+    reply.errorName = name;
+    reply.errorMessage = message;
+    return reply;
+}
+
+RequestCoalescer::RequestCoalescer(QObject *parent) :
+    QObject(parent)
+{
+}
+
+/*
+ * The first request for a key schedules the computation for the next event
+ * loop iteration, and requests dispatched before that join it.
+ */
+void RequestCoalescer::enqueue(const QString &key, const DelayedReply &reply, const Compute &compute,
+                               QThreadPool *lane)
+{
+    auto it = m_pending.find(key);
+    if (it != m_pending.end()) {
+        it->requests.append(reply);
+        return;
+    }
+
+    Pending pending = { compute, lane, QList<DelayedReply>() << reply };
+    m_pending.insert(key, pending);
+    QTimer::singleShot(0, this, [this, key]() { run(key); });
+}
+
+void RequestCoalescer::run(const QString &key)
+{
+    // Requests arriving during computation get a fresh result
+    Pending pending = m_pending.take(key);
+
+    if (!pending.lane) {
+        reply(pending, compute(key, pending.compute), key);
+        return;
+    }
+
+    QFutureWatcher<Reply> *watcher = new QFutureWatcher<Reply>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [watcher, pending, key]() {
+        watcher->deleteLater();
+        reply(pending, watcher->result(), key);
+    });
+    const Compute work = pending.compute;
+    watcher->setFuture(QtConcurrent::run(pending.lane, [key, work]() { return compute(key, work); }));
+}
+
+RequestCoalescer::Reply RequestCoalescer::compute(const QString &key, const Compute &compute)
+{
+    MetricsScope scope(QStringLiteral("coalesced.") + key);
+    const Reply reply = compute();
+    if (reply.isError())
+        scope.fail(reply.errorName);
+    return reply;
+}
+
+void RequestCoalescer::reply(const Pending &pending, const Reply &reply, const QString &key)
+{
+    qCDebug(lcSUM) << "Replying to" << pending.requests.count() << "coalesced" << key << "requests";
+    for (const DelayedReply &request : pending.requests) {
+        if (reply.isError())
+            request.sendError(reply.errorName, reply.errorMessage);
+        else
+            request.send(reply.arguments);
+    }
+}
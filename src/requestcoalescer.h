@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#ifndef REQUESTCOALESCER_H
+#define REQUESTCOALESCER_H
+
+#include "metrics.h"
+
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QVariantList>
+
+#include <functional>
+
+class QThreadPool;
+
+// Coalesces identical read requests. Requests with the same key that arrive
+// while a computation is pending share its result and are replied together.
+// Computations run in the calling thread or in a given thread pool, replies
+// are always sent from the calling thread and record the latency and the
+// error of each request.
+class RequestCoalescer : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Reply {
+        QVariantList arguments;
+        QString errorName;
+        QString errorMessage;
+
+        bool isError() const { return !errorName.isEmpty(); }
+        static Reply value(const QVariant &value);
+        static Reply error(const QString &name, const QString &message);
+    };
+
+    typedef std::function<Reply()> Compute;
+
+    explicit RequestCoalescer(QObject *parent = nullptr);
+
+    void enqueue(const QString &key, const DelayedReply &reply, const Compute &compute,
+                 QThreadPool *lane = nullptr);
+
+private:
+    struct Pending {
+        Compute compute;
+        QThreadPool *lane;
+        QList<DelayedReply> requests;
+    };
+
+    void run(const QString &key);
+    static Reply compute(const QString &key, const Compute &compute);
+    static void reply(const Pending &pending, const Reply &reply, const QString &key);
+
+    QHash<QString, Pending> m_pending;
+};
+
+#endif // REQUESTCOALESCER_H
@@ -9,8 +9,30 @@
 
 #include "sailfishusermanager.h"
 #include "usermanager_adaptor.h"
+#include "accountlanes.h"
+#include "accountreader.h"
+#include "accountwatcher.h"
+#include "admission.h"
+#include "config.h"
+#include "debuginterface.h"
+#include "filetree.h"
+#include "flightrecorder.h"
+#include "hookrunner.h"
+#include "idlepolicy.h"
+#include "job.h"
+#include "job_adaptor.h"
 #include "libuserhelper.h"
+#include "metrics.h"
+#include "quotamonitor.h"
+#include "requestcoalescer.h"
+#include "sandbox.h"
+#include "seatmonitor.h"
+#include "snapshotwriter.h"
+#include "tracer.h"
 #include "systemdmanager.h"
+#include "uidallocator.h"
+#include "usernameindex.h"
+#include "usersnapshot.h"
 #include "logging.h"
 
 #include <QDBusConnection>
@@ -19,9 +41,16 @@
 #include <QDir>
 #include <QString>
 #include <QCollator>
+#include <QFuture>
+#include <QFutureWatcher>
+#include <QMutex>
+#include <QtConcurrentRun>
 
 #include <errno.h>
 #include <grp.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 #include <pwd.h>
 #include <qmcecallstate.h>
 #include <sailfishaccesscontrol.h>
@@ -30,7 +59,6 @@
 #include <sys/stat.h>
 #include <sys/statvfs.h>
 #include <sys/types.h>
-#include <systemd/sd-login.h>
 #include <unistd.h>
 
 namespace {
@@ -44,13 +72,17 @@ const auto SKEL_DIR = QStringLiteral("/etc/skel");
 const auto USER_HOME = QStringLiteral("/home/%1");
 const auto GUEST_USER = QStringLiteral("sailfish-guest");
 const int HOME_MODE = 0700;
-const int QUIT_TIMEOUT = 60 * 1000; // One minute quit timeout
 const int SWITCHING_DELAY = 1000; // One second time before changing currentUser
+// Upper bound for a whole switch and for its phases
+const int SWITCH_TIMEOUT = 90 * 1000;
+const int PRE_SWITCH_TIMEOUT = 10 * 1000;
+const int UNIT_JOB_TIMEOUT = 30 * 1000;
 const int MAX_RESERVED_UID = 99999;
 const int MIN_USER_UID = 100000;
 const int OWNER_USER_UID = MIN_USER_UID;
 const int MAX_USER_UID = MIN_USER_UID + 99999;
 const auto DEFAULT_TARGET = QStringLiteral("default.target");
+const auto PRIMARY_SEAT = QStringLiteral("seat0");
 const auto USER_SERVICE = QStringLiteral("user@%1.service");
 const auto AUTOLOGIN_SERVICE = QStringLiteral("autologin@%1.service");
 const auto ENVIRONMENT_FILE = QStringLiteral("/etc/environment");
@@ -61,6 +93,10 @@ const auto USER_REMOVE_SCRIPT_DIR = QStringLiteral("/usr/share/user-managerd/rem
 const auto USER_CREATE_SCRIPT_DIR = QStringLiteral("/usr/share/user-managerd/create.d");
 const auto USER_PRE_SWITCH_SCRIPT_DIR = QStringLiteral("/usr/share/user-managerd/pre-switch.d");
 const quint64 MAXIMUM_QUOTA_LIMIT = 2000000000ULL;
+const auto USERMANAGER_INTERFACE = QStringLiteral(SAILFISH_USERMANAGER_DBUS_INTERFACE);
+const auto PROPERTIES_INTERFACE = QStringLiteral("org.freedesktop.DBus.Properties");
+const auto QUOTA_STATE_FILE = QStringLiteral("/var/lib/user-managerd/quota-blocks");
+const auto IDLE_STATE_FILE = QStringLiteral("/var/lib/user-managerd/idle-state");
 const auto SAILFISH_GROUP_PREFIX = QStringLiteral("sailfish-");
 const auto ACCOUNT_GROUP_PREFIX = QStringLiteral("account-");
 
@@ -72,10 +108,74 @@ static_assert((SAILFISH_USERMANAGER_GUEST_UID >= MIN_USER_UID && SAILFISH_USERMA
 
 QByteArray findHomeDevice()
 {
-    QStorageInfo info(USER_HOME.arg(""));
+    QStorageInfo info(Sandbox::path(USER_HOME.arg("")));
     return info.device();
 }
 
+// Default block limits in quota blocks for file system described by info
+void defaultQuotaLimits(const struct statvfs &info, quint64 *softlimit, quint64 *hardlimit)
+{
+    // Soft limit of max(20 %, MAXIMUM_QUOTA_LIMIT), soft limit turns into hard after grace period
+    fsblkcnt_t soft = info.f_blocks * 20 / 100;
+    if (soft > (fsblkcnt_t)(MAXIMUM_QUOTA_LIMIT / info.f_frsize))
+        soft = (fsblkcnt_t)(MAXIMUM_QUOTA_LIMIT / info.f_frsize);
+    // Hard limit is 120 % of soft limit
+    fsblkcnt_t hard = soft * 120 / 100;
+    *softlimit = fs_to_dq_blocks(soft, info.f_frsize);
+    *hardlimit = fs_to_dq_blocks(hard, info.f_frsize);
+}
+
+// Adds files and bytes under dir to job totals
+void countTree(const QString &dir, Job *job)
+{
+    quint64 bytes = 0;
+    quint64 files = 0;
+    FileTree::measure(dir, &bytes, &files);
+    job->addTotal(bytes, files);
+}
+
+SailfishUserManagerHookEvent hookEvent(SailfishUserManagerHookEvent::Type type, uint uid,
+                                       uint previousUid = 0, const QString &seat = QString())
+{
+    SailfishUserManagerHookEvent event;
+    event.type = type;
+    event.uid = uid;
+    event.previousUid = previousUid;
+    event.seat = seat;
+    event.budget = 0;
+    return event;
+}
+
+// UUID in gecos of uid, empty if the user has none yet
+QString storedUuid(const AccountReader &accounts, uint uid)
+{
+    AccountReader::User user;
+    if (!accounts.findUser(uid, &user))
+        return QString();
+    const QStringList gecos = user.gecos.split(',');
+    return gecos.size() > 1 ? gecos.at(1) : QString();
+}
+
+// Members of the users group, false if the group can not be found
+bool listUsers(const AccountReader &accounts, QList<SailfishUserManagerEntry> *users)
+{
+    if (!accounts.findGroup(USER_GROUP))
+        return false;
+
+    for (const QString &member : accounts.groupMembers(USER_GROUP)) {
+        AccountReader::User pw;
+        if (accounts.findUser(member, &pw)) {
+            SailfishUserManagerEntry user;
+            user.user = member;
+            user.uid = pw.uid;
+            // Trim out other gecos fields
+            user.name = pw.gecos.section(',', 0, 0);
+            users->append(user);
+        }
+    }
+    return true;
+}
+
 };
 
 /* Try to keep documentation inside 80 character limit, please. */
@@ -105,15 +205,32 @@ QByteArray findHomeDevice()
  */
 SailfishUserManager::SailfishUserManager(QObject *parent) :
     QObject(parent),
-    m_lu(new LibUserHelper()),
-    m_switchUser(0),
-    m_currentUid(0),
-    m_systemd(nullptr)
+    m_lanes(new AccountLanes(this)),
+    m_names(new UserNameIndex(m_lanes, Sandbox::path(USER_HOME.arg("")))),
+    m_uids(new UidAllocator(m_lanes, MIN_USER_UID, MAX_USER_UID)),
+    m_maxUsers(Config::load().maxUsers),
+    m_sequentialUserCreation(false),
+    m_coalescer(new RequestCoalescer(this)),
+    m_primarySeat(nullptr),
+    m_lastJobId(0),
+    m_quotaMonitor(nullptr),
+    m_propertiesTimer(nullptr),
+    m_snapshotGeneration(0),
+    m_accountWatcher(nullptr),
+    m_directoryGeneration(0)
 {
+    m_uids->reserve(SAILFISH_USERMANAGER_GUEST_UID);
+
+    m_primarySeat = addSeat(PRIMARY_SEAT);
+    for (const QString &id : SeatMonitor::seats()) {
+        if (!m_seats.contains(id))
+            addSeat(id);
+    }
+
     qDBusRegisterMetaType<SailfishUserManagerEntry>();
     qDBusRegisterMetaType<QList<SailfishUserManagerEntry>>();
 
-    QDBusConnection connection = QDBusConnection::systemBus();
+    QDBusConnection connection = Sandbox::bus();
     if (!connection.registerObject(SAILFISH_USERMANAGER_DBUS_OBJECT_PATH, this)) {
         qCCritical(lcSUM, "Cannot register D-Bus object at %s", SAILFISH_USERMANAGER_DBUS_OBJECT_PATH);
     }
@@ -123,33 +240,310 @@ SailfishUserManager::SailfishUserManager(QObject *parent) :
     }
 
     new UsermanagerAdaptor(this);
+    new DebugInterface(this);
+
+    const Config config = Config::load();
+    m_sequentialUserCreation = config.sequentialUserCreation;
+    m_idle = new IdlePolicy(Sandbox::path(IDLE_STATE_FILE), config.idleTimeout * 1000,
+                            config.maxIdleTimeout * 1000, this);
+    connect(m_idle, &IdlePolicy::expired, this, &SailfishUserManager::exitTimeout);
+    connect(m_idle, &IdlePolicy::trim, this, &SailfishUserManager::trimMemory);
+    // Partition may be resized while the daemon stays resident
+    connect(m_idle, &IdlePolicy::trim, this, &SailfishUserManager::reconcileQuota);
+
+    // Property changes are published once per event loop iteration
+    m_publishedProperties = properties();
+    m_propertiesTimer = new QTimer(this);
+    m_propertiesTimer->setSingleShot(true);
+    m_propertiesTimer->setInterval(0);
+    connect(m_propertiesTimer, &QTimer::timeout, this, [this]() {
+        updateSnapshot();
+        publishProperties();
+    });
+    auto schedulePublish = [this]() {
+        m_propertiesTimer->start();
+    };
+    connect(this, &SailfishUserManager::userAdded, this, schedulePublish);
+    connect(this, &SailfishUserManager::userRemoved, this, schedulePublish);
+    connect(this, &SailfishUserManager::guestUserEnabled, this, schedulePublish);
+    connect(this, &SailfishUserManager::aboutToChangeSeatCurrentUser, this, schedulePublish);
+    connect(this, &SailfishUserManager::seatCurrentUserChanged, this, schedulePublish);
+    connect(this, &SailfishUserManager::seatCurrentUserChangeFailed, this, schedulePublish);
+    connect(this, &SailfishUserManager::JobRemoved, this, schedulePublish);
+
+    if (!Sandbox::enabled()) {
+        m_quotaMonitor = new QuotaMonitor(USER_HOME.arg(""), this);
+        connect(m_quotaMonitor, &QuotaMonitor::warning, this, &SailfishUserManager::onQuotaWarning);
+    }
+    reconcileQuota();
+    updateSnapshot();
+
+    // Signals of the daemon's own changes keep the directory up to date
+    const AccountLanes::Snapshot accounts = m_lanes->snapshot();
+    QList<SailfishUserManagerEntry> entries;
+    listUsers(*accounts, &entries);
+    for (const SailfishUserManagerEntry &user : entries)
+        m_directory.insert(user.uid, user);
+    m_directoryGeneration = accounts->generation();
+    connect(this, &SailfishUserManager::userAdded, this, [this](const SailfishUserManagerEntry &user) {
+        m_directory.insert(user.uid, user);
+    });
+    connect(this, &SailfishUserManager::userRemoved, this, [this](uint uid) {
+        m_directory.remove(uid);
+    });
+    connect(this, &SailfishUserManager::userModified, this, [this](uint uid, const QString &new_name) {
+        auto it = m_directory.find(uid);
+        if (it != m_directory.end())
+            it->name = new_name;
+    });
 
-    m_exitTimer = new QTimer(this);
-    connect(m_exitTimer, &QTimer::timeout, this, &SailfishUserManager::exitTimeout);
-    m_exitTimer->start(QUIT_TIMEOUT);
+    m_accountWatcher = new AccountWatcher(QStringList() << Sandbox::path(QStringLiteral("/etc/passwd"))
+                                                        << Sandbox::path(QStringLiteral("/etc/group")), this);
+    connect(m_accountWatcher, &AccountWatcher::changed, this, &SailfishUserManager::syncDirectory);
 }
 
+/*!
+  \property SailfishUserManager::CurrentUser
+  \brief \e UID of the user that is active on \c seat0.
+
+  Same as \l currentUser.
+ */
+
+/*!
+  \property SailfishUserManager::CurrentUserUuid
+  \brief \e UUID of the user that is active on \c seat0.
+
+  Same as \l currentUserUuid but empty if it can not be read.
+ */
+
+/*!
+  \property SailfishUserManager::GuestUserEnabled
+  \brief Whether \e {guest user} is enabled.
+ */
+
+/*!
+  \property SailfishUserManager::UserCount
+  \brief Number of users, including \e {guest user} when it is enabled.
+ */
+
+/*!
+  \property SailfishUserManager::SwitchInProgress
+  \brief Whether user is being switched on any seat.
+ */
+
+/*!
+  \property SailfishUserManager::DirectoryGeneration
+  \brief Value that changes whenever user or group databases change.
+
+  Clients that cache user or group information can compare this to the value
+  they read the information with. It is derived from the database files, so
+  it stays the same over daemon restarts, but it is not ordered.
+ */
+
 /*!
   \brief Destructs SailfishUserManager, for internal use only.
   \internal
  */
 SailfishUserManager::~SailfishUserManager()
 {
-    delete m_lu;
-    m_lu = nullptr;
+    qDeleteAll(m_seats);
+    m_seats.clear();
+    m_primarySeat = nullptr;
+    delete m_uids;
+    m_uids = nullptr;
+    delete m_names;
+    m_names = nullptr;
+}
+
+uint SailfishUserManager::primarySeatUser()
+{
+    return m_primarySeat->monitor->activeUser();
+}
+
+// Property is not worth a write, users without UUID get one from currentUserUuid
+QString SailfishUserManager::primarySeatUserUuid()
+{
+    uint uid = primarySeatUser();
+    return uid != SAILFISH_UNDEFINED_UID ? storedUuid(*m_lanes->snapshot(), uid) : QString();
+}
+
+bool SailfishUserManager::isGuestUserEnabled()
+{
+    return m_lanes->snapshot()->findUser(SAILFISH_USERMANAGER_GUEST_UID, nullptr);
+}
+
+uint SailfishUserManager::userCount()
+{
+    return m_lanes->snapshot()->memberCount(USER_GROUP);
+}
+
+qulonglong SailfishUserManager::directoryGeneration()
+{
+    // Taking a snapshot reads the databases if they have changed on disk
+    return m_lanes->snapshot()->generation();
+}
+
+QVariantMap SailfishUserManager::properties()
+{
+    QVariantMap rv;
+    rv.insert(QStringLiteral("CurrentUser"), primarySeatUser());
+    rv.insert(QStringLiteral("CurrentUserUuid"), primarySeatUserUuid());
+    rv.insert(QStringLiteral("GuestUserEnabled"), isGuestUserEnabled());
+    rv.insert(QStringLiteral("UserCount"), userCount());
+    rv.insert(QStringLiteral("SwitchInProgress"), switching());
+    rv.insert(QStringLiteral("DirectoryGeneration"), directoryGeneration());
+    return rv;
+}
+
+/*
+ * Rewrites the user snapshot read by the NSS module if account databases
+ * have changed since it was last written. UUIDs are taken from gecos as is,
+ * generating missing ones would modify passwd while writing.
+ */
+void SailfishUserManager::updateSnapshot()
+{
+    const quint64 generation = directoryGeneration();
+    if (generation == m_snapshotGeneration)
+        return;
+
+    MetricsScope scope("snapshot.write");
+    const AccountLanes::Snapshot snapshot = m_lanes->snapshot();
+    const AccountReader *accounts = snapshot.get();
+    QHash<uint, QString> uuids;
+    for (uint uid : accounts->userIds()) {
+        if (uid < MIN_USER_UID || uid > MAX_USER_UID)
+            continue;
+        const QString uuid = storedUuid(*accounts, uid);
+        if (!uuid.isEmpty())
+            uuids.insert(uid, uuid);
+    }
+
+    SnapshotWriter writer(accounts, Sandbox::path(QStringLiteral("/etc/passwd")),
+                          Sandbox::path(QStringLiteral("/etc/group")), MIN_USER_UID, MAX_USER_UID);
+    if (writer.write(Sandbox::path(QStringLiteral(USER_SNAPSHOT_PATH)), uuids)) {
+        m_snapshotGeneration = generation;
+    } else {
+        // Stale snapshot is ignored by readers, next change retries
+        scope.fail();
+    }
+}
+
+/*
+ * Emits user signals for changes made to account databases outside of the
+ * daemon, e.g. with useradd or by restoring a backup. Users that are being
+ * added or removed by a job are left to the job, which emits the signals
+ * when it is done.
+ */
+void SailfishUserManager::syncDirectory()
+{
+    // Own writes emit their signals when done, look again after them
+    if (m_lanes->writing()) {
+        m_accountWatcher->schedule();
+        return;
+    }
+
+    const AccountLanes::Snapshot accounts = m_lanes->snapshot();
+    if (accounts->generation() == m_directoryGeneration)
+        return;
+
+    MetricsScope scope("directory.sync");
+    QList<SailfishUserManagerEntry> entries;
+    if (!listUsers(*accounts, &entries)) {
+        qCWarning(lcSUM) << "Getting user group failed";
+        scope.fail();
+        return;
+    }
+    m_directoryGeneration = accounts->generation();
+
+    QSet<uint> busy;
+    for (const Job *job : m_jobs) {
+        if (job->type() == QStringLiteral("addUser") || job->type() == QStringLiteral("removeUser"))
+            busy.insert(job->uid());
+    }
+
+    QHash<uint, SailfishUserManagerEntry> removed = m_directory;
+    QList<SailfishUserManagerEntry> added;
+    QList<SailfishUserManagerEntry> modified;
+    for (const SailfishUserManagerEntry &user : entries) {
+        auto it = removed.find(user.uid);
+        if (it == removed.end()) {
+            if (!busy.contains(user.uid))
+                added.append(user);
+            continue;
+        }
+        if (it->user != user.user && !busy.contains(user.uid)) {
+            // userModified carries only the real name, renamed user is replaced
+            added.append(user);
+            continue;
+        }
+        if (it->name != user.name)
+            modified.append(user);
+        removed.erase(it);
+    }
+
+    // Signals update the directory, removals first for renamed users
+    for (const SailfishUserManagerEntry &user : removed) {
+        if (busy.contains(user.uid))
+            continue;
+        qCDebug(lcSUM) << "User" << user.uid << "was removed outside of the daemon";
+        emit userRemoved(user.uid);
+    }
+    for (const SailfishUserManagerEntry &user : added) {
+        qCDebug(lcSUM) << "User" << user.uid << "was added outside of the daemon";
+        emit userAdded(user);
+    }
+    for (const SailfishUserManagerEntry &user : modified) {
+        qCDebug(lcSUM) << "User" << user.uid << "was modified outside of the daemon";
+        emit userModified(user.uid, user.name);
+    }
+
+    // Other account changes are published as DirectoryGeneration
+    m_propertiesTimer->start();
+}
+
+void SailfishUserManager::publishProperties()
+{
+    QVariantMap changed;
+    const QVariantMap current = properties();
+    for (auto it = current.constBegin(); it != current.constEnd(); ++it) {
+        if (m_publishedProperties.value(it.key()) != it.value())
+            changed.insert(it.key(), it.value());
+    }
+    if (changed.isEmpty())
+        return;
+
+    m_publishedProperties = current;
+    QDBusMessage changedSignal = QDBusMessage::createSignal(SAILFISH_USERMANAGER_DBUS_OBJECT_PATH,
+                                                            PROPERTIES_INTERFACE,
+                                                            QStringLiteral("PropertiesChanged"));
+    changedSignal << USERMANAGER_INTERFACE << changed << QStringList();
+    Sandbox::bus().send(changedSignal);
 }
 
 void SailfishUserManager::exitTimeout()
 {
-    // Quit if user switching is not in progress
-    if (m_switchUser == 0) {
+    // Quit if user switching or other jobs are not in progress
+    if (!switching() && m_jobs.isEmpty()) {
         qCDebug(lcSUM) << "Exit timeout reached, quitting";
         qApp->quit();
     } else {
-        qCDebug(lcSUM) << "User switching in progress, not quitting yet";
+        qCDebug(lcSUM) << "Jobs in progress, not quitting yet";
     }
 }
 
+/*
+ * Called once per idle period when the daemon stays resident. Caches are
+ * rebuilt on next use and freed heap is returned to the system.
+ */
+void SailfishUserManager::trimMemory()
+{
+    m_names->squeeze();
+    m_uids->squeeze();
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+}
+
 /*!
   \brief List users on device.
 
@@ -159,37 +553,73 @@ void SailfishUserManager::exitTimeout()
  */
 QList<SailfishUserManagerEntry> SailfishUserManager::users()
 {
-    m_exitTimer->start();
+    MetricsScope scope("dbus.users");
+    if (!admit(Admission::Read))
+        return QList<SailfishUserManagerEntry>();
+    m_idle->activity();
+
+    RequestCoalescer::Reply reply;
+    if (coalesce(QStringLiteral("users"), &SailfishUserManager::usersReply, &scope, &reply, m_lanes->readers())
+            || reply.isError())
+        return QList<SailfishUserManagerEntry>();
+
+    return qvariant_cast<QList<SailfishUserManagerEntry>>(reply.arguments.first());
+}
+
+RequestCoalescer::Reply SailfishUserManager::usersReply()
+{
     QList<SailfishUserManagerEntry> rv;
 
-    struct group *grent = getgrnam(USER_GROUP);
-    if (grent) {
-        for (int i = 0; grent->gr_mem[i]; i++) {
-            SailfishUserManagerEntry user;
-            user.user = grent->gr_mem[i];
-            struct passwd *pw = getpwnam(grent->gr_mem[i]);
-            if (pw && pw->pw_gecos) {
-                user.uid = pw->pw_uid;
-                user.name = pw->pw_gecos;
-                // Trim out other gecos fields
-                int i = user.name.indexOf(',');
-                if (i != -1)
-                    user.name.remove(i, user.name.length());
-                rv.append(user);
-            }
-        }
-    } else {
+    if (!listUsers(*m_lanes->snapshot(), &rv)) {
         auto message = QStringLiteral("Getting user group failed");
         qCWarning(lcSUM) << message;
-        sendErrorReply(QDBusError::Failed, message);
+        return RequestCoalescer::Reply::error(QDBusError::errorString(QDBusError::Failed), message);
     }
 
-    return rv;
+    return RequestCoalescer::Reply::value(QVariant::fromValue(rv));
+}
+
+/*
+ * Takes a token from the bucket of the D-Bus caller, sends an error and
+ * returns false if the caller is over its rate limit. Local calls are
+ * always admitted.
+ */
+bool SailfishUserManager::admit(Admission::Kind kind)
+{
+    if (!calledFromDBus() || Admission::instance()->admit(message().service(), kind))
+        return true;
+
+    // Not a warning, a misbehaving client would flood the log
+    qCDebug(lcSUM) << "Rate limited call from" << message().service();
+    sendErrorReply(QStringLiteral(SailfishUserManagerErrorRateLimited),
+                   QStringLiteral("Too many calls, try again later"));
+    return false;
+}
+
+/*
+ * Identical reads from D-Bus are coalesced and replied later, returns true
+ * in that case. Local calls are computed immediately into reply. Reads that
+ * only use account snapshots can be computed in the reader lane.
+ */
+bool SailfishUserManager::coalesce(const QString &key, ReplyFunction compute, MetricsScope *scope,
+                                   RequestCoalescer::Reply *reply, QThreadPool *lane)
+{
+    if (calledFromDBus()) {
+        m_coalescer->enqueue(key, delayReply(scope), [this, compute]() {
+            return (this->*compute)();
+        }, lane);
+        return true;
+    }
+
+    *reply = (this->*compute)();
+    if (reply->isError())
+        sendErrorReply(reply->errorName, reply->errorMessage);
+    return false;
 }
 
-bool SailfishUserManager::addUserToGroups(const QString &user)
+bool SailfishUserManager::addUserToGroups(LibUserHelper *lu, const QString &user)
 {
-    QFile file(GROUP_IDS_FILE);
+    QFile file(Sandbox::path(GROUP_IDS_FILE));
     if (!file.open(QIODevice::ReadOnly)) {
         qCWarning(lcSUM) << "Failed to open groups file";
         return false;
@@ -203,7 +633,7 @@ bool SailfishUserManager::addUserToGroups(const QString &user)
         if (line.startsWith(GROUP_IDS_KEY_PREFIX) && line.contains(GROUP_IDS_VALUE_SEPARATOR)) {
             QByteArray groups = line.mid(line.indexOf(GROUP_IDS_VALUE_SEPARATOR)+1).trimmed();
             for (const QString& group : groups.split(GROUP_IDS_GROUP_SEPARATOR)) {
-                if (!m_lu->addUserToGroup(user, group.trimmed())) {
+                if (!lu->addUserToGroup(user, group.trimmed())) {
                     qCWarning(lcSUM) << "Failed to add" << user << "to group" << group.trimmed();
                     success = false;
                 }
@@ -215,53 +645,64 @@ bool SailfishUserManager::addUserToGroups(const QString &user)
     return success;
 }
 
-bool SailfishUserManager::copyDir(const QString &source, const QString &destination, uint uid, uint guid)
+bool SailfishUserManager::copyDir(const QString &source, const QString &destination, uint uid, uint guid, Job *job)
 {
+    TraceScope trace(QStringLiteral("fs.copyDir"), destination);
+    if (job && job->cancelRequested())
+        return false;
+
     QDir sourceDir(source);
     if (!sourceDir.exists(destination) && !sourceDir.mkdir(destination)) {
         qCWarning(lcSUM) << "Directory create failed";
         return false;
     }
-    if (chown(destination.toUtf8(), uid, guid)) {
+    // Sandbox runs without root and owns everything itself
+    if (!Sandbox::enabled() && chown(destination.toUtf8(), uid, guid)) {
+        FlightRecorder::record("fs.chown", FlightRecorder::Failed, uid, errno);
         qCWarning(lcSUM) << "Directory ownership change failed";
         return false;
     }
 
     for (const QString &dir : sourceDir.entryList(QDir::Dirs | QDir::NoDotAndDotDot | QDir::Hidden)) {
-        if (!copyDir(sourceDir.path() + '/' + dir, destination + '/' + dir, uid, guid))
+        if (!copyDir(sourceDir.path() + '/' + dir, destination + '/' + dir, uid, guid, job))
             return false;
     }
 
     for (const QString &file : sourceDir.entryList(QDir::Files | QDir::NoDotAndDotDot | QDir::Hidden)) {
+        if (job && job->cancelRequested())
+            return false;
+
+        QString sourceFile = QString("%1/%2").arg(sourceDir.path()).arg(file);
         QString destFile = QString("%1/%2").arg(destination).arg(file);
-        if (!QFile::copy(QString("%1/%2").arg(sourceDir.path()).arg(file), destFile)) {
+        if (!QFile::copy(sourceFile, destFile)) {
             qCWarning(lcSUM) << "Failed to copy file";
             return false;
         }
-        if (chown(destFile.toUtf8(), uid, guid)) {
+        if (!Sandbox::enabled() && chown(destFile.toUtf8(), uid, guid)) {
+            FlightRecorder::record("fs.chown", FlightRecorder::Failed, uid, errno);
             qCWarning(lcSUM) << "Failed to change file ownership";
             return false;
         }
+        if (job)
+            job->addProcessed(QFileInfo(sourceFile).size(), 1);
     }
 
     return true;
 }
 
-bool SailfishUserManager::makeHome(const QString &user)
+bool SailfishUserManager::makeHome(const QString &home, uint uid, uint gid, Job *job)
 {
-    struct passwd *pw = getpwnam(user.toUtf8());
-    if (!pw) {
-        qCWarning(lcSUM) << "User not found";
+    MetricsScope scope("fs.copySkel");
+    if (job)
+        countTree(Sandbox::path(SKEL_DIR), job);
+    if (!copyDir(Sandbox::path(SKEL_DIR), home, uid, gid, job)) {
+        scope.fail();
         return false;
     }
 
-    QString destination = pw->pw_dir;
-
-    if (!copyDir(SKEL_DIR, destination, pw->pw_uid, pw->pw_gid))
-        return false;
-
-    if (chmod(destination.toUtf8(), HOME_MODE)) {
+    if (chmod(home.toUtf8(), HOME_MODE)) {
         qCWarning(lcSUM) << "Home directory permissions change failed";
+        scope.fail();
         return false;
     }
 
@@ -282,16 +723,23 @@ bool SailfishUserManager::makeHome(const QString &user)
   This may return errors
   \l {D-Bus errors} {SailfishUserManagerErrorMaxUsersReached},
   \l {D-Bus errors} {SailfishUserManagerErrorUserAddFailed},
-  \l {D-Bus errors} {SailfishUserManagerErrorUserModifyFailed} and
-  \l {D-Bus errors} {SailfishUserManagerErrorHomeCreateFailed}.
+  \l {D-Bus errors} {SailfishUserManagerErrorUserModifyFailed},
+  \l {D-Bus errors} {SailfishUserManagerErrorHomeCreateFailed} and
+  \l {D-Bus errors} {SailfishUserManagerErrorCancelled}.
+
+  User is added in a job, see \l JobNew. The reply is sent when the job is
+  done.
  */
 uint SailfishUserManager::addUser(const QString &name)
 {
+    MetricsScope scope("dbus.addUser");
+    if (!admit(Admission::Write))
+        return 0;
     // When adding user there is no uid to modify, use special value instead
     if (!checkAccessRights(SAILFISH_UNDEFINED_UID))
         return 0;
 
-    m_exitTimer->start();
+    m_idle->activity();
 
     if (name.isEmpty()) {
         auto message = QStringLiteral("Empty name");
@@ -300,17 +748,20 @@ uint SailfishUserManager::addUser(const QString &name)
         return 0;
     }
 
-    int count = 0;
-    struct group *grent = getgrnam(USER_GROUP);
-    if (grent) {
-        for (int i = 0; grent->gr_mem[i]; i++) {
-            // Guest user is not counted to number of users that can be created
-            struct passwd *pw = getpwnam(grent->gr_mem[i]);
-            if (pw && (pw->pw_uid != SAILFISH_USERMANAGER_GUEST_UID))
-                count++;
-        }
+    const AccountLanes::Snapshot accounts = m_lanes->snapshot();
+    int count = accounts->memberCount(USER_GROUP);
+    // Guest user is not counted to number of users that can be created
+    AccountReader::User guest;
+    if (accounts->findUser(SAILFISH_USERMANAGER_GUEST_UID, &guest)
+            && accounts->groupsOfUser(guest.name).contains(USER_GROUP))
+        count--;
+    // Users that are still being added are not in the databases yet
+    for (const Job *job : m_jobs) {
+        AccountReader::User added;
+        if (job->type() == QStringLiteral("addUser") && !accounts->findUser(job->uid(), &added))
+            count++;
     }
-    if (count > (SAILFISH_USERMANAGER_MAX_USERS - 1)) {
+    if (count > (m_maxUsers - 1)) {
         // Master user reserves one slot above
         auto message = QStringLiteral("Maximum number of users reached");
         qCWarning(lcSUM) << message;
@@ -329,19 +780,37 @@ uint SailfishUserManager::addUser(const QString &name)
     if (cleanName.isEmpty())
         cleanName = "user";
 
-    i = 0;
-    QString user(cleanName);
-    // Append number until it's unused
-    while (getpwnam(user.toUtf8()) || getgrnam(user.toUtf8())
-            || QFile::exists(QString(USER_HOME).arg(user))) {
-        user = cleanName + QString::number(i++);
+    // Append number if it's used
+    QString user = m_names->uniqueName(cleanName);
+
+    uint userId = m_uids->allocate();
+    if (!userId) {
+        auto message = QStringLiteral("No free user ids");
+        qCWarning(lcSUM) << message;
+        sendErrorReply(QStringLiteral(SailfishUserManagerErrorUserAddFailed), message);
+        return 0;
     }
 
-    return addSailfishUser(user, name);
+    // Reply is sent when the job is done
+    Job *job = createJob(QStringLiteral("addUser"), userId);
+    const DelayedReply reply = delayReply(&scope);
+    addSailfishUser(user, name, userId, QString(), job,
+                    [this, reply, user, userId](uint uid, const QString &errorName, const QString &errorMessage) {
+        m_names->release(user);
+        if (!uid) {
+            m_uids->release(userId);
+            reply.sendError(errorName, errorMessage);
+        } else {
+            m_uids->commit(userId);
+            reply.send(QVariantList() << uid);
+        }
+    });
+    return 0;
 }
 
-void SailfishUserManager::executeScripts(uint uid, const QString &directory)
+void SailfishUserManager::executeScripts(uint uid, const QString &systemDirectory, Job *job)
 {
+    const QString directory = Sandbox::path(systemDirectory);
     QDir scripts(directory, "*.sh", QDir::NoSort, QDir::Files | QDir::Executable);
 
     auto entryList = scripts.entryList();
@@ -351,64 +820,192 @@ void SailfishUserManager::executeScripts(uint uid, const QString &directory)
 
     std::sort(entryList.begin(), entryList.end(), collator);
 
+    if (job)
+        job->addTotal(0, entryList.count());
+
     for (const QString &entry : entryList) {
+        MetricsScope scope(QStringLiteral("hook.%1/%2").arg(scripts.dirName()).arg(entry));
         int exitCode = QProcess::execute(directory + '/' + entry, QStringList() << QString::number(uid));
-        if (exitCode)
+        if (exitCode) {
             qCWarning(lcSUM) << "User scripts" << directory + '/' + entry << "returned:" << exitCode;
+            scope.fail(QStringLiteral("ExitCode%1").arg(exitCode));
+        }
+        if (job)
+            job->addProcessed(0, 1);
     }
 }
 
-uint SailfishUserManager::addSailfishUser(const QString &user, const QString &name, uint userId, const QString &home)
+/*
+ * Runs hook plugins and then hook scripts of the event. Scripts get the user
+ * that was created or removed, or the user that is switched from.
+ */
+void SailfishUserManager::runHooks(const SailfishUserManagerHookEvent &event, Job *job)
 {
-    uint uid = m_lu->addUser(user, name, userId, home);
-    if (!uid) {
-        auto message = QStringLiteral("Adding user failed");
-        qCWarning(lcSUM) << message;
-        sendErrorReply(QStringLiteral(SailfishUserManagerErrorUserAddFailed), message);
-        return 0;
+    HookRunner::instance()->run(event, job);
+
+    switch (event.type) {
+    case SailfishUserManagerHookEvent::UserCreated:
+        executeScripts(event.uid, USER_CREATE_SCRIPT_DIR, job);
+        break;
+    case SailfishUserManagerHookEvent::UserRemoved:
+        executeScripts(event.uid, USER_REMOVE_SCRIPT_DIR, job);
+        break;
+    case SailfishUserManagerHookEvent::PreSwitch:
+        executeScripts(event.previousUid, USER_PRE_SWITCH_SCRIPT_DIR, job);
+        break;
     }
+}
 
-    if (!addUserToGroups(user)) {
-        m_lu->removeUser(uid);
-        auto message = QStringLiteral("Adding user to groups failed");
-        qCWarning(lcSUM) << message;
-        sendErrorReply(QStringLiteral(SailfishUserManagerErrorUserModifyFailed), message);
-        return 0;
-    }
+/*
+ * Creates user and calls done with the new uid or with an error when it is
+ * complete. Account databases are written in the writer lane, home
+ * directory, quota and creation scripts are run in worker threads so that
+ * the job can be followed and cancelled meanwhile.
+ */
+void SailfishUserManager::addSailfishUser(const QString &user, const QString &name, uint userId,
+                                          const QString &home, Job *job, const JobCallback &done)
+{
+    job->start();
+
+    bool createHome = userId != SAILFISH_USERMANAGER_GUEST_UID;
+    // Result has zero uid if adding failed and empty name if the user was
+    // not found afterwards, the user is removed again in that case
+    m_lanes->write<AccountReader::User>(job->owner(),
+                                        [user, name, userId, home, createHome](LibUserHelper *lu) {
+        AccountReader::User pw = { lu->addUser(user, name, userId, home), 0, user, QString(), QString(), QString() };
+        // Resolve home and primary group before running stages in parallel
+        if (pw.uid && createHome) {
+            const uint uid = pw.uid;
+            lu->accounts()->refresh();
+            if (!lu->accounts()->findUser(user, &pw)) {
+                lu->removeUser(uid);
+                pw.uid = uid;
+                pw.name.clear();
+            }
+        }
+        return pw;
+    }, this, [this, user, name, createHome, job, done](const AccountReader::User &pw) {
+        if (!pw.uid || pw.name.isEmpty()) {
+            auto message = pw.uid ? QStringLiteral("Creating user home failed, user not found")
+                                  : QStringLiteral("Adding user failed");
+            qCWarning(lcSUM) << message;
+            job->finish(Job::Failed);
+            done(0, pw.uid ? QStringLiteral(SailfishUserManagerErrorHomeCreateFailed)
+                           : QStringLiteral(SailfishUserManagerErrorUserAddFailed), message);
+            return;
+        }
+
+        // Once uid and gid are known home directory and quota do not depend
+        // on group memberships, they are set up in a worker while groups are
+        // added in the writer lane
+        const uint uid = pw.uid;
+        const QString homeDir = pw.home;
+        const uint gid = pw.gid;
+        const std::function<bool()> homeStage = [this, createHome, homeDir, uid, gid, job]() {
+            bool homeCreated = !createHome || makeHome(homeDir, uid, gid, job);
+            setUserLimits(uid);
+            return homeCreated;
+        };
+        const std::function<bool(LibUserHelper *)> groupsStage = [user](LibUserHelper *lu) {
+            return addUserToGroups(lu, user);
+        };
+        const auto finish = [=](bool groupsAdded, const QFuture<bool> &homeFuture) {
+            // Watcher reports a stage that already finished as well
+            QFutureWatcher<bool> *homeWatcher = new QFutureWatcher<bool>(this);
+            connect(homeWatcher, &QFutureWatcherBase::finished, this, [=]() {
+                bool homeCreated = homeWatcher->result();
+                homeWatcher->deleteLater();
+                addSailfishUserFinished(user, name, uid, createHome ? homeDir : QString(),
+                                        groupsAdded, homeCreated, job, done);
+            });
+            homeWatcher->setFuture(homeFuture);
+        };
 
-    if (userId != SAILFISH_USERMANAGER_GUEST_UID && !makeHome(user)) {
-        m_lu->removeUser(uid);
-        auto message = QStringLiteral("Creating user home failed");
+        if (m_sequentialUserCreation) {
+            // Groups, then home directory and quota, as before stages overlapped
+            m_lanes->write<bool>(job->owner(), groupsStage, this, [=](bool groupsAdded) {
+                finish(groupsAdded, QtConcurrent::run(homeStage));
+            });
+            return;
+        }
+
+        const QFuture<bool> homeFuture = QtConcurrent::run(homeStage);
+        m_lanes->write<bool>(job->owner(), groupsStage, this, [=](bool groupsAdded) {
+            finish(groupsAdded, homeFuture);
+        });
+    });
+}
+
+/*
+ * Last stage of addSailfishUser, undoes the user if an earlier stage failed
+ * or the job was cancelled and runs creation scripts otherwise.
+ */
+void SailfishUserManager::addSailfishUserFinished(const QString &user, const QString &name, uint uid,
+                                                  const QString &homeDir, bool groupsAdded, bool homeCreated,
+                                                  Job *job, const JobCallback &done)
+{
+    // Past this point user creation is not undone
+    bool cancelled = !job->disableCancel();
+    if (cancelled || !groupsAdded || !homeCreated) {
+        // Partial copy would be inherited by the next user of this name,
+        // names are never taken from existing home directories
+        if (!homeDir.isEmpty())
+            removeDir(homeDir);
+
+        QString errorName;
+        QString message;
+        if (cancelled) {
+            errorName = QStringLiteral(SailfishUserManagerErrorCancelled);
+            message = QStringLiteral("Adding user cancelled");
+        } else if (!groupsAdded) {
+            errorName = QStringLiteral(SailfishUserManagerErrorUserModifyFailed);
+            message = QStringLiteral("Adding user to groups failed");
+        } else {
+            errorName = QStringLiteral(SailfishUserManagerErrorHomeCreateFailed);
+            message = QStringLiteral("Creating user home failed");
+        }
         qCWarning(lcSUM) << message;
-        sendErrorReply(QStringLiteral(SailfishUserManagerErrorHomeCreateFailed), message);
-        return 0;
+        m_lanes->write<bool>(job->owner(), [uid](LibUserHelper *lu) {
+            return lu->removeUser(uid);
+        }, this, [job, done, errorName, message, cancelled](bool) {
+            job->finish(cancelled ? Job::Cancelled : Job::Failed);
+            done(0, errorName, message);
+        });
+        return;
     }
 
-    // Execute user creation scripts
-    executeScripts(uid, USER_CREATE_SCRIPT_DIR);
+    // Execute user creation scripts, these may rely on all of the above
+    QFutureWatcher<void> *scriptsWatcher = new QFutureWatcher<void>(this);
+    connect(scriptsWatcher, &QFutureWatcherBase::finished, this, [=]() {
+        scriptsWatcher->deleteLater();
 
-    setUserLimits(uid);
+        SailfishUserManagerEntry entry;
+        entry.user = user;
+        entry.name = name;
+        entry.uid = uid;
+        emit userAdded(entry);
 
-    SailfishUserManagerEntry entry;
-    entry.user = user;
-    entry.name = name;
-    entry.uid = uid;
-    emit userAdded(entry);
+        // Catches up if /home was resized since the daemon started
+        reconcileQuota();
 
-    return uid;
+        job->finish(Job::Finished);
+        done(uid, QString(), QString());
+    });
+    scriptsWatcher->setFuture(QtConcurrent::run(&SailfishUserManager::runHooks,
+                                                hookEvent(SailfishUserManagerHookEvent::UserCreated, uid),
+                                                job));
 }
 
-int SailfishUserManager::removeUserFiles(uint uid)
+int SailfishUserManager::removeUserFiles(uint uid, Job *job)
 {
     int rv = EXIT_FAILURE;
-    QDir dir(USER_ENVIRONMENT_DIR.arg(uid));
-    if (dir.removeRecursively())
+    if (FileTree::remove(Sandbox::path(USER_ENVIRONMENT_DIR.arg(uid))))
         rv = EXIT_SUCCESS;
     else
         qCWarning(lcSUM) << "Removing user environment directory failed";
 
-    // Execute user removal scripts
-    executeScripts(uid, USER_REMOVE_SCRIPT_DIR);
+    // Execute user removal hooks
+    runHooks(hookEvent(SailfishUserManagerHookEvent::UserRemoved, uid), job);
 
     return rv;
 }
@@ -419,24 +1016,25 @@ int SailfishUserManager::removeUserFiles(uint uid)
  */
 void SailfishUserManager::setUserLimits(uint uid)
 {
+    // Quota can not be set without root
+    if (Sandbox::enabled())
+        return;
+
     struct statvfs info;
     memset(&info, 0, sizeof(info));
     errno = 0;
     if (statvfs(USER_HOME.arg("").toUtf8().data(), &info) < 0) {
         qCWarning(lcSUM) << "Could not set limits, could not stat filesystem:" << strerror(errno);
     } else {
-        // Soft limit of max(20 %, MAXIMUM_QUOTA_LIMIT), soft limit turns into hard after grace period
-        fsblkcnt_t softlimit = info.f_blocks * 20 / 100;
-        if (softlimit > (fsblkcnt_t)(MAXIMUM_QUOTA_LIMIT / info.f_frsize))
-            softlimit = (fsblkcnt_t)(MAXIMUM_QUOTA_LIMIT / info.f_frsize);
-        // Hard limit is 120 % of soft limit
-        fsblkcnt_t hardlimit = softlimit * 120 / 100;
+        quint64 softlimit;
+        quint64 hardlimit;
+        defaultQuotaLimits(info, &softlimit, &hardlimit);
         qCDebug(lcSUM) << "Setting quota limits for" << uid << "to"
-                       << hardlimit << "and" << softlimit << "blocks of size" << info.f_frsize;
+                       << hardlimit << "and" << softlimit << "quota blocks";
         // Sets block limits and clears inode limits
         struct if_dqblk quota = {
-            .dqb_bhardlimit = fs_to_dq_blocks(hardlimit, info.f_frsize),
-            .dqb_bsoftlimit = fs_to_dq_blocks(softlimit, info.f_frsize),
+            .dqb_bhardlimit = hardlimit,
+            .dqb_bsoftlimit = softlimit,
             .dqb_curspace = 0,
             .dqb_ihardlimit = 0,
             .dqb_isoftlimit = 0,
@@ -447,6 +1045,7 @@ void SailfishUserManager::setUserLimits(uint uid)
         };
         errno = 0;
         if (quotactl(QCMD(Q_SETQUOTA, USRQUOTA), findHomeDevice().data(), (uid_t)uid, (caddr_t)&quota) < 0) {
+            FlightRecorder::record("quota", FlightRecorder::Failed, uid, errno);
             if (errno == ENOSYS) {
                 qCWarning(lcSUM) << "Could not set limits, kernel doesn't support it";
             } else if (errno == ESRCH) {
@@ -459,6 +1058,111 @@ void SailfishUserManager::setUserLimits(uint uid)
     }
 }
 
+/*
+ * Brings default quota limits of users up to date with the size of /home
+ * partition. Size that limits were last computed for is stored in
+ * QUOTA_STATE_FILE and nothing is done if it has not changed. Only users that
+ * have the defaults of the previous size are updated, limits adjusted with
+ * setquota are kept.
+ */
+void SailfishUserManager::reconcileQuotaLimits(const QVector<uint> &uids)
+{
+    // Serialises reconciliations of startup, idle periods and user creation
+    static QMutex mutex;
+    QMutexLocker locker(&mutex);
+    MetricsScope scope("quota.reconcile");
+
+    struct statvfs info;
+    memset(&info, 0, sizeof(info));
+    if (statvfs(USER_HOME.arg("").toUtf8().data(), &info) < 0) {
+        qCWarning(lcSUM) << "Could not reconcile limits, could not stat filesystem:" << strerror(errno);
+        scope.fail();
+        return;
+    }
+
+    QFile state(QUOTA_STATE_FILE);
+    struct statvfs previous;
+    memset(&previous, 0, sizeof(previous));
+    if (state.open(QIODevice::ReadOnly)) {
+        QList<QByteArray> values = state.readAll().trimmed().split(' ');
+        if (values.count() == 2) {
+            previous.f_blocks = values.at(0).toULongLong();
+            previous.f_frsize = values.at(1).toULong();
+        }
+        state.close();
+    }
+    if (previous.f_blocks == info.f_blocks && previous.f_frsize == info.f_frsize)
+        return;
+
+    quint64 softlimit;
+    quint64 hardlimit;
+    defaultQuotaLimits(info, &softlimit, &hardlimit);
+    quint64 previousSoftlimit = 0;
+    quint64 previousHardlimit = 0;
+    if (previous.f_blocks > 0 && previous.f_frsize > 0)
+        defaultQuotaLimits(previous, &previousSoftlimit, &previousHardlimit);
+
+    // Limits of all users are checked with one statvfs and device lookup
+    QByteArray device = findHomeDevice();
+    int updated = 0;
+    for (uint uid : uids) {
+        if (previousSoftlimit == 0)
+            break; // Size is not known yet, only record it
+
+        struct if_dqblk quota;
+        memset(&quota, 0, sizeof(quota));
+        if (quotactl(QCMD(Q_GETQUOTA, USRQUOTA), device.data(), (uid_t)uid, (caddr_t)&quota) < 0) {
+            if (errno == ENOSYS || errno == ESRCH)
+                return; // Not supported or not enabled, size is not recorded either
+            qCWarning(lcSUM) << "Could not get limits of" << uid << strerror(errno);
+            continue;
+        }
+
+        if (quota.dqb_bsoftlimit != previousSoftlimit || quota.dqb_bhardlimit != previousHardlimit)
+            continue;
+
+        quota.dqb_bsoftlimit = softlimit;
+        quota.dqb_bhardlimit = hardlimit;
+        quota.dqb_valid = QIF_BLIMITS;
+        if (quotactl(QCMD(Q_SETQUOTA, USRQUOTA), device.data(), (uid_t)uid, (caddr_t)&quota) < 0) {
+            FlightRecorder::record("quota", FlightRecorder::Failed, uid, errno);
+            qCWarning(lcSUM) << "Could not update limits of" << uid << strerror(errno);
+            scope.fail();
+        } else {
+            updated++;
+        }
+    }
+
+    qCDebug(lcSUM) << "Filesystem size changed from" << previous.f_blocks << "to" << info.f_blocks
+                   << "blocks, updated limits of" << updated << "users";
+    QDir().mkpath(QFileInfo(QUOTA_STATE_FILE).path());
+    if (!state.open(QIODevice::WriteOnly | QIODevice::Truncate)
+            || state.write(QByteArray::number((qulonglong)info.f_blocks) + ' '
+                           + QByteArray::number((qulonglong)info.f_frsize) + '\n') < 0)
+        qCWarning(lcSUM) << "Could not store filesystem size for quota:" << state.errorString();
+}
+
+// Reconciles quota limits of all users in a worker thread
+void SailfishUserManager::reconcileQuota()
+{
+    // Quota can not be set without root
+    if (Sandbox::enabled())
+        return;
+
+    QVector<uint> uids;
+    for (uint uid : m_lanes->snapshot()->userIds()) {
+        if (uid >= MIN_USER_UID && uid <= MAX_USER_UID)
+            uids.append(uid);
+    }
+    QtConcurrent::run(&SailfishUserManager::reconcileQuotaLimits, uids);
+}
+
+void SailfishUserManager::onQuotaWarning(uint uid, const QString &resource, const QString &limit)
+{
+    if (uid >= MIN_USER_UID && uid <= MAX_USER_UID)
+        emit quotaWarning(uid, resource, limit);
+}
+
 /*!
   \brief Removes extra files for user, for internal use only.
   \internal
@@ -481,11 +1185,18 @@ int SailfishUserManager::removeUserFiles(const char *user)
 
   \warning Removing a user destroys all data for that user.
 
-  This may return error
-  \l {D-Bus errors} {SailfishUserManagerErrorUserRemoveFailed}.
+  This may return errors
+  \l {D-Bus errors} {SailfishUserManagerErrorUserRemoveFailed} and
+  \l {D-Bus errors} {SailfishUserManagerErrorBusy}.
+
+  User is removed in a job that can not be cancelled, see \l JobNew. The
+  reply is sent when the job is done.
  */
 void SailfishUserManager::removeUser(uint uid)
 {
+    MetricsScope scope("dbus.removeUser");
+    if (!admit(Admission::Write))
+        return;
     if (!checkAccessRights(uid))
         return;
 
@@ -496,67 +1207,167 @@ void SailfishUserManager::removeUser(uint uid)
         return;
     }
 
-    if (uid == currentUser()) {
+    if (userOnSeat(uid)) {
         auto message = QStringLiteral("Can not remove current user");
         qCWarning(lcSUM) << message;
         sendErrorReply(QDBusError::InvalidArgs, message);
         return;
     }
 
-    m_exitTimer->start();
+    if (userBusy(uid))
+        return;
 
-    if (uid != SAILFISH_USERMANAGER_GUEST_UID && !removeHome(uid)) {
-        qCWarning(lcSUM) << "Removing user home failed";
+    m_idle->activity();
+
+    // Reply is sent when the job is done
+    Job *job = createJob(QStringLiteral("removeUser"), uid);
+    const DelayedReply reply = delayReply(&scope);
+    removeSailfishUser(uid, job, [reply](uint uid, const QString &errorName, const QString &errorMessage) {
+        if (uid)
+            reply.send();
+        else
+            reply.sendError(errorName, errorMessage);
+    });
+}
+
+/*
+ * Removes user and calls done with uid or with an error when it is complete.
+ * Home directory and removal scripts are run in a worker thread and the
+ * account in the writer lane. Removal can not be cancelled.
+ */
+void SailfishUserManager::removeSailfishUser(uint uid, Job *job, const JobCallback &done)
+{
+    job->start();
+    job->disableCancel();
+
+    QString home;
+    AccountReader::User pw;
+    if (uid != SAILFISH_USERMANAGER_GUEST_UID) {
+        if (m_lanes->snapshot()->findUser(uid, &pw))
+            home = pw.home;
+        else
+            qCWarning(lcSUM) << "Could not find user";
     }
+    QFutureWatcher<void> *watcher = new QFutureWatcher<void>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [=]() {
+        watcher->deleteLater();
+
+        m_lanes->write<bool>(job->owner(), [uid](LibUserHelper *lu) {
+            return lu->removeUser(uid);
+        }, this, [this, uid, job, done](bool removed) {
+            if (!removed) {
+                auto message = QStringLiteral("User remove failed");
+                qCWarning(lcSUM) << message;
+                job->finish(Job::Failed);
+                done(0, QStringLiteral(SailfishUserManagerErrorUserRemoveFailed), message);
+                return;
+            }
 
-    removeUserFiles(uid);
+            emit userRemoved(uid);
+            job->finish(Job::Finished);
+            done(uid, QString(), QString());
+        });
+    });
+    watcher->setFuture(QtConcurrent::run([this, uid, home, job]() {
+        if (uid != SAILFISH_USERMANAGER_GUEST_UID && !removeHome(home, job))
+            qCWarning(lcSUM) << "Removing user home failed";
+        removeUserFiles(uid, job);
+    }));
+}
 
-    if (!m_lu->removeUser(uid)) {
-        auto message = QStringLiteral("User remove failed");
-        qCWarning(lcSUM) << message;
-        sendErrorReply(QStringLiteral(SailfishUserManagerErrorUserRemoveFailed), message);
-    } else {
-        emit userRemoved(uid);
+// Sends busy error if there is a job for uid
+bool SailfishUserManager::userBusy(uint uid)
+{
+    for (const Job *job : m_jobs) {
+        if (job->uid() == uid) {
+            auto message = QStringLiteral("Operation on user already in progress");
+            qCWarning(lcSUM) << message;
+            sendErrorReply(QStringLiteral(SailfishUserManagerErrorBusy), message);
+            return true;
+        }
     }
+    return false;
 }
 
 /*!
   \brief Changes real name to \a new_name for user with given \a uid.
+
+  The reply is sent when the change is written.
  */
 void SailfishUserManager::modifyUser(uint uid, const QString &new_name)
 {
+    MetricsScope scope("dbus.modifyUser");
+    if (!admit(Admission::Write))
+        return;
     if (!checkAccessRights(uid))
         return;
 
-    m_exitTimer->start();
+    m_idle->activity();
 
-    if (!m_lu->modifyUser(uid, new_name)) {
-        auto message = QStringLiteral("User modify failed");
-        qCWarning(lcSUM) << message;
-        sendErrorReply(QStringLiteral(SailfishUserManagerErrorUserModifyFailed), message);
-        return;
-    }
+    const DelayedReply reply = delayReply(&scope);
+    m_lanes->write<bool>(message().service(), [uid, new_name](LibUserHelper *lu) {
+        return lu->modifyUser(uid, new_name);
+    }, this, [this, reply, uid, new_name](bool modified) {
+        if (!modified) {
+            auto message = QStringLiteral("User modify failed");
+            qCWarning(lcSUM) << message;
+            reply.sendError(QStringLiteral(SailfishUserManagerErrorUserModifyFailed), message);
+            return;
+        }
 
-    emit userModified(uid, new_name);
+        emit userModified(uid, new_name);
+        reply.send();
+    });
 }
 
-bool SailfishUserManager::removeDir(const QString &dir)
+bool SailfishUserManager::removeDir(const QString &dir, Job *job)
 {
-    QDir directory(dir);
-    if (!directory.removeRecursively()) {
+    TraceScope trace(QStringLiteral("fs.removeDir"), dir);
+    FileTree::Progress progress;
+    if (job) {
+        countTree(dir, job);
+        progress = [job](quint64 bytes, quint64 files) {
+            job->addProcessed(bytes, files);
+        };
+    }
+    if (!FileTree::remove(dir, progress)) {
         qCWarning(lcSUM) << "Removing directory failed";
         return false;
     }
     return true;
 }
 
-bool SailfishUserManager::removeHome(uint uid)
+bool SailfishUserManager::removeHome(const QString &home, Job *job)
 {
-    QString home = m_lu->homeDir(uid);
-    if (home.isEmpty())
+    MetricsScope scope("fs.removeHome");
+    if (home.isEmpty() || !removeDir(home, job)) {
+        scope.fail();
         return false;
+    }
+
+    return true;
+}
+
+/*
+ * Replies to the D-Bus call in progress later. Latency and error of the call
+ * are recorded for scope when the reply is sent.
+ */
+DelayedReply SailfishUserManager::delayReply(MetricsScope *scope)
+{
+    setDelayedReply(true);
+    return DelayedReply(scope, connection(), message());
+}
 
-    return removeDir(home);
+void SailfishUserManager::sendErrorReply(const QString &name, const QString &msg) const
+{
+    MetricsScope::setError(name);
+    QDBusContext::sendErrorReply(name, msg);
+}
+
+void SailfishUserManager::sendErrorReply(QDBusError::ErrorType type, const QString &msg) const
+{
+    MetricsScope::setError(QDBusError::errorString(type));
+    QDBusContext::sendErrorReply(type, msg);
 }
 
 /*!
@@ -583,6 +1394,11 @@ uid_t SailfishUserManager::checkCallerUid()
         return uid;
     }
 
+    if (Sandbox::enabled() && uid == getuid()) {
+        // Sandbox owner is root of the sandbox
+        return 0;
+    }
+
     if (info.group() != QStringLiteral("privileged") && !sailfish_access_control_hasgroup(uid, "privileged")) {
         // Non-privileged applications are not allowed
         auto message = QStringLiteral("PID %1 is not in privileged group").arg(pid);
@@ -616,31 +1432,104 @@ bool SailfishUserManager::checkAccessRights(uint uid_to_modify) {
     if (uid == SAILFISH_UNDEFINED_UID)
         return false;
 
-    if (uid && !sailfish_access_control_hasgroup(uid, "sailfish-system") && uid != uid_to_modify) {
-        // Users in sailfish-system can change any user, other users can only modify themselves
-        auto message = QStringLiteral("UID %1 is not allowed to modify UID %2").arg(uid).arg(uid_to_modify);
-        qCWarning(lcSUM) << "Access denied:" << message;
-        sendErrorReply(QDBusError::AccessDenied, message);
-        return false;
+    if (uid && !sailfish_access_control_hasgroup(uid, "sailfish-system") && uid != uid_to_modify) {
+        // Users in sailfish-system can change any user, other users can only modify themselves
+        auto message = QStringLiteral("UID %1 is not allowed to modify UID %2").arg(uid).arg(uid_to_modify);
+        qCWarning(lcSUM) << "Access denied:" << message;
+        sendErrorReply(QDBusError::AccessDenied, message);
+        return false;
+    }
+
+    return true;
+}
+
+SailfishUserManager::Seat *SailfishUserManager::addSeat(const QString &id)
+{
+    Seat *seat = new Seat;
+    seat->id = id;
+    seat->monitor = new SeatMonitor(id, this);
+    seat->systemd = nullptr;
+    seat->switchUser = 0;
+    seat->currentUid = 0;
+    seat->reportedUid = seat->monitor->activeUser();
+    seat->job = nullptr;
+    seat->switchState = SwitchIdle;
+    seat->switchSerial = 0;
+    seat->switchDeadline = new QTimer(this);
+    seat->switchDeadline->setSingleShot(true);
+    seat->switchDeadline->setInterval(SWITCH_TIMEOUT);
+    connect(seat->switchDeadline, &QTimer::timeout, this, [this, seat]() {
+        onSwitchDeadline(seat);
+    });
+    connect(seat->monitor, &SeatMonitor::activeUserChanged, this, [this, seat](uint uid) {
+        onActiveUserChanged(seat, uid);
+    });
+    m_seats.insert(id, seat);
+    return seat;
+}
+
+/*
+ * Returns state for seat, seats that appeared after startup are added here.
+ * Sends error reply and returns nullptr if there is no such seat.
+ */
+SailfishUserManager::Seat *SailfishUserManager::findSeat(const QString &id)
+{
+    Seat *seat = m_seats.value(id);
+    if (!seat && SeatMonitor::seats().contains(id))
+        seat = addSeat(id);
+
+    if (!seat) {
+        auto message = QStringLiteral("Seat not found");
+        qCWarning(lcSUM) << message << id;
+        sendErrorReply(QDBusError::InvalidArgs, message);
+    }
+    return seat;
+}
+
+bool SailfishUserManager::switching() const
+{
+    for (const Seat *seat : m_seats) {
+        if (seat->switchUser)
+            return true;
     }
+    return false;
+}
 
-    return true;
+// Returns true if uid is active or being switched to on a seat other than except
+bool SailfishUserManager::userOnSeat(uint uid, const Seat *except) const
+{
+    for (Seat *seat : m_seats) {
+        if (seat != except && (seat->switchUser == uid || seat->monitor->activeUser() == uid))
+            return true;
+    }
+    return false;
 }
 
-void SailfishUserManager::initSystemdManager()
+void SailfishUserManager::initSystemdManager(Seat *seat)
 {
-    m_systemd = new SystemdManager(this);
-    connect(m_systemd, &SystemdManager::busyChanged, this, &SailfishUserManager::onBusyChanged);
-    connect(m_systemd, &SystemdManager::unitJobFinished, this, &SailfishUserManager::onUnitJobFinished);
-    connect(m_systemd, &SystemdManager::unitJobFailed, this, &SailfishUserManager::onUnitJobFailed);
-    connect(m_systemd, &SystemdManager::creatingJobFailed, this, &SailfishUserManager::onCreatingJobFailed);
+    seat->systemd = new SystemdManager(this);
+    seat->systemd->setJobTimeout(UNIT_JOB_TIMEOUT);
+    connect(seat->systemd, &SystemdManager::busyChanged, this, [this, seat]() {
+        onBusyChanged(seat);
+    });
+    connect(seat->systemd, &SystemdManager::unitJobFinished, this, [this, seat](SystemdManager::Job &job) {
+        onUnitJobFinished(seat, job);
+    });
+    connect(seat->systemd, &SystemdManager::unitJobFailed,
+            this, [this, seat](SystemdManager::Job &job, SystemdManager::JobList &remaining) {
+        onUnitJobFailed(seat, job, remaining);
+    });
+    connect(seat->systemd, &SystemdManager::creatingJobFailed, this, [this, seat](SystemdManager::JobList &remaining) {
+        onCreatingJobFailed(seat, remaining);
+    });
 }
 
 /*!
   \brief Sets current user to user with given \a uid.
 
   This will end current user session and start user session for \a uid
-  which must be different from current user's \e UID.
+  which must be different from current user's \e UID. This operates on
+  \c seat0, see \l setSeatCurrentUser for other seats.
 
   This may return errors
   \l {D-Bus errors} {SailfishUserManagerErrorGetUidFailed},
@@ -649,38 +1538,89 @@ void SailfishUserManager::initSystemdManager()
  */
 void SailfishUserManager::setCurrentUser(uint uid)
 {
+    MetricsScope scope("dbus.setCurrentUser");
+    if (!admit(Admission::Write))
+        return;
+    if (checkCallerUid() == SAILFISH_UNDEFINED_UID)
+        return;
+
+    switchUser(m_primarySeat, uid);
+}
+
+/*!
+  \brief Sets current user on \a seat to user with given \a uid.
+
+  This works like \l setCurrentUser but on the given seat. Switching is
+  supported only on \c seat0 for now, as autologin and session units are not
+  seat specific and switching on another seat would restart those of \c
+  seat0.
+
+  This may return errors
+  \l {D-Bus errors} {SailfishUserManagerErrorGetUidFailed},
+  \l {D-Bus errors} {SailfishUserManagerErrorBusy},
+  \l {D-Bus errors} {SailfishUserManagerErrorUserNotFound},
+  \c QDBusError::NotSupported if \a seat is not \c seat0 and
+  \c QDBusError::InvalidArgs if \a seat does not exist.
+ */
+void SailfishUserManager::setSeatCurrentUser(const QString &seat, uint uid)
+{
+    MetricsScope scope("dbus.setSeatCurrentUser");
+    if (!admit(Admission::Write))
+        return;
     if (checkCallerUid() == SAILFISH_UNDEFINED_UID)
         return;
 
-    if (m_switchUser) {
+    Seat *state = findSeat(seat);
+    if (!state)
+        return;
+
+    // autologin@.service and default.target are shared by all seats
+    if (state != m_primarySeat) {
+        auto message = QStringLiteral("Switching user is supported only on %1").arg(m_primarySeat->id);
+        qCWarning(lcSUM) << message << "not on" << seat;
+        sendErrorReply(QDBusError::NotSupported, message);
+        return;
+    }
+
+    switchUser(state, uid);
+}
+
+void SailfishUserManager::switchUser(Seat *seat, uint uid)
+{
+    if (seat->switchState != SwitchIdle) {
         auto message = QStringLiteral("Already switching user");
-        qCWarning(lcSUM) << message;
+        qCWarning(lcSUM) << message << "on" << seat->id;
         sendErrorReply(QStringLiteral(SailfishUserManagerErrorBusy), message);
         return;
     }
 
-    m_currentUid = currentUser();
-    if (m_currentUid == SAILFISH_UNDEFINED_UID)
+    seat->currentUid = seat->monitor->activeUser();
+    if (seat->currentUid == SAILFISH_UNDEFINED_UID) {
+        auto message = QStringLiteral("Failed to get current user id");
+        qCWarning(lcSUM) << message << "on" << seat->id;
+        sendErrorReply(QStringLiteral(SailfishUserManagerErrorGetUidFailed), message);
         return;
+    }
 
-    if (m_currentUid == uid) {
+    if (seat->currentUid == uid) {
         auto message = QStringLiteral("User already active");
         qCWarning(lcSUM) << message;
         sendErrorReply(QDBusError::InvalidArgs, message);
         return;
     }
 
-    bool uidFound = false;
-    struct group *grent = getgrnam(USER_GROUP);
-    if (grent) {
-        for (int i = 0; grent->gr_mem[i]; i++) {
-            struct passwd *pw = getpwnam(grent->gr_mem[i]);
-            if (pw && pw->pw_uid == uid) {
-                uidFound = true;
-                break;
-            }
-        }
+    if (userOnSeat(uid, seat)) {
+        auto message = QStringLiteral("User active on another seat");
+        qCWarning(lcSUM) << message;
+        sendErrorReply(QStringLiteral(SailfishUserManagerErrorBusy), message);
+        return;
     }
+
+    bool uidFound = false;
+    const AccountLanes::Snapshot accounts = m_lanes->snapshot();
+    AccountReader::User pw;
+    if (accounts->findUser(uid, &pw))
+        uidFound = accounts->groupMembers(USER_GROUP).contains(pw.name);
     if (!uidFound) {
         auto message = QStringLiteral("User not found");
         qCWarning(lcSUM) << message;
@@ -696,104 +1636,281 @@ void SailfishUserManager::setCurrentUser(uint uid)
         return;
     }
 
-    qCDebug(lcSUM) << "About to switch user to uid" << uid;
-    emit aboutToChangeCurrentUser(uid);
+    qCDebug(lcSUM) << "About to switch user to uid" << uid << "on" << seat->id;
+    FlightRecorder::record("switch", FlightRecorder::Begin, uid);
+    emit aboutToChangeSeatCurrentUser(seat->id, uid);
+    if (seat == m_primarySeat)
+        emit aboutToChangeCurrentUser(uid);
 
-    m_switchUser = uid;
+    seat->switchUser = uid;
+    seat->switchSerial++;
+    seat->switchDeadline->start();
+    setSwitchState(seat, SwitchDelayed);
+    seat->job = createJob(QStringLiteral("switchUser"), uid);
+    seat->job->start();
 
     // Remove guest user's extra data, if there is any left from a previous session
     if (uid == SAILFISH_USERMANAGER_GUEST_UID)
         removeUserFiles(SAILFISH_USERMANAGER_GUEST_UID);
 
-    QTimer::singleShot(SWITCHING_DELAY, [this] {
-        if (!m_systemd) {
-            initSystemdManager();
+    const uint serial = seat->switchSerial;
+    QTimer::singleShot(SWITCHING_DELAY, this, [this, seat, serial] {
+        if (seat->switchSerial != serial || seat->switchState != SwitchDelayed)
+            return;
+
+        // Switch can be cancelled only before sessions are touched
+        if (!seat->job->disableCancel()) {
+            qCDebug(lcSUM) << "Switching user on" << seat->id << "cancelled";
+            FlightRecorder::record("switch", FlightRecorder::Failed, seat->switchUser);
+            emit seatCurrentUserChangeFailed(seat->id, seat->switchUser);
+            if (seat == m_primarySeat)
+                emit currentUserChangeFailed(seat->switchUser);
+            abandonSwitch(seat);
+            finishSwitch(seat, Job::Cancelled);
+            m_idle->activity();
+            return;
         }
 
-        executeScripts(m_currentUid, USER_PRE_SWITCH_SCRIPT_DIR);
+        if (!seat->systemd) {
+            initSystemdManager(seat);
+        }
 
-        qCDebug(lcSUM) << "Switching user from" << m_currentUid << "to" << m_switchUser << "now";
-        m_systemd->addUnitJobs(SystemdManager::JobList()
-                               << SystemdManager::Job::stop(USER_SERVICE.arg(m_currentUid))
-                               << SystemdManager::Job::stop(AUTOLOGIN_SERVICE.arg(m_currentUid))
-                               << SystemdManager::Job::start(AUTOLOGIN_SERVICE.arg(m_switchUser))
-                               << SystemdManager::Job::start(USER_SERVICE.arg(m_switchUser), false));
+        // Hooks that do not return in time are left running
+        setSwitchState(seat, SwitchHooks);
+        QFutureWatcher<void> *hooksWatcher = new QFutureWatcher<void>(this);
+        connect(hooksWatcher, &QFutureWatcherBase::finished, this, [this, seat, serial, hooksWatcher]() {
+            hooksWatcher->deleteLater();
+            startSwitchJobs(seat, serial);
+        });
+        hooksWatcher->setFuture(QtConcurrent::run(&SailfishUserManager::runHooks,
+                                                  hookEvent(SailfishUserManagerHookEvent::PreSwitch,
+                                                            seat->switchUser, seat->currentUid, seat->id),
+                                                  nullptr));
+        QTimer::singleShot(PRE_SWITCH_TIMEOUT, this, [this, seat, serial]() {
+            if (seat->switchSerial == serial && seat->switchState == SwitchHooks) {
+                qCWarning(lcSUM) << "Pre-switch hooks did not finish in" << PRE_SWITCH_TIMEOUT << "ms, switching anyway";
+                startSwitchJobs(seat, serial);
+            }
+        });
     });
 }
 
-void SailfishUserManager::onBusyChanged()
+/*
+ * Switching goes through the states below in order, each unit job moves it
+ * to the next state whether it succeeded or failed in a way that can be
+ * continued from. Failures that can not be continued from and the switch
+ * deadline return the seat to SwitchIdle, or to SwitchRecovering until the
+ * fallback unit jobs they queued have ended.
+ */
+void SailfishUserManager::setSwitchState(Seat *seat, SwitchState state)
+{
+    static const char *names[] = {
+        "idle", "delayed", "hooks", "stopping-session", "stopping-autologin",
+        "starting-autologin", "starting-session", "recovering"
+    };
+    qCDebug(lcSUM) << "Switch on" << seat->id << "is" << names[state];
+    seat->switchState = state;
+    if (state == SwitchIdle) {
+        seat->switchDeadline->stop();
+        seat->switchUser = 0;
+    }
+}
+
+void SailfishUserManager::startSwitchJobs(Seat *seat, uint serial)
+{
+    // Hooks finished after their deadline or the switch ended meanwhile
+    if (seat->switchSerial != serial || seat->switchState != SwitchHooks)
+        return;
+
+    qCDebug(lcSUM) << "Switching user from" << seat->currentUid << "to" << seat->switchUser
+                   << "on" << seat->id << "now";
+    setSwitchState(seat, SwitchStoppingSession);
+    seat->systemd->addUnitJobs(SystemdManager::JobList()
+                               << SystemdManager::Job::stop(USER_SERVICE.arg(seat->currentUid))
+                               << SystemdManager::Job::stop(AUTOLOGIN_SERVICE.arg(seat->currentUid))
+                               << SystemdManager::Job::start(AUTOLOGIN_SERVICE.arg(seat->switchUser))
+                               << SystemdManager::Job::start(USER_SERVICE.arg(seat->switchUser), false));
+}
+
+/*
+ * Switch did not end in SWITCH_TIMEOUT. Remaining unit jobs are dropped and
+ * the seat is returned to the previous user: while only its session was
+ * being stopped the session is started again, after that default target
+ * brings up autologin of the previous user as the last login was not
+ * updated.
+ */
+void SailfishUserManager::onSwitchDeadline(Seat *seat)
+{
+    const SwitchState state = seat->switchState;
+    if (state == SwitchIdle || state == SwitchRecovering)
+        return;
+
+    qCWarning(lcSUM) << "Switching user on" << seat->id << "did not finish in" << SWITCH_TIMEOUT << "ms";
+    if (seat->systemd) {
+        seat->systemd->abort();
+        if (state == SwitchStoppingSession)
+            seat->systemd->addUnitJob(SystemdManager::Job::start(USER_SERVICE.arg(seat->currentUid)));
+        else if (state > SwitchStoppingSession)
+            seat->systemd->addUnitJob(SystemdManager::Job::start(DEFAULT_TARGET));
+    }
+    switchFailed(seat, seat->switchUser);
+    abandonSwitch(seat);
+    m_idle->activity();
+}
+
+/*
+ * Ends a switch that did not complete. Unit jobs queued in the systemd job
+ * queue of the seat by now are fallbacks, new switches are refused until
+ * they have ended so that their jobs are not queued behind them. Changes of
+ * the active user were not reported while switching, they are reported now.
+ */
+void SailfishUserManager::abandonSwitch(Seat *seat)
+{
+    setSwitchState(seat, seat->systemd && seat->systemd->busy() ? SwitchRecovering : SwitchIdle);
+    reportCurrentUser(seat, seat->monitor->activeUser());
+}
+
+void SailfishUserManager::finishSwitch(Seat *seat, Job::State state)
+{
+    if (seat->job) {
+        seat->job->finish(state);
+        seat->job = nullptr;
+    }
+}
+
+void SailfishUserManager::onBusyChanged(Seat *seat)
 {
-    if (!m_systemd->busy()) {
-        qCDebug(lcSUM) << "Systemd job queue cleared, can exit";
-        m_exitTimer->start();
+    if (!seat->systemd->busy()) {
+        qCDebug(lcSUM) << "Systemd job queue of" << seat->id << "cleared, can exit";
+        if (seat->switchState == SwitchRecovering)
+            abandonSwitch(seat);
+        m_idle->activity();
     }
 }
 
-void SailfishUserManager::onUnitJobFinished(SystemdManager::Job &job)
+void SailfishUserManager::onUnitJobFinished(Seat *seat, SystemdManager::Job &job)
 {
-    if (job.type == SystemdManager::StartJob && job.unit == USER_SERVICE.arg(m_switchUser)) {
+    if (seat->switchState == SwitchRecovering) {
+        // Backup plan, seat changes were not reported while switching
+        seat->monitor->refresh();
+        reportCurrentUser(seat, seat->monitor->activeUser());
+    } else if (job.type == SystemdManager::StartJob && job.unit == USER_SERVICE.arg(seat->switchUser)) {
         // Everything went well
-        emit currentUserChanged(m_switchUser);
-        updateEnvironment(m_switchUser);
-        m_switchUser = 0;
-    } else if (job.type == SystemdManager::StartJob && job.unit == DEFAULT_TARGET) {
-        // Backup plan
-        if (m_currentUid != currentUser())
-            emit currentUserChanged(currentUser());
-    }// else it's not interesting
-}
-
-void SailfishUserManager::onUnitJobFailed(SystemdManager::Job &job, SystemdManager::JobList &remaining) {
-    if (job.type == SystemdManager::StopJob && job.unit == USER_SERVICE.arg(m_currentUid)) {
+        FlightRecorder::record("switch", FlightRecorder::End, seat->switchUser);
+        reportCurrentUser(seat, seat->switchUser);
+        updateEnvironment(seat, seat->switchUser);
+        setSwitchState(seat, SwitchIdle);
+        finishSwitch(seat, Job::Finished);
+    } else if (seat->job) {
+        // Switching consists of four unit jobs
+        seat->job->setProgress(seat->job->progress() + 25);
+        advanceSwitch(seat, job);
+    }
+}
+
+// Moves switch past the state of a stop or autologin start job that ended
+void SailfishUserManager::advanceSwitch(Seat *seat, const SystemdManager::Job &job)
+{
+    if (job.type == SystemdManager::StopJob && job.unit == USER_SERVICE.arg(seat->currentUid))
+        setSwitchState(seat, SwitchStoppingAutologin);
+    else if (job.type == SystemdManager::StopJob && job.unit == AUTOLOGIN_SERVICE.arg(seat->currentUid))
+        setSwitchState(seat, SwitchStartingAutologin);
+    else if (job.type == SystemdManager::StartJob && job.unit == AUTOLOGIN_SERVICE.arg(seat->switchUser))
+        setSwitchState(seat, SwitchStartingSession);
+}
+
+void SailfishUserManager::onActiveUserChanged(Seat *seat, uint uid)
+{
+    // Switching reports the change itself when it is complete
+    if (seat->switchUser == 0)
+        reportCurrentUser(seat, uid);
+}
+
+void SailfishUserManager::reportCurrentUser(Seat *seat, uint uid)
+{
+    if (uid != SAILFISH_UNDEFINED_UID && uid != seat->reportedUid) {
+        seat->reportedUid = uid;
+        emit seatCurrentUserChanged(seat->id, uid);
+        if (seat == m_primarySeat)
+            emit currentUserChanged(uid);
+    }
+}
+
+void SailfishUserManager::onUnitJobFailed(Seat *seat, SystemdManager::Job &job, SystemdManager::JobList &remaining) {
+    if (seat->switchState == SwitchRecovering) {
+        // Fallback of a failed switch, recovery ends when the queue is empty
+        qCWarning(lcSUM) << "Fallback job for" << job.unit << "failed on" << seat->id;
+    } else if (job.type == SystemdManager::StopJob && job.unit == USER_SERVICE.arg(seat->currentUid)) {
         // session systemd is fubar, autologin is probably still up
         qCWarning(lcSUM) << "Unit failed while stopping session, trying to continue";
-        m_systemd->addUnitJobs(remaining); // Try to continue anyway
-    } else if (job.type == SystemdManager::StopJob && job.unit == AUTOLOGIN_SERVICE.arg(m_currentUid)) {
+        advanceSwitch(seat, job);
+        seat->systemd->addUnitJobs(remaining); // Try to continue anyway
+    } else if (job.type == SystemdManager::StopJob && job.unit == AUTOLOGIN_SERVICE.arg(seat->currentUid)) {
         // session systemd is down, autologind stop failed
         qCWarning(lcSUM) << "Autologin failed while stopping it, trying to continue";
-        m_systemd->addUnitJobs(remaining); // Try to continue anyway
-    } else if (job.type == SystemdManager::StartJob && job.unit == AUTOLOGIN_SERVICE.arg(m_switchUser)) {
+        advanceSwitch(seat, job);
+        seat->systemd->addUnitJobs(remaining); // Try to continue anyway
+    } else if (job.type == SystemdManager::StartJob && job.unit == AUTOLOGIN_SERVICE.arg(seat->switchUser)) {
         // session systemd is already down, autologind didn't come back again
         // Try to start to user session normally still
         qCWarning(lcSUM) << "User session start failed, trying to start default target as fallback";
-        m_systemd->addUnitJob(SystemdManager::Job::start(DEFAULT_TARGET));
-        m_switchUser = 0;
+        seat->systemd->addUnitJob(SystemdManager::Job::start(DEFAULT_TARGET));
         // Inform UI
-        emit currentUserChangeFailed(m_switchUser);
-    } else if (job.type == SystemdManager::StartJob && job.unit == USER_SERVICE.arg(m_switchUser)) {
+        switchFailed(seat, seat->switchUser);
+        abandonSwitch(seat);
+    } else if (job.type == SystemdManager::StartJob && job.unit == USER_SERVICE.arg(seat->switchUser)) {
         // autologind was started but starting user@.service failed, probably because it was already starting
         qCWarning(lcSUM) << "Starting session systemd failed, is it already starting?";
-        m_switchUser = 0;
         // Inform UI
-        emit currentUserChangeFailed(m_switchUser);
+        switchFailed(seat, seat->switchUser);
+        abandonSwitch(seat);
     }
 }
 
-void SailfishUserManager::onCreatingJobFailed(SystemdManager::JobList &remaining) {
+void SailfishUserManager::switchFailed(Seat *seat, uint uid)
+{
+    FlightRecorder::record("switch", FlightRecorder::Failed, uid);
+    const char *path = FlightRecorder::dump(FlightRecorder::SwitchFailure);
+    if (path)
+        qCWarning(lcSUM) << "User switch failed, flight recorder written to" << path;
+    emit seatCurrentUserChangeFailed(seat->id, uid);
+    if (seat == m_primarySeat)
+        emit currentUserChangeFailed(uid);
+    finishSwitch(seat, Job::Failed);
+}
+
+void SailfishUserManager::onCreatingJobFailed(Seat *seat, SystemdManager::JobList &remaining) {
+    if (seat->switchState == SwitchRecovering) {
+        // Fallback of a failed switch, recovery ends when the queue is empty
+        qCWarning(lcSUM) << "Could not create fallback job for" << remaining.first().unit << "on" << seat->id;
+        return;
+    }
+
     if (remaining.count() == 1) {
-        if (remaining.first().unit == USER_SERVICE.arg(m_switchUser)) {
+        if (remaining.first().unit == USER_SERVICE.arg(seat->switchUser)) {
             // autologind was started but session systemd wasn't, probably because it was already starting
             qCWarning(lcSUM) << "Could not start session systemd, is it already starting?";
         } // else it was DEFAULT_TARGET and there isn't much that can be done
     } else if (remaining.count() == 2) {
-        if (remaining.first().unit == AUTOLOGIN_SERVICE.arg(m_switchUser)) {
+        if (remaining.first().unit == AUTOLOGIN_SERVICE.arg(seat->switchUser)) {
             // Try to start to user session normally still
             qCWarning(lcSUM) << "Could not start user session, trying to start default target as fallback";
-            m_systemd->addUnitJob(SystemdManager::Job::start(DEFAULT_TARGET));
+            seat->systemd->addUnitJob(SystemdManager::Job::start(DEFAULT_TARGET));
         }
     } else if (remaining.count() == 3) {
-        if (remaining.first().unit == AUTOLOGIN_SERVICE.arg(m_currentUid)) {
+        if (remaining.first().unit == AUTOLOGIN_SERVICE.arg(seat->currentUid)) {
             // session systemd is stopped but autologin is still up and it wasn't brought down
             // TODO: What to do?
             qCWarning(lcSUM) << "Could not stop autologin, user switch failed";
             // Inform UI
-            emit currentUserChangeFailed(m_switchUser);
+            switchFailed(seat, seat->switchUser);
         }
     } else { // nothing was done
         qCWarning(lcSUM) << "User switching did not begin";
-        emit currentUserChangeFailed(m_switchUser);
+        switchFailed(seat, seat->switchUser);
     }
-    m_switchUser = 0;
+    abandonSwitch(seat);
+    finishSwitch(seat, Job::Failed);
 }
 
 /*!
@@ -804,17 +1921,79 @@ void SailfishUserManager::onCreatingJobFailed(SystemdManager::JobList &remaining
  */
 uint SailfishUserManager::currentUser()
 {
-    m_exitTimer->start();
-    uid_t uid;
-    if (sd_seat_get_active("seat0", nullptr, &uid) < 0) {
+    MetricsScope scope("dbus.currentUser");
+    if (!admit(Admission::Read))
+        return SAILFISH_UNDEFINED_UID;
+    m_idle->activity();
+
+    return activeUser();
+}
+
+/*!
+  \brief Returns \e UID of the user that is active on \a seat.
+
+  This may return errors
+  \l {D-Bus errors} {SailfishUserManagerErrorGetUidFailed} and
+  \c QDBusError::InvalidArgs if \a seat does not exist.
+ */
+uint SailfishUserManager::seatCurrentUser(const QString &seat)
+{
+    MetricsScope scope("dbus.seatCurrentUser");
+    if (!admit(Admission::Read))
+        return SAILFISH_UNDEFINED_UID;
+    m_idle->activity();
+
+    Seat *state = findSeat(seat);
+    if (!state)
+        return SAILFISH_UNDEFINED_UID;
+
+    uint uid = state->monitor->activeUser();
+    if (uid == SAILFISH_UNDEFINED_UID) {
         auto message = QStringLiteral("Failed to get current user id");
-        qCWarning(lcSUM) << message;
+        qCWarning(lcSUM) << message << "on" << seat;
         sendErrorReply(QStringLiteral(SailfishUserManagerErrorGetUidFailed), message);
-        return SAILFISH_UNDEFINED_UID;
     }
     return uid;
 }
 
+/*!
+  \brief Returns seats known to the system.
+ */
+QStringList SailfishUserManager::seats()
+{
+    MetricsScope scope("dbus.seats");
+    if (!admit(Admission::Read))
+        return QStringList();
+    m_idle->activity();
+
+    return SeatMonitor::seats();
+}
+
+RequestCoalescer::Reply SailfishUserManager::currentUserReply()
+{
+    uint uid = m_primarySeat->monitor->activeUser();
+    if (uid == SAILFISH_UNDEFINED_UID) {
+        auto message = QStringLiteral("Failed to get current user id");
+        qCWarning(lcSUM) << message;
+        return RequestCoalescer::Reply::error(QStringLiteral(SailfishUserManagerErrorGetUidFailed), message);
+    }
+    return RequestCoalescer::Reply::value(uid);
+}
+
+/*
+ * Current user for internal use, errors are sent as replies to the
+ * D-Bus call in progress.
+ */
+uint SailfishUserManager::activeUser()
+{
+    const RequestCoalescer::Reply reply = currentUserReply();
+    if (reply.isError()) {
+        sendErrorReply(reply.errorName, reply.errorMessage);
+        return SAILFISH_UNDEFINED_UID;
+    }
+    return reply.arguments.first().toUInt();
+}
+
 /*!
   \brief Returns \e UUID (\e {Universally Unique IDentifier}) for current
   user.
@@ -825,11 +2004,40 @@ uint SailfishUserManager::currentUser()
  */
 QString SailfishUserManager::currentUserUuid()
 {
-    const auto uid = currentUser();
-    if (uid == SAILFISH_UNDEFINED_UID) {
+    MetricsScope scope("dbus.currentUserUuid");
+    if (!admit(Admission::Read))
+        return QString();
+    m_idle->activity();
+
+    const uint uid = activeUser();
+    if (uid == SAILFISH_UNDEFINED_UID)
+        return QString();
+    if (calledFromDBus() && storedUuid(*m_lanes->snapshot(), uid).isEmpty()) {
+        writeUuid(uid, &scope);
+        return QString();
+    }
+
+    RequestCoalescer::Reply reply;
+    if (coalesce(QStringLiteral("currentUserUuid"), &SailfishUserManager::currentUserUuidReply, &scope, &reply)
+            || reply.isError())
         return QString();
+
+    return reply.arguments.first().toString();
+}
+
+RequestCoalescer::Reply SailfishUserManager::currentUserUuidReply()
+{
+    RequestCoalescer::Reply reply = currentUserReply();
+    if (reply.isError())
+        return reply;
+
+    const auto userUuid = storedUuid(*m_lanes->snapshot(), reply.arguments.first().toUInt());
+    if (userUuid.isEmpty()) {
+        auto message = QStringLiteral("Failed to get user uuid");
+        qCWarning(lcSUM) << message;
+        return RequestCoalescer::Reply::error(QStringLiteral(SailfishUserManagerErrorGetUuidFailed), message);
     }
-    return userUuid(uid);
+    return RequestCoalescer::Reply::value(userUuid);
 }
 
 /*!
@@ -841,9 +2049,16 @@ QString SailfishUserManager::currentUserUuid()
  */
 QString SailfishUserManager::userUuid(uint uid)
 {
-    m_exitTimer->start();
-    const auto userUuid = m_lu->getUserUuid(uid);
-    if (userUuid.isEmpty()) {
+    MetricsScope scope("dbus.userUuid");
+    if (!admit(Admission::Read))
+        return QString();
+    m_idle->activity();
+    const AccountLanes::Snapshot accounts = m_lanes->snapshot();
+    const auto userUuid = storedUuid(*accounts, uid);
+    if (userUuid.isEmpty() && calledFromDBus() && accounts->findUser(uid, nullptr)) {
+        writeUuid(uid, &scope);
+        return QString();
+    } else if (userUuid.isEmpty()) {
         auto message = QStringLiteral("Failed to get user uuid");
         qCWarning(lcSUM) << message;
         sendErrorReply(QStringLiteral(SailfishUserManagerErrorGetUuidFailed), message);
@@ -852,24 +2067,49 @@ QString SailfishUserManager::userUuid(uint uid)
     return userUuid;
 }
 
-void SailfishUserManager::updateEnvironment(uint uid)
+/*
+ * Users created before UUIDs were stored get one in the writer lane. The
+ * D-Bus call in progress is replied when it has been written, that happens
+ * once per user.
+ */
+void SailfishUserManager::writeUuid(uint uid, MetricsScope *scope)
+{
+    const DelayedReply reply = delayReply(scope);
+    m_lanes->write<QString>(message().service(), [uid](LibUserHelper *lu) {
+        return lu->getUserUuid(uid);
+    }, this, [reply](QString uuid) {
+        if (uuid.isEmpty()) {
+            auto message = QStringLiteral("Failed to get user uuid");
+            qCWarning(lcSUM) << message;
+            reply.sendError(QStringLiteral(SailfishUserManagerErrorGetUuidFailed), message);
+            return;
+        }
+        reply.send(QVariantList() << uuid);
+    });
+}
+
+void SailfishUserManager::updateEnvironment(Seat *seat, uint uid)
 {
     // Nothing here for guest
     if (uid == SAILFISH_USERMANAGER_GUEST_UID)
         return;
 
     // Remove guest user's extra data
-    if (m_currentUid == SAILFISH_USERMANAGER_GUEST_UID)
+    if (seat->currentUid == SAILFISH_USERMANAGER_GUEST_UID)
         removeUserFiles(SAILFISH_USERMANAGER_GUEST_UID);
 
-    if (uid < OWNER_USER_UID || uid > OWNER_USER_UID + SAILFISH_USERMANAGER_MAX_USERS) {
+    // Device boots up as the last user of the primary seat
+    if (seat != m_primarySeat)
+        return;
+
+    if (uid < OWNER_USER_UID || uid > MAX_USER_UID) {
         // This could be also an assert but it only results in device booting up as wrong user
         qCWarning(lcSUM) << "updateEnvironment: uid" << uid
                          << "is outside allowed range. Not setting LAST_LOGIN_UID.";
         return;
     }
 
-    QFile file(ENVIRONMENT_FILE);
+    QFile file(Sandbox::path(ENVIRONMENT_FILE));
     if (file.open(QIODevice::ReadWrite | QIODevice::Text)) {
         QByteArray line;
         QByteArray rest;
@@ -895,8 +2135,18 @@ void SailfishUserManager::updateEnvironment(uint uid)
  */
 QStringList SailfishUserManager::usersGroups(uint uid)
 {
-    m_exitTimer->start();
-    return m_lu->groups(uid);
+    MetricsScope scope("dbus.usersGroups");
+    if (!admit(Admission::Read))
+        return QStringList();
+    m_idle->activity();
+    const AccountLanes::Snapshot accounts = m_lanes->snapshot();
+    AccountReader::User pw;
+    if (!accounts->findUser(uid, &pw)) {
+        qCWarning(lcSUM) << "Could not find user";
+        scope.fail();
+        return QStringList();
+    }
+    return accounts->groupsOfUser(pw.name);
 }
 
 /*!
@@ -911,41 +2161,54 @@ QStringList SailfishUserManager::usersGroups(uint uid)
  */
 void SailfishUserManager::addToGroups(uint uid, const QStringList &groups)
 {
+    MetricsScope scope("dbus.addToGroups");
+    if (!admit(Admission::Write))
+        return;
     if (!checkAccessRights(SAILFISH_UNDEFINED_UID))
         return;
 
-    m_exitTimer->start();
+    m_idle->activity();
 
     if (!checkIsPermissionGroup(groups))
         return;
 
-    struct passwd *pwd = getpwuid(uid);
-    if (!pwd) {
+    AccountReader::User pwd;
+    if (!m_lanes->snapshot()->findUser(uid, &pwd)) {
         auto message = QStringLiteral("User not found");
         qCWarning(lcSUM) << message;
         sendErrorReply(QStringLiteral(SailfishUserManagerErrorUserNotFound), message);
         return;
     }
 
-    QStringList original = m_lu->groups(uid);
-    QStringList revert;
-    for (const QString &group : groups) {
-        if (!original.contains(group)) {
-            if (m_lu->addUserToGroup(pwd->pw_name, group)) {
-                revert.append(group);
-            } else {
-                auto message = QStringLiteral("Failed to add user to group");
-                qCWarning(lcSUM) << message;
-                sendErrorReply(QStringLiteral(SailfishUserManagerErrorAddToGroupFailed), message);
-
-                // Revert back to original groups
-                for (const QString &newGroup : revert)
-                    m_lu->removeUserFromGroup(pwd->pw_name, newGroup);
-
-                return;
+    const DelayedReply reply = delayReply(&scope);
+    const QString user = pwd.name;
+    m_lanes->write<bool>(message().service(), [uid, user, groups](LibUserHelper *lu) {
+        const QSet<QString> original = lu->groups(uid).toSet();
+        QStringList revert;
+        for (const QString &group : groups) {
+            if (!original.contains(group)) {
+                if (lu->addUserToGroup(user, group)) {
+                    revert.append(group);
+                } else {
+                    // Revert back to original groups
+                    for (const QString &newGroup : revert)
+                        lu->removeUserFromGroup(user, newGroup);
+                    return false;
+                }
             }
         }
-    }
+        return true;
+    }, this, [this, reply](bool added) {
+        // Directory generation changes
+        m_propertiesTimer->start();
+        if (!added) {
+            auto message = QStringLiteral("Failed to add user to group");
+            qCWarning(lcSUM) << message;
+            reply.sendError(QStringLiteral(SailfishUserManagerErrorAddToGroupFailed), message);
+            return;
+        }
+        reply.send();
+    });
 }
 
 /*!
@@ -960,42 +2223,54 @@ void SailfishUserManager::addToGroups(uint uid, const QStringList &groups)
  */
 void SailfishUserManager::removeFromGroups(uint uid, const QStringList &groups)
 {
+    MetricsScope scope("dbus.removeFromGroups");
+    if (!admit(Admission::Write))
+        return;
     if (!checkAccessRights(SAILFISH_UNDEFINED_UID))
         return;
 
-    m_exitTimer->start();
+    m_idle->activity();
 
     if (!checkIsPermissionGroup(groups))
         return;
 
-    struct passwd *pwd = getpwuid(uid);
-    if (!pwd) {
+    AccountReader::User pwd;
+    if (!m_lanes->snapshot()->findUser(uid, &pwd)) {
         auto message = QStringLiteral("User not found");
         qCWarning(lcSUM) << message;
         sendErrorReply(QStringLiteral(SailfishUserManagerErrorUserNotFound), message);
         return;
     }
 
-    QStringList original = m_lu->groups(uid);
-    QStringList revert;
-
-    for (const QString &group : groups) {
-        if (original.contains(group)) {
-            if (m_lu->removeUserFromGroup(pwd->pw_name, group)) {
-                revert.append(group);
-            } else {
-                auto message = QStringLiteral("Failed to remove user from group");
-                qCWarning(lcSUM) << message;
-                sendErrorReply(QStringLiteral(SailfishUserManagerErrorRemoveFromGroupFailed), message);
-
-                // Revert back to original groups
-                for (const QString &oldGroup : revert)
-                    m_lu->addUserToGroup(pwd->pw_name, oldGroup);
-
-                return;
+    const DelayedReply reply = delayReply(&scope);
+    const QString user = pwd.name;
+    m_lanes->write<bool>(message().service(), [uid, user, groups](LibUserHelper *lu) {
+        const QSet<QString> original = lu->groups(uid).toSet();
+        QStringList revert;
+        for (const QString &group : groups) {
+            if (original.contains(group)) {
+                if (lu->removeUserFromGroup(user, group)) {
+                    revert.append(group);
+                } else {
+                    // Revert back to original groups
+                    for (const QString &oldGroup : revert)
+                        lu->addUserToGroup(user, oldGroup);
+                    return false;
+                }
             }
         }
-    }
+        return true;
+    }, this, [this, reply](bool removed) {
+        // Directory generation changes
+        m_propertiesTimer->start();
+        if (!removed) {
+            auto message = QStringLiteral("Failed to remove user from group");
+            qCWarning(lcSUM) << message;
+            reply.sendError(QStringLiteral(SailfishUserManagerErrorRemoveFromGroupFailed), message);
+            return;
+        }
+        reply.send();
+    });
 }
 
 bool SailfishUserManager::checkIsPermissionGroup(const QStringList &groups)
@@ -1020,24 +2295,104 @@ bool SailfishUserManager::checkIsPermissionGroup(const QStringList &groups)
 
   This may return errors
   \l {D-Bus errors} {SailfishUserManagerErrorUserAddFailed},
-  \l {D-Bus errors} {SailfishUserManagerErrorUserModifyFailed} and
-  \l {D-Bus errors} {SailfishUserManagerErrorUserRemoveFailed}.
+  \l {D-Bus errors} {SailfishUserManagerErrorUserModifyFailed},
+  \l {D-Bus errors} {SailfishUserManagerErrorUserRemoveFailed},
+  \l {D-Bus errors} {SailfishUserManagerErrorBusy} and
+  \l {D-Bus errors} {SailfishUserManagerErrorCancelled}.
+
+  The reply is sent when the job adding or removing \e {guest user} is done.
  */
 void SailfishUserManager::enableGuestUser(bool enable)
 {
+    MetricsScope scope("dbus.enableGuestUser");
+    if (!admit(Admission::Write))
+        return;
     if (!checkAccessRights(SAILFISH_USERMANAGER_GUEST_UID))
         return;
 
-    if (enable != (bool)getpwuid(SAILFISH_USERMANAGER_GUEST_UID)) {
-        if (enable) {
-            if (addSailfishUser(GUEST_USER, "", SAILFISH_USERMANAGER_GUEST_UID, SAILFISH_USERMANAGER_GUEST_HOME))
-                emit guestUserEnabled(true);
+    if (enable == m_lanes->snapshot()->findUser(SAILFISH_USERMANAGER_GUEST_UID, nullptr))
+        return;
+
+    if (!enable && userOnSeat(SAILFISH_USERMANAGER_GUEST_UID)) {
+        auto message = QStringLiteral("Can not remove current user");
+        qCWarning(lcSUM) << message;
+        sendErrorReply(QDBusError::InvalidArgs, message);
+        return;
+    }
+
+    if (userBusy(SAILFISH_USERMANAGER_GUEST_UID))
+        return;
+
+    m_idle->activity();
+
+    // Reply is sent when the job is done
+    Job *job = createJob(enable ? QStringLiteral("addUser") : QStringLiteral("removeUser"),
+                         SAILFISH_USERMANAGER_GUEST_UID);
+    const DelayedReply reply = delayReply(&scope);
+    auto done = [this, reply, enable](uint uid, const QString &errorName, const QString &errorMessage) {
+        if (!uid) {
+            reply.sendError(errorName, errorMessage);
         } else {
-            removeUser(SAILFISH_USERMANAGER_GUEST_UID);
-            if (!getpwuid(SAILFISH_USERMANAGER_GUEST_UID))
-                emit guestUserEnabled(false);
+            emit guestUserEnabled(enable);
+            reply.send();
         }
-    }
+    };
+    if (enable)
+        addSailfishUser(GUEST_USER, "", SAILFISH_USERMANAGER_GUEST_UID,
+                        Sandbox::path(SAILFISH_USERMANAGER_GUEST_HOME), job, done);
+    else
+        removeSailfishUser(SAILFISH_USERMANAGER_GUEST_UID, job, done);
+}
+
+/*!
+  \brief Returns object paths of jobs that are in progress.
+
+  Every job implements \c org.sailfishos.usermanager.Job interface. See
+  \l JobNew and \l JobRemoved.
+ */
+QList<QDBusObjectPath> SailfishUserManager::jobs()
+{
+    MetricsScope scope("dbus.jobs");
+    if (!admit(Admission::Read))
+        return QList<QDBusObjectPath>();
+    m_idle->activity();
+
+    QList<uint> ids = m_jobs.keys();
+    std::sort(ids.begin(), ids.end());
+    QList<QDBusObjectPath> paths;
+    for (uint id : ids)
+        paths.append(m_jobs.value(id)->path());
+    return paths;
+}
+
+/*
+ * Creates job and exports it on D-Bus. Job is owned by the calling client
+ * which may cancel it.
+ */
+Job *SailfishUserManager::createJob(const QString &type, uint uid)
+{
+    uint id = ++m_lastJobId;
+    Job *job = new Job(id, type, uid, calledFromDBus() ? message().service() : QString(), this);
+    new JobAdaptor(job);
+    if (!Sandbox::bus().registerObject(job->path().path(), job))
+        qCWarning(lcSUM) << "Failed to register job object" << job->path().path();
+    m_jobs.insert(id, job);
+    connect(job, &Job::finished, this, [this, job]() {
+        onJobFinished(job);
+    });
+    emit JobNew(id, job->path(), type, uid);
+    return job;
+}
+
+void SailfishUserManager::onJobFinished(Job *job)
+{
+    Metrics::instance()->record(QStringLiteral("job.") + job->type(), job->elapsed(),
+                                job->state() == Job::Finished ? QString() : job->stateName());
+    m_jobs.remove(job->id());
+    Sandbox::bus().unregisterObject(job->path().path());
+    emit JobRemoved(job->id(), job->path(), job->type(), job->stateName());
+    job->deleteLater();
+    m_idle->activity();
 }
 
 /*!
@@ -1045,7 +2400,8 @@ void SailfishUserManager::enableGuestUser(bool enable)
 
   \brief Triggered when a new user has been added.
 
-  User information is contained in \a user.
+  User information is contained in \a user. Also triggered for users added
+  outside of the daemon while it is running.
 
   \sa SailfishUserManagerEntry
  */
@@ -1054,6 +2410,8 @@ void SailfishUserManager::enableGuestUser(bool enable)
   \fn void SailfishUserManager::userRemoved(uint uid)
 
   \brief Triggered when user with \a uid has been removed.
+
+  Also triggered for users removed outside of the daemon while it is running.
  */
 
 /*!
@@ -1061,7 +2419,9 @@ void SailfishUserManager::enableGuestUser(bool enable)
 
   \brief Triggered when user's real name has been changed.
 
-  User with \a uid has \a new_name as their new real name.
+  User with \a uid has \a new_name as their new real name. Also triggered
+  when user name or real name is changed outside of the daemon while it is
+  running.
  */
 
 /*!
@@ -1069,7 +2429,8 @@ void SailfishUserManager::enableGuestUser(bool enable)
 
   \brief Triggered when current user is changed.
 
-  Current user is set to user with \a uid.
+  Current user is set to user with \a uid. This is also triggered when the
+  active user of the seat is changed by something else than user manager.
  */
 
 /*!
@@ -1095,6 +2456,29 @@ void SailfishUserManager::enableGuestUser(bool enable)
   follow this signal.
  */
 
+/*!
+  \fn void SailfishUserManager::seatCurrentUserChanged(const QString &seat, uint uid)
+
+  \brief Triggered when current user of \a seat is changed to user with \a
+  uid.
+
+  This is triggered for all seats including \c seat0.
+ */
+
+/*!
+  \fn void SailfishUserManager::seatCurrentUserChangeFailed(const QString &seat, uint uid)
+
+  \brief Triggered when changing current user of \a seat to user with \a uid
+  fails.
+ */
+
+/*!
+  \fn void SailfishUserManager::aboutToChangeSeatCurrentUser(const QString &seat, uint uid)
+
+  \brief Triggered when system is about to change current user of \a seat to
+  user with \a uid.
+ */
+
 /*!
   \fn void SailfishUserManager::guestUserEnabled(bool enabled)
 
@@ -1103,3 +2487,37 @@ void SailfishUserManager::enableGuestUser(bool enable)
   If \a enabled is \c true, \e {guest user} is enabled, otherwise it is
   disabled.
  */
+
+/*!
+  \fn void SailfishUserManager::quotaWarning(uint uid, const QString &resource, const QString &limit)
+
+  \brief Triggered when user with \a uid crosses a quota limit on /home.
+
+  Argument \a resource is \c blocks or \c inodes and \a limit tells what
+  happened: \c soft or \c hard when usage went over that limit,
+  \c grace-expired when soft limit has been exceeded longer than the grace
+  period and \c below-soft or \c below-hard when usage went back under the
+  limit.
+
+  This is emitted only while the daemon is running.
+ */
+
+/*!
+  \fn void SailfishUserManager::JobNew(uint id, const QDBusObjectPath &job, const QString &type, uint uid)
+
+  \brief Triggered when a new job has been started.
+
+  Job with \a id is exported at path \a job. Argument \a type is one of
+  \c addUser, \c removeUser and \c switchUser and \a uid is the user the job
+  operates on.
+ */
+
+/*!
+  \fn void SailfishUserManager::JobRemoved(uint id, const QDBusObjectPath &job, const QString &type, const QString &result)
+
+  \brief Triggered when a job has ended.
+
+  Job with \a id and \a type at path \a job ended with \a result which is
+  one of \c finished, \c failed and \c cancelled. The job object is not
+  available after this.
+ */
@@ -14,18 +14,43 @@
 #include <sys/types.h>
 #endif
 
+#include "admission.h"
+#include "job.h"
+#include "requestcoalescer.h"
 #include "sailfishusermanagerinterface.h"
 #include "systemdmanager.h"
 #include <QDBusContext>
+#include <QDBusObjectPath>
+#include <QHash>
+#include <QVariantMap>
+#include <QVector>
+#include <functional>
 
 class QTimer;
+class QThreadPool;
+class AccountLanes;
+class AccountWatcher;
+class DelayedReply;
+class IdlePolicy;
 class LibUserHelper;
+class MetricsScope;
+class QuotaMonitor;
+class SeatMonitor;
+class UidAllocator;
+class UserNameIndex;
 class QDBusPendingCallWatcher;
 class QDBusInterface;
+struct SailfishUserManagerHookEvent;
 
 class SailfishUserManager : public QObject, protected QDBusContext
 {
     Q_OBJECT
+    Q_PROPERTY(uint CurrentUser READ primarySeatUser)
+    Q_PROPERTY(QString CurrentUserUuid READ primarySeatUserUuid)
+    Q_PROPERTY(bool GuestUserEnabled READ isGuestUserEnabled)
+    Q_PROPERTY(uint UserCount READ userCount)
+    Q_PROPERTY(bool SwitchInProgress READ switching)
+    Q_PROPERTY(qulonglong DirectoryGeneration READ directoryGeneration)
 
 public:
     explicit SailfishUserManager(QObject *parent = nullptr);
@@ -33,15 +58,25 @@ public:
     static int removeUserFiles(const char *user);
 
 private:
-    bool addUserToGroups(const QString &user);
-    bool makeHome(const QString &user);
-    bool removeDir(const QString &dir);
-    bool removeHome(uint uid);
-    bool copyDir(const QString &source, const QString &destination, uint uid, uint guid);
-    static void executeScripts(uint uid, const QString &directory);
-    static int removeUserFiles(uint uid);
+    // Called with uid on success and with zero uid and error otherwise
+    typedef std::function<void(uint uid, const QString &errorName, const QString &errorMessage)> JobCallback;
+
+    static bool addUserToGroups(LibUserHelper *lu, const QString &user);
+    bool makeHome(const QString &home, uint uid, uint gid, Job *job = nullptr);
+    bool removeDir(const QString &dir, Job *job = nullptr);
+    bool removeHome(const QString &home, Job *job = nullptr);
+    bool copyDir(const QString &source, const QString &destination, uint uid, uint guid, Job *job = nullptr);
+    static void executeScripts(uint uid, const QString &systemDirectory, Job *job = nullptr);
+    static void runHooks(const SailfishUserManagerHookEvent &event, Job *job = nullptr);
+    static int removeUserFiles(uint uid, Job *job = nullptr);
     static void setUserLimits(uint uid);
-    uint addSailfishUser(const QString &user, const QString &name, uint userId = 0, const QString &home = QString());
+    static void reconcileQuotaLimits(const QVector<uint> &uids);
+    void reconcileQuota();
+    void addSailfishUser(const QString &user, const QString &name, uint userId, const QString &home,
+                         Job *job, const JobCallback &done);
+    void addSailfishUserFinished(const QString &user, const QString &name, uint uid, const QString &homeDir,
+                                 bool groupsAdded, bool homeCreated, Job *job, const JobCallback &done);
+    void removeSailfishUser(uint uid, Job *job, const JobCallback &done);
 
 signals:
     void userAdded(const SailfishUserManagerEntry &user);
@@ -50,7 +85,13 @@ signals:
     void currentUserChanged(uint uid);
     void currentUserChangeFailed(uint uid);
     void aboutToChangeCurrentUser(uint uid);
+    void seatCurrentUserChanged(const QString &seat, uint uid);
+    void seatCurrentUserChangeFailed(const QString &seat, uint uid);
+    void aboutToChangeSeatCurrentUser(const QString &seat, uint uid);
     void guestUserEnabled(bool enabled);
+    void quotaWarning(uint uid, const QString &resource, const QString &limit);
+    void JobNew(uint id, const QDBusObjectPath &job, const QString &type, uint uid);
+    void JobRemoved(uint id, const QDBusObjectPath &job, const QString &type, const QString &result);
 
 public slots:
     QList<SailfishUserManagerEntry> users();
@@ -59,32 +100,118 @@ public slots:
     void modifyUser(uint uid, const QString &new_name);
     void setCurrentUser(uint uid);
     uint currentUser();
+    QStringList seats();
+    void setSeatCurrentUser(const QString &seat, uint uid);
+    uint seatCurrentUser(const QString &seat);
     QString currentUserUuid();
     QString userUuid(uint uid);
     QStringList usersGroups(uint uid);
     void addToGroups(uint uid, const QStringList &groups);
     void removeFromGroups(uint uid, const QStringList &groups);
     void enableGuestUser(bool enable);
+    QList<QDBusObjectPath> jobs();
 
 private slots:
     void exitTimeout();
-    void onBusyChanged();
-    void onUnitJobFinished(SystemdManager::Job &job);
-    void onUnitJobFailed(SystemdManager::Job &job, SystemdManager::JobList &remaining);
-    void onCreatingJobFailed(SystemdManager::JobList &remaining);
+    void trimMemory();
+    void onQuotaWarning(uint uid, const QString &resource, const QString &limit);
+    void publishProperties();
+    void syncDirectory();
 
 private:
+    // Switching state of a seat, every seat has its own systemd job queue
+    enum SwitchState {
+        SwitchIdle,
+        SwitchDelayed,
+        SwitchHooks,
+        SwitchStoppingSession,
+        SwitchStoppingAutologin,
+        SwitchStartingAutologin,
+        SwitchStartingSession,
+        // Switch failed, fallback unit jobs are still queued
+        SwitchRecovering
+    };
+
+    struct Seat {
+        QString id;
+        SeatMonitor *monitor;
+        SystemdManager *systemd;
+        uid_t switchUser;
+        uid_t currentUid;
+        uid_t reportedUid;
+        Job *job;
+        SwitchState switchState;
+        // Distinguishes callbacks of an earlier switch from the current one
+        uint switchSerial;
+        QTimer *switchDeadline;
+    };
+
+    Seat *addSeat(const QString &id);
+    Seat *findSeat(const QString &id);
+    bool switching() const;
+    uint primarySeatUser();
+    QString primarySeatUserUuid();
+    bool isGuestUserEnabled();
+    uint userCount();
+    qulonglong directoryGeneration();
+    QVariantMap properties();
+    void updateSnapshot();
+    bool userOnSeat(uint uid, const Seat *except = nullptr) const;
+    void switchUser(Seat *seat, uint uid);
+    void setSwitchState(Seat *seat, SwitchState state);
+    void startSwitchJobs(Seat *seat, uint serial);
+    void advanceSwitch(Seat *seat, const SystemdManager::Job &job);
+    void onSwitchDeadline(Seat *seat);
+    void abandonSwitch(Seat *seat);
+    void finishSwitch(Seat *seat, Job::State state);
+    Job *createJob(const QString &type, uint uid);
+    void onJobFinished(Job *job);
+    bool userBusy(uint uid);
+    void onBusyChanged(Seat *seat);
+    void onUnitJobFinished(Seat *seat, SystemdManager::Job &job);
+    void onActiveUserChanged(Seat *seat, uint uid);
+    void onUnitJobFailed(Seat *seat, SystemdManager::Job &job, SystemdManager::JobList &remaining);
+    void onCreatingJobFailed(Seat *seat, SystemdManager::JobList &remaining);
+    typedef RequestCoalescer::Reply (SailfishUserManager::*ReplyFunction)();
+
+    bool admit(Admission::Kind kind);
+    bool coalesce(const QString &key, ReplyFunction compute, MetricsScope *scope,
+                  RequestCoalescer::Reply *reply, QThreadPool *lane = nullptr);
+    RequestCoalescer::Reply usersReply();
+    RequestCoalescer::Reply currentUserReply();
+    RequestCoalescer::Reply currentUserUuidReply();
+    void writeUuid(uint uid, MetricsScope *scope);
+    uint activeUser();
+    DelayedReply delayReply(MetricsScope *scope);
+    void sendErrorReply(const QString &name, const QString &msg = QString()) const;
+    void sendErrorReply(QDBusError::ErrorType type, const QString &msg = QString()) const;
     bool checkAccessRights(uint uid_to_modify);
     uid_t checkCallerUid();
     bool checkIsPermissionGroup(const QStringList &groups);
-    void updateEnvironment(uint uid);
-    void initSystemdManager();
-
-    QTimer *m_exitTimer;
-    LibUserHelper *m_lu;
-    uid_t m_switchUser;
-    uid_t m_currentUid;
-    SystemdManager *m_systemd;
+    void updateEnvironment(Seat *seat, uint uid);
+    void initSystemdManager(Seat *seat);
+    void switchFailed(Seat *seat, uint uid);
+    void reportCurrentUser(Seat *seat, uint uid);
+
+    IdlePolicy *m_idle;
+    AccountLanes *m_lanes;
+    UserNameIndex *m_names;
+    UidAllocator *m_uids;
+    int m_maxUsers;
+    bool m_sequentialUserCreation;
+    RequestCoalescer *m_coalescer;
+    QHash<QString, Seat *> m_seats;
+    Seat *m_primarySeat;
+    QHash<uint, Job *> m_jobs;
+    uint m_lastJobId;
+    QuotaMonitor *m_quotaMonitor;
+    QTimer *m_propertiesTimer;
+    QVariantMap m_publishedProperties;
+    quint64 m_snapshotGeneration;
+    AccountWatcher *m_accountWatcher;
+    // Users as last signalled to clients
+    QHash<uint, SailfishUserManagerEntry> m_directory;
+    quint64 m_directoryGeneration;
 };
 
 #endif // SAILFISHUSERMANAGER_H
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#ifndef SAILFISHUSERMANAGERHOOK_H
+#define SAILFISHUSERMANAGERHOOK_H
+
+#include <QString>
+#include <QtPlugin>
+
+#define SailfishUserManagerHook_iid "org.sailfishos.usermanager.Hook/1.0"
+
+struct SailfishUserManagerHookEvent {
+    enum Type {
+        UserCreated,
+        UserRemoved,
+        PreSwitch
+    };
+
+    Type type;
+    // User that was created or removed, or the user that is switched to
+    uint uid;
+    // User that is switched from, only for PreSwitch
+    uint previousUid;
+    // Seat of PreSwitch, empty otherwise
+    QString seat;
+    // Milliseconds the daemon waits for the hook
+    int budget;
+};
+
+// Hook plugin interface. Plugins are loaded into the daemon from its hook
+// directory and called from worker threads, one event at a time per plugin.
+class SailfishUserManagerHook
+{
+public:
+    virtual ~SailfishUserManagerHook() {}
+
+    // Returns false if the hook failed, that is logged but does not stop the
+    // operation. The daemon stops waiting after event.budget milliseconds.
+    virtual bool handleEvent(const SailfishUserManagerHookEvent &event) = 0;
+};
+
+Q_DECLARE_INTERFACE(SailfishUserManagerHook, SailfishUserManagerHook_iid)
+
+#endif // SAILFISHUSERMANAGERHOOK_H
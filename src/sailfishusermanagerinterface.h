@@ -18,7 +18,8 @@
 #define SAILFISH_USERMANAGER_GUEST_UID 105000
 #define SAILFISH_USERMANAGER_GUEST_HOME "/home/sailfish_guest"
 
-// LUKS has eight slots but one slot is reserved for backup
+// LUKS has eight slots but one slot is reserved for backup. This is the
+// default, MaxUsers in /etc/user-managerd.conf overrides it.
 #define SAILFISH_USERMANAGER_MAX_USERS 7
 
 #define SailfishUserManagerErrorBusy "org.sailfishos.usermanager.Error.Busy"
@@ -34,6 +35,9 @@
 #define SailfishUserManagerErrorUserNotFound "org.sailfishos.usermanager.Error.UserNotFound"
 #define SailfishUserManagerErrorAddToGroupFailed "org.sailfishos.usermanager.Error.AddToGroupFailed"
 #define SailfishUserManagerErrorRemoveFromGroupFailed "org.sailfishos.usermanager.Error.RemoveFromGroupFailed"
+#define SailfishUserManagerErrorCancelled "org.sailfishos.usermanager.Error.Cancelled"
+#define SailfishUserManagerErrorJobNotCancellable "org.sailfishos.usermanager.Error.JobNotCancellable"
+#define SailfishUserManagerErrorRateLimited "org.sailfishos.usermanager.Error.RateLimited"
 
 struct SailfishUserManagerEntry {
     QString user;
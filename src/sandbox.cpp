@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#include "sandbox.h"
+#include "logging.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+namespace {
+const char *LIBUSER_CONF_VARIABLE = "LIBUSER_CONF";
+
+// Account files are in etc, import is pointed there too so that the host's
+// login.defs does not leak into defaults
+const char *LIBUSER_CONF =
+        "[import]\n"
+        "login_defs = %1/etc/login.defs\n"
+        "default_useradd = %1/etc/default/useradd\n"
+        "\n"
+        "[defaults]\n"
+        "modules = files shadow\n"
+        "create_modules = files shadow\n"
+        "crypt_style = sha512\n"
+        "\n"
+        "[userdefaults]\n"
+        "LU_USERNAME = %n\n"
+        "LU_GIDNUMBER = %u\n"
+        "LU_HOMEDIRECTORY = %1/home/%n\n"
+        "LU_LOGINSHELL = /bin/sh\n"
+        "\n"
+        "[groupdefaults]\n"
+        "LU_GROUPNAME = %n\n"
+        "\n"
+        "[files]\n"
+        "directory = %1/etc\n"
+        "\n"
+        "[shadow]\n"
+        "directory = %1/etc\n";
+}
+
+QString Sandbox::s_root;
+
+/*
+ * Prepares sandbox at root, missing directories and files are created with
+ * minimal contents. Existing files are kept so that caller can seed them.
+ */
+bool Sandbox::setup(const QString &root)
+{
+    QDir dir(root);
+    if (!dir.mkpath(QStringLiteral("."))) {
+        qCCritical(lcSUM) << "Could not create sandbox at" << root;
+        return false;
+    }
+    s_root = dir.absolutePath();
+
+    const QStringList dirs = QStringList()
+            << QStringLiteral("/etc/skel")
+            << QStringLiteral("/home/.system/var/lib/environment")
+            << QStringLiteral("/usr/share/sailfish-setup")
+            << QStringLiteral("/usr/share/user-managerd/create.d")
+            << QStringLiteral("/usr/share/user-managerd/remove.d")
+            << QStringLiteral("/usr/share/user-managerd/pre-switch.d");
+    for (const QString &path : dirs) {
+        if (!dir.mkpath(s_root + path)) {
+            qCCritical(lcSUM) << "Could not create" << s_root + path;
+            return false;
+        }
+    }
+
+    const QByteArray libuserConf = QByteArray(LIBUSER_CONF).replace("%1", QFile::encodeName(s_root));
+    if (!writeFile(s_root + QStringLiteral("/etc/libuser.conf"), libuserConf)
+            || !writeFile(s_root + QStringLiteral("/etc/passwd"), "root:x:0:0:root:/root:/bin/sh\n")
+            || !writeFile(s_root + QStringLiteral("/etc/shadow"), "root:*:0:0:99999:7:::\n")
+            || !writeFile(s_root + QStringLiteral("/etc/group"), "root:x:0:\nusers:x:100:\n")
+            || !writeFile(s_root + QStringLiteral("/etc/gshadow"), "root:*::\nusers:*::\n")
+            || !writeFile(s_root + QStringLiteral("/usr/share/sailfish-setup/group_ids.env"), "USER_GROUPS=\n"))
+        return false;
+
+    qputenv(LIBUSER_CONF_VARIABLE, QFile::encodeName(s_root + QStringLiteral("/etc/libuser.conf")));
+    qCDebug(lcSUM) << "Running in sandbox at" << s_root;
+    return true;
+}
+
+bool Sandbox::enabled()
+{
+    return !s_root.isEmpty();
+}
+
+QString Sandbox::root()
+{
+    return s_root;
+}
+
+QString Sandbox::path(const QString &systemPath)
+{
+    return s_root.isEmpty() ? systemPath : s_root + systemPath;
+}
+
+QDBusConnection Sandbox::bus()
+{
+    return s_root.isEmpty() ? QDBusConnection::systemBus() : QDBusConnection::sessionBus();
+}
+
+// Writes file only if it does not exist
+bool Sandbox::writeFile(const QString &path, const QByteArray &contents)
+{
+    if (QFileInfo::exists(path))
+        return true;
+
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(contents) != contents.size()) {
+        qCCritical(lcSUM) << "Could not write" << path;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#ifndef SANDBOX_H
+#define SANDBOX_H
+
+#include <QDBusConnection>
+#include <QString>
+
+// Sandbox mode runs the daemon without root for load testing. System paths
+// are mapped under the sandbox root, libuser is configured to use account
+// files there, service is registered on the session bus and operations that
+// need root such as ownership changes and quota are skipped. User switching
+// is not supported in sandbox.
+class Sandbox
+{
+public:
+    static bool setup(const QString &root);
+    static bool enabled();
+    static QString root();
+    static QString path(const QString &systemPath);
+    static QDBusConnection bus();
+
+private:
+    static bool writeFile(const QString &path, const QByteArray &contents);
+
+    static QString s_root;
+};
+
+#endif // SANDBOX_H
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#include "seatmonitor.h"
+#include "flightrecorder.h"
+#include "logging.h"
+
+#include <QSocketNotifier>
+#include <sailfishaccesscontrol.h>
+#include <stdlib.h>
+#include <string.h>
+#include <systemd/sd-login.h>
+
+SeatMonitor::SeatMonitor(const QString &seat, QObject *parent)
+    : QObject(parent)
+    , m_seat(seat)
+    , m_monitor(nullptr)
+    , m_notifier(nullptr)
+    , m_activeUser(SAILFISH_UNDEFINED_UID)
+{
+    int ret = sd_login_monitor_new("seat", &m_monitor);
+    if (ret < 0) {
+        qCWarning(lcSUM) << "Could not monitor seats, reading active user on demand:" << strerror(-ret);
+        m_monitor = nullptr;
+    } else {
+        m_notifier = new QSocketNotifier(sd_login_monitor_get_fd(m_monitor), QSocketNotifier::Read, this);
+        connect(m_notifier, &QSocketNotifier::activated, this, &SeatMonitor::onActivated);
+    }
+    refresh();
+}
+
+SeatMonitor::~SeatMonitor()
+{
+    delete m_notifier;
+    m_notifier = nullptr;
+    if (m_monitor)
+        sd_login_monitor_unref(m_monitor);
+    m_monitor = nullptr;
+}
+
+QString SeatMonitor::seat() const
+{
+    return m_seat;
+}
+
+// Returns SAILFISH_UNDEFINED_UID if seat has no active user
+uint SeatMonitor::activeUser()
+{
+    if (!m_monitor)
+        refresh();
+    return m_activeUser;
+}
+
+QStringList SeatMonitor::seats()
+{
+    QStringList rv;
+    char **seats = nullptr;
+    int count = sd_get_seats(&seats);
+    if (count < 0) {
+        qCWarning(lcSUM) << "Could not get seats:" << strerror(-count);
+        return rv;
+    }
+    for (int i = 0; i < count; ++i) {
+        rv.append(QString::fromUtf8(seats[i]));
+        free(seats[i]);
+    }
+    free(seats);
+    return rv;
+}
+
+void SeatMonitor::refresh()
+{
+    uid_t uid;
+    uint activeUser = SAILFISH_UNDEFINED_UID;
+    if (sd_seat_get_active(m_seat.toUtf8().constData(), nullptr, &uid) >= 0)
+        activeUser = uid;
+
+    if (activeUser != m_activeUser) {
+        qCDebug(lcSUM) << "Active user of" << m_seat << "changed from" << m_activeUser << "to" << activeUser;
+        m_activeUser = activeUser;
+        FlightRecorder::record("seat.active", FlightRecorder::Event, activeUser);
+        emit activeUserChanged(activeUser);
+    }
+}
+
+void SeatMonitor::onActivated()
+{
+    sd_login_monitor_flush(m_monitor);
+    refresh();
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#ifndef SEATMONITOR_H
+#define SEATMONITOR_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+
+class QSocketNotifier;
+struct sd_login_monitor;
+
+// Keeps active user of a seat cached. Changes are read from logind through
+// sd_login_monitor on the event loop, so activeUser() is a memory read.
+class SeatMonitor : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit SeatMonitor(const QString &seat, QObject *parent = nullptr);
+    ~SeatMonitor();
+
+    QString seat() const;
+    uint activeUser();
+
+    static QStringList seats();
+
+public slots:
+    void refresh();
+
+signals:
+    void activeUserChanged(uint uid);
+
+private slots:
+    void onActivated();
+
+private:
+    QString m_seat;
+    sd_login_monitor *m_monitor;
+    QSocketNotifier *m_notifier;
+    uint m_activeUser;
+};
+
+#endif // SEATMONITOR_H
@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#include "snapshotwriter.h"
+#include "accountreader.h"
+#include "logging.h"
+#include "usersnapshot.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QSet>
+#include <QVector>
+
+#include <string.h>
+#include <sys/stat.h>
+
+namespace {
+
+const int MIN_INDEX_SIZE = 8;
+
+// Strings are deduplicated, group member names repeat a lot
+class StringTable
+{
+public:
+    quint32 add(const QString &string)
+    {
+        const QByteArray bytes = string.toUtf8();
+        auto it = m_offsets.constFind(bytes);
+        if (it != m_offsets.constEnd())
+            return *it;
+
+        quint32 offset = m_strings.size();
+        m_strings.append(bytes);
+        m_strings.append('\0');
+        m_offsets.insert(bytes, offset);
+        return offset;
+    }
+
+    const char *at(quint32 offset) const { return m_strings.constData() + offset; }
+    const QByteArray &data() const { return m_strings; }
+
+private:
+    QByteArray m_strings;
+    QHash<QByteArray, quint32> m_offsets;
+};
+
+// Adds index to an open addressing table, keeps the first of duplicates
+template<typename Equal>
+void insertIndex(QVector<quint32> *table, quint32 hash, quint32 index, Equal equal)
+{
+    const quint32 mask = table->size() - 1;
+    for (quint32 slot = hash & mask;; slot = (slot + 1) & mask) {
+        quint32 &entry = (*table)[slot];
+        if (entry == USER_SNAPSHOT_NONE) {
+            entry = index;
+            return;
+        }
+        if (equal(entry))
+            return;
+    }
+}
+
+void append(QByteArray *image, const void *data, int length)
+{
+    image->append(static_cast<const char *>(data), length);
+}
+
+} // namespace
+
+SnapshotWriter::SnapshotWriter(const AccountReader *accounts, const QString &passwdPath, const QString &groupPath,
+                               uint first, uint last) :
+    m_accounts(accounts),
+    m_passwdPath(passwdPath),
+    m_groupPath(groupPath),
+    m_first(first),
+    m_last(last)
+{
+}
+
+bool SnapshotWriter::source(const QString &path, struct user_snapshot_source *source)
+{
+    struct stat info;
+    if (stat(QFile::encodeName(path).constData(), &info) < 0)
+        return false;
+
+    source->device = info.st_dev;
+    source->inode = info.st_ino;
+    source->size = info.st_size;
+    source->mtime_sec = info.st_mtim.tv_sec;
+    source->mtime_nsec = info.st_mtim.tv_nsec;
+    return true;
+}
+
+/*
+ * Builds the snapshot and replaces the file at path with it. Returns false
+ * without writing if account files changed while the snapshot was built.
+ */
+bool SnapshotWriter::write(const QString &path, const QHash<uint, QString> &uuids)
+{
+    struct user_snapshot_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = USER_SNAPSHOT_MAGIC;
+    header.version = USER_SNAPSHOT_VERSION;
+    if (!source(m_passwdPath, &header.passwd) || !source(m_groupPath, &header.group)) {
+        qCWarning(lcSUM) << "Can not write user snapshot, account files are missing";
+        return false;
+    }
+    if (!m_accounts->isCurrent()) {
+        // Sources must describe the files the accounts were read from
+        qCDebug(lcSUM) << "Account files changed, user snapshot not written";
+        return false;
+    }
+    header.generation = m_accounts->generation();
+
+    StringTable strings;
+    QVector<quint32> lists;
+
+    QVector<struct user_snapshot_group> groups;
+    QHash<QString, quint32> groupIndexes;
+    for (const QString &name : m_accounts->groupNames()) {
+        struct user_snapshot_group group;
+        if (groupIndexes.contains(name) || !m_accounts->findGroup(name, &group.gid))
+            continue;
+        group.name = strings.add(name);
+        group.members = lists.size();
+        const QStringList members = m_accounts->groupMembers(name);
+        for (const QString &member : members)
+            lists.append(strings.add(member));
+        group.member_count = members.size();
+        groupIndexes.insert(name, groups.size());
+        groups.append(group);
+    }
+
+    QVector<struct user_snapshot_user> users;
+    QSet<uint> seen;
+    for (uint uid : m_accounts->userIds()) {
+        AccountReader::User pw;
+        if (uid < m_first || uid > m_last || seen.contains(uid) || !m_accounts->findUser(uid, &pw))
+            continue;
+        seen.insert(uid);
+
+        struct user_snapshot_user user;
+        user.uid = pw.uid;
+        user.gid = pw.gid;
+        user.name = strings.add(pw.name);
+        user.gecos = strings.add(pw.gecos);
+        user.home = strings.add(pw.home);
+        user.shell = strings.add(pw.shell);
+        user.uuid = strings.add(uuids.value(uid));
+        user.groups = lists.size();
+        user.group_count = 0;
+        for (const QString &group : m_accounts->groupsOfUser(pw.name)) {
+            auto it = groupIndexes.constFind(group);
+            if (it != groupIndexes.constEnd()) {
+                lists.append(*it);
+                user.group_count++;
+            }
+        }
+        users.append(user);
+    }
+
+    int indexSize = MIN_INDEX_SIZE;
+    while (indexSize < 2 * qMax(users.size(), groups.size()))
+        indexSize *= 2;
+    QVector<quint32> usersByUid(indexSize, USER_SNAPSHOT_NONE);
+    QVector<quint32> usersByName(indexSize, USER_SNAPSHOT_NONE);
+    QVector<quint32> groupsByGid(indexSize, USER_SNAPSHOT_NONE);
+    QVector<quint32> groupsByName(indexSize, USER_SNAPSHOT_NONE);
+    for (int i = 0; i < users.size(); i++) {
+        const struct user_snapshot_user &user = users.at(i);
+        insertIndex(&usersByUid, user_snapshot_hash_id(user.uid), i, [&](quint32 other) {
+            return users.at(other).uid == user.uid;
+        });
+        insertIndex(&usersByName, user_snapshot_hash_name(strings.at(user.name)), i, [&](quint32 other) {
+            return users.at(other).name == user.name;
+        });
+    }
+    for (int i = 0; i < groups.size(); i++) {
+        const struct user_snapshot_group &group = groups.at(i);
+        insertIndex(&groupsByGid, user_snapshot_hash_id(group.gid), i, [&](quint32 other) {
+            return groups.at(other).gid == group.gid;
+        });
+        insertIndex(&groupsByName, user_snapshot_hash_name(strings.at(group.name)), i, [&](quint32 other) {
+            return groups.at(other).name == group.name;
+        });
+    }
+
+    // Sections follow the header in this order, all are 4 byte aligned
+    const int indexBytes = indexSize * sizeof(quint32);
+    header.user_count = users.size();
+    header.group_count = groups.size();
+    header.list_count = lists.size();
+    header.index_size = indexSize;
+    header.users = sizeof(header);
+    header.groups = header.users + users.size() * sizeof(struct user_snapshot_user);
+    header.lists = header.groups + groups.size() * sizeof(struct user_snapshot_group);
+    header.users_by_uid = header.lists + lists.size() * sizeof(quint32);
+    header.users_by_name = header.users_by_uid + indexBytes;
+    header.groups_by_gid = header.users_by_name + indexBytes;
+    header.groups_by_name = header.groups_by_gid + indexBytes;
+    header.strings = header.groups_by_name + indexBytes;
+    header.strings_size = strings.data().size();
+    header.size = header.strings + header.strings_size;
+
+    QByteArray image;
+    image.reserve(header.size);
+    append(&image, &header, sizeof(header));
+    append(&image, users.constData(), users.size() * sizeof(struct user_snapshot_user));
+    append(&image, groups.constData(), groups.size() * sizeof(struct user_snapshot_group));
+    append(&image, lists.constData(), lists.size() * sizeof(quint32));
+    append(&image, usersByUid.constData(), indexBytes);
+    append(&image, usersByName.constData(), indexBytes);
+    append(&image, groupsByGid.constData(), indexBytes);
+    append(&image, groupsByName.constData(), indexBytes);
+    image.append(strings.data());
+
+    struct user_snapshot_header *written = reinterpret_cast<struct user_snapshot_header *>(image.data());
+    written->checksum = user_snapshot_hash_bytes(2166136261u, image.constData() + sizeof(header),
+                                                 image.size() - sizeof(header));
+
+    // Readers would reject a snapshot of files that changed meanwhile
+    struct user_snapshot_source passwd;
+    struct user_snapshot_source group;
+    if (!source(m_passwdPath, &passwd) || !source(m_groupPath, &group)
+            || memcmp(&passwd, &header.passwd, sizeof(passwd)) != 0
+            || memcmp(&group, &header.group, sizeof(group)) != 0) {
+        qCDebug(lcSUM) << "Account files changed while writing user snapshot";
+        return false;
+    }
+
+    // Directory may have been created by someone else, unprivileged NSS
+    // readers must be able to enter it
+    const QString directory = QFileInfo(path).path();
+    if (!QDir().mkpath(directory) || chmod(QFile::encodeName(directory).constData(), 0755) < 0) {
+        qCWarning(lcSUM) << "Can not create user snapshot directory" << directory;
+        return false;
+    }
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)
+            || !file.setPermissions(QFileDevice::ReadOwner | QFileDevice::WriteOwner
+                                    | QFileDevice::ReadGroup | QFileDevice::ReadOther)
+            || file.write(image) != image.size()
+            || !file.commit()) {
+        qCWarning(lcSUM) << "Can not write user snapshot:" << file.errorString();
+        return false;
+    }
+
+    qCDebug(lcSUM) << "Wrote user snapshot of" << users.size() << "users and" << groups.size()
+                   << "groups, generation" << header.generation;
+    return true;
+}
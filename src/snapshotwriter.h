@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#ifndef SNAPSHOTWRITER_H
+#define SNAPSHOTWRITER_H
+
+#include <QHash>
+#include <QString>
+
+class AccountReader;
+struct user_snapshot_source;
+
+// Writes the memory-mappable user snapshot described in usersnapshot.h from
+// the account databases. Users with uid in [first, last] are included, with
+// their UUIDs if given, and all groups.
+class SnapshotWriter
+{
+public:
+    SnapshotWriter(const AccountReader *accounts, const QString &passwdPath, const QString &groupPath,
+                   uint first, uint last);
+
+    bool write(const QString &path, const QHash<uint, QString> &uuids);
+
+private:
+    static bool source(const QString &path, struct user_snapshot_source *source);
+
+    const AccountReader *m_accounts;
+    QString m_passwdPath;
+    QString m_groupPath;
+    uint m_first;
+    uint m_last;
+};
+
+#endif // SNAPSHOTWRITER_H
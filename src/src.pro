@@ -2,7 +2,7 @@ TEMPLATE = app
 TARGET = user-managerd
 
 QT -= gui
-QT += dbus
+QT += dbus concurrent
 
 CONFIG += c++11 console link_pkgconfig
 CONFIG -= app_bundle
@@ -23,34 +23,92 @@ DEFINES += QT_DEPRECATED_WARNINGS
 
 PKGCONFIG += libuser glib-2.0 sailfishaccesscontrol libsystemd mce-qt5
 
+# Removing directory trees batches unlinks through io_uring when available
+packagesExist(liburing) {
+    PKGCONFIG += liburing
+    DEFINES += HAVE_LIBURING
+}
+
+# Hook plugins are loaded from here
+HOOK_PLUGIN_DIR = $$[QT_INSTALL_LIBS]/user-managerd/hooks
+DEFINES += HOOK_PLUGIN_DIR=\\\"$$HOOK_PLUGIN_DIR\\\"
+
 DBUS_SERVICE_NAME = org.sailfishos.usermanager
 dbus_interface.files = $${DBUS_SERVICE_NAME}.xml
 dbus_interface.header_flags = -i sailfishusermanagerinterface.h
 
-DBUS_ADAPTORS += dbus_interface
+debug_interface.files = $${DBUS_SERVICE_NAME}.Debug.xml
+
+job_interface.files = $${DBUS_SERVICE_NAME}.Job.xml
+
+DBUS_ADAPTORS += dbus_interface debug_interface job_interface
 
 SOURCES += \
+    accountlanes.cpp \
+    accountreader.cpp \
+    accountwatcher.cpp \
+    admission.cpp \
+    config.cpp \
+    debuginterface.cpp \
+    filetree.cpp \
+    flightrecorder.cpp \
+    hookrunner.cpp \
+    idlepolicy.cpp \
+    job.cpp \
     libuserhelper.cpp \
+    metrics.cpp \
+    quotamonitor.cpp \
+    requestcoalescer.cpp \
+    seatmonitor.cpp \
+    snapshotwriter.cpp \
     systemdmanager.cpp \
+    tracer.cpp \
+    uidallocator.cpp \
+    usernameindex.cpp \
     logging.cpp \
     main.cpp \
-    sailfishusermanager.cpp
+    sailfishusermanager.cpp \
+    sandbox.cpp
 
 HEADERS += \
+    accountlanes.h \
+    accountreader.h \
+    accountwatcher.h \
+    admission.h \
+    config.h \
+    debuginterface.h \
+    filetree.h \
+    flightrecorder.h \
+    hookrunner.h \
+    idlepolicy.h \
+    job.h \
     libuserhelper.h \
+    metrics.h \
+    quotamonitor.h \
+    requestcoalescer.h \
+    seatmonitor.h \
+    snapshotwriter.h \
     systemdmanager.h \
+    tracer.h \
+    uidallocator.h \
+    usernameindex.h \
+    usersnapshot.h \
     logging.h \
     sailfishusermanager.h \
-    sailfishusermanagerinterface.h
+    sailfishusermanagerhook.h \
+    sailfishusermanagerinterface.h \
+    sandbox.h
 
 DISTFILES += \
     sailfishusermanager.pc.in \
     org.sailfishos.usermanager.xml \
+    org.sailfishos.usermanager.Debug.xml \
+    org.sailfishos.usermanager.Job.xml \
     userdel_local.sh
 
 target.path = /usr/bin/
 
-include.files = sailfishusermanagerinterface.h $${DBUS_SERVICE_NAME}.xml
+include.files = sailfishusermanagerinterface.h sailfishusermanagerhook.h $${DBUS_SERVICE_NAME}.xml
 include.path = /usr/include/sailfishusermanager
 
 pkgconfig.files = sailfishusermanager.pc
@@ -58,7 +116,7 @@ pkgconfig.path = $$[QT_INSTALL_LIBS]/pkgconfig
 pkgconfig.CONFIG = no_check_exist
 pkgconfig.commands = $$QMAKE_STREAM_EDITOR \
     -e 's~@VERSION@~$$VERSION~g' \
-    -e 's~@LIBDIR@~$${QT_INSTALL_LIBS}~g' \
+    -e 's~@LIBDIR@~$$[QT_INSTALL_LIBS]~g' \
     -e 's~@INCLUDEDIR@~$${include.path}~g' \
     sailfishusermanager.pc.in > sailfishusermanager.pc
 
@@ -7,11 +7,16 @@
  */
 
 #include "systemdmanager.h"
+#include "flightrecorder.h"
 #include "logging.h"
+#include "metrics.h"
+#include "tracer.h"
 #include <QDBusInterface>
+#include <QDBusMessage>
 #include <QDBusObjectPath>
 #include <QDBusPendingCall>
 #include <QDBusPendingReply>
+#include <QTimer>
 
 namespace Systemd {
 const auto Service = QStringLiteral("org.freedesktop.systemd1");
@@ -21,41 +26,119 @@ const auto Replace = QStringLiteral("replace");
 const auto Fail = QStringLiteral("fail");
 const auto StartUnit = QStringLiteral("StartUnit");
 const auto StopUnit = QStringLiteral("StopUnit");
+const auto Subscribe = QStringLiteral("Subscribe");
+const auto Unsubscribe = QStringLiteral("Unsubscribe");
+const auto JobRemoved = QStringLiteral("JobRemoved");
+const auto JobInterface = QStringLiteral("org.freedesktop.systemd1.Job");
+const auto Cancel = QStringLiteral("Cancel");
+const auto AlreadySubscribed = QStringLiteral("org.freedesktop.systemd1.AlreadySubscribed");
 const auto ResultDone = QStringLiteral("done");
 const auto ResultSkipped = QStringLiteral("skipped");
+// Not a systemd result, used for jobs that ran out of time
+const auto ResultTimeout = QStringLiteral("timeout");
+}
+
+namespace {
+const int DEFAULT_JOB_TIMEOUT = 30 * 1000;
 }
 
 // This is currently implemented so that it can do one thing at a time
 // as there is no need for anything more complicated.
 // It would be quite easily possible to add individual queues with
 // queue numbers if needed.
+//
+// Systemd emits job signals only while some client is subscribed, so the
+// daemon subscribes itself. JobRemoved is received only for the unit of the
+// current job by matching its name, not for every job on the system.
+
+int SystemdManager::s_subscribers = 0;
 
 SystemdManager::SystemdManager(QObject *parent) :
     QObject(parent),
     m_pendingCall(nullptr),
+    m_jobId(0),
     m_systemd(new QDBusInterface(Systemd::Service, Systemd::ManagerPath,
                                  Systemd::ManagerInterface,
-                                 QDBusConnection::systemBus(), this))
+                                 QDBusConnection::systemBus(), this)),
+    m_deadline(new QTimer(this))
 {
+    m_deadline->setSingleShot(true);
+    m_deadline->setInterval(DEFAULT_JOB_TIMEOUT);
+    connect(m_deadline, &QTimer::timeout, this, &SystemdManager::onDeadline);
+
     if (!m_systemd->isValid())
         qCCritical(lcSUM) << "Could not create interface to systemd, can not function!";
-    if (!connect(m_systemd, SIGNAL(JobRemoved(uint, QDBusObjectPath, QString, QString)),
-                 this, SLOT(onJobRemoved(uint, QDBusObjectPath, QString, QString))))
-        qCCritical(lcSUM) << "Could not connect to JobRemoved signal, can not function!";
+
+    // Subscription is per bus connection and shared by all seats
+    if (s_subscribers++ == 0) {
+        QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(m_systemd->asyncCall(Systemd::Subscribe), this);
+        connect(watcher, &QDBusPendingCallWatcher::finished, this, [](QDBusPendingCallWatcher *call) {
+            QDBusPendingReply<> reply = *call;
+            if (reply.isError() && reply.error().name() != Systemd::AlreadySubscribed)
+                qCCritical(lcSUM) << "Could not subscribe to systemd signals:" << reply.error();
+            call->deleteLater();
+        });
+    }
 }
 
 SystemdManager::~SystemdManager()
 {
+    if (!m_watchedUnit.isEmpty())
+        unwatchUnit();
+    // Systemd drops the subscription anyway when the daemon exits
+    if (--s_subscribers == 0)
+        m_systemd->asyncCall(Systemd::Unsubscribe);
     delete m_systemd;
     m_systemd = nullptr;
 }
 
+/*
+ * Starts receiving JobRemoved for jobs of unit. Called before the job is
+ * created so that its removal can not be missed.
+ */
+bool SystemdManager::watchUnit(const QString &unit)
+{
+    if (unit == m_watchedUnit)
+        return true;
+    if (!m_watchedUnit.isEmpty())
+        unwatchUnit();
+
+    if (!QDBusConnection::systemBus().connect(Systemd::Service, Systemd::ManagerPath, Systemd::ManagerInterface,
+                                              Systemd::JobRemoved, unitMatch(unit), QString(),
+                                              this, SLOT(onJobRemoved(uint, QDBusObjectPath, QString, QString)))) {
+        qCCritical(lcSUM) << "Could not connect to JobRemoved signal for" << unit;
+        return false;
+    }
+    m_watchedUnit = unit;
+    return true;
+}
+
+void SystemdManager::unwatchUnit()
+{
+    QDBusConnection::systemBus().disconnect(Systemd::Service, Systemd::ManagerPath, Systemd::ManagerInterface,
+                                            Systemd::JobRemoved, unitMatch(m_watchedUnit), QString(),
+                                            this, SLOT(onJobRemoved(uint, QDBusObjectPath, QString, QString)));
+    m_watchedUnit.clear();
+}
+
+// Match rule arguments of JobRemoved(id, job, unit, result) for unit
+QStringList SystemdManager::unitMatch(const QString &unit)
+{
+    return QStringList() << QString() << QString() << unit;
+}
+
 bool SystemdManager::busy()
 {
     // Busy if there is something on queue or a pending call or job removal is waited for
     return !m_jobs.isEmpty() || m_pendingCall || !m_currentJob.isEmpty();
 }
 
+// Time each job may take from the D-Bus call to its removal
+void SystemdManager::setJobTimeout(int msecs)
+{
+    m_deadline->setInterval(msecs);
+}
+
 void SystemdManager::addUnitJob(Job job)
 {
     addUnitJobs(JobList() << job);
@@ -78,20 +161,36 @@ void SystemdManager::processNextJob()
 
     qCDebug(lcSUM) << "Process next systemd job";
 
+    // Jobs of the same unit usually follow each other, the match is kept until another unit
+    watchUnit(m_jobs.first().unit);
+    m_jobTimer.start();
+    FlightRecorder::record(m_jobs.first().unit, FlightRecorder::Begin);
+    Tracer::instance()->asyncBegin(jobName(m_jobs.first()), ++m_jobId);
     QDBusPendingCall call = m_systemd->asyncCall(
             (m_jobs.first().type == StopJob) ? Systemd::StopUnit : Systemd::StartUnit,
             m_jobs.first().unit, (m_jobs.first().replace) ? Systemd::Replace : Systemd::Fail);
-    QDBusPendingCallWatcher *m_pendingCall = new QDBusPendingCallWatcher(call, this);
+    m_deadline->start();
+    m_pendingCall = new QDBusPendingCallWatcher(call, this);
     connect(m_pendingCall, &QDBusPendingCallWatcher::finished, this, &SystemdManager::pendingCallFinished);
 }
 
 void SystemdManager::pendingCallFinished(QDBusPendingCallWatcher *call)
 {
-    m_pendingCall = nullptr;
     QDBusPendingReply<QDBusObjectPath> reply = *call;
+    if (call != m_pendingCall) {
+        // Abandoned call, systemd may still have created the job
+        if (!reply.isError())
+            cancelJob(reply.value().path());
+        call->deleteLater();
+        return;
+    }
+
+    m_pendingCall = nullptr;
     if (reply.isError()) {
+        m_deadline->stop();
         // This basically means that the job didn't do anything yet
         qCWarning(lcSUM) << "Systemd job start failed" << reply.error();
+        recordJob(m_jobs.first(), reply.error().name());
         JobList remaining;
         remaining.swap(m_jobs);
         emit creatingJobFailed(remaining);
@@ -104,34 +203,115 @@ void SystemdManager::pendingCallFinished(QDBusPendingCallWatcher *call)
     call->deleteLater();
 }
 
+QString SystemdManager::jobName(const Job &job)
+{
+    return QStringLiteral("systemd.%1 %2")
+            .arg((job.type == StopJob) ? Systemd::StopUnit : Systemd::StartUnit, job.unit);
+}
+
+void SystemdManager::recordJob(const Job &job, const QString &error)
+{
+    // Covers the time from the D-Bus call to the job removal
+    Metrics::instance()->record((job.type == StopJob) ? QStringLiteral("systemd.StopUnit")
+                                                      : QStringLiteral("systemd.StartUnit"),
+                                m_jobTimer.nsecsElapsed(), error);
+    FlightRecorder::record(job.unit, error.isEmpty() ? FlightRecorder::End : FlightRecorder::Failed);
+    Tracer::instance()->asyncEnd(jobName(job), m_jobId, error);
+}
+
 void SystemdManager::onJobRemoved(uint id, QDBusObjectPath job, QString unit, QString result)
 {
     Q_UNUSED(id)
-    if (job.path() == m_currentJob) {
-        if (result != Systemd::ResultDone) {
-            // Uh, Houston, we've had a problem
-            qCWarning(lcSUM) << "Systemd" << ((m_jobs.first().type == StopJob) ? "stop" : "start") << "job"
-                             << job.path() << "for unit" << unit << "ended with result" << result;
-            m_currentJob.clear(); // Clear busyness before signal
-            JobList remaining;
-            remaining.swap(m_jobs);
-            if (result == Systemd::ResultSkipped) {
-                // This means that the job didn't do anything yet
-                emit creatingJobFailed(remaining);
-            } else {
-                Job failed = remaining.takeFirst();
-                emit unitJobFailed(failed, remaining);
-            }
+    // Counts wakeups, other jobs of the watched unit still arrive here
+    Metrics::instance()->record(QStringLiteral("systemd.JobRemoved"), 0,
+                                job.path() == m_currentJob ? QString() : QStringLiteral("OtherJob"));
+    if (job.path() == m_currentJob)
+        finishCurrentJob(unit, result);
+}
+
+// Ends the current job with systemd result and starts the next one if it was done
+void SystemdManager::finishCurrentJob(const QString &unit, const QString &result)
+{
+    m_deadline->stop();
+    if (result != Systemd::ResultDone) {
+        // Uh, Houston, we've had a problem
+        qCWarning(lcSUM) << "Systemd" << ((m_jobs.first().type == StopJob) ? "stop" : "start") << "job"
+                         << m_currentJob << "for unit" << unit << "ended with result" << result;
+        m_currentJob.clear(); // Clear busyness before signal
+        recordJob(m_jobs.first(), result);
+        JobList remaining;
+        remaining.swap(m_jobs);
+        if (result == Systemd::ResultSkipped) {
+            // This means that the job didn't do anything yet
+            emit creatingJobFailed(remaining);
         } else {
-            qCDebug(lcSUM) << "Systemd" << ((m_jobs.first().type == StopJob) ? "stop" : "start") << "job"
-                           << job.path() << "for unit" << unit << "ended with result" << result;
-            Job done = m_jobs.takeFirst();
-            emit unitJobFinished(done);
-            m_currentJob.clear(); // Clear busyness *after* signal
-            if (!m_jobs.isEmpty())
-                processNextJob();
+            Job failed = remaining.takeFirst();
+            emit unitJobFailed(failed, remaining);
         }
-        if (!busy()) // Check if we are busy still
+    } else {
+        qCDebug(lcSUM) << "Systemd" << ((m_jobs.first().type == StopJob) ? "stop" : "start") << "job"
+                       << m_currentJob << "for unit" << unit << "ended with result" << result;
+        Job done = m_jobs.takeFirst();
+        recordJob(done);
+        emit unitJobFinished(done);
+        m_currentJob.clear(); // Clear busyness *after* signal
+        if (!m_jobs.isEmpty())
+            processNextJob();
+    }
+    if (!busy()) // Check if we are busy still
+        emit busyChanged();
+}
+
+/*
+ * Current job ran out of time. A job that systemd has created is cancelled
+ * and fails as a unit job, a call that has not returned yet fails as if
+ * the job could not be created.
+ */
+void SystemdManager::onDeadline()
+{
+    if (!m_currentJob.isEmpty()) {
+        cancelJob(m_currentJob);
+        finishCurrentJob(m_jobs.first().unit, Systemd::ResultTimeout);
+    } else if (m_pendingCall) {
+        qCWarning(lcSUM) << "Systemd did not create job for unit" << m_jobs.first().unit << "in time";
+        m_pendingCall = nullptr; // Deleted when it finishes
+        recordJob(m_jobs.first(), Systemd::ResultTimeout);
+        JobList remaining;
+        remaining.swap(m_jobs);
+        emit creatingJobFailed(remaining);
+        if (!busy())
             emit busyChanged();
     }
 }
+
+/*
+ * Drops queued jobs and cancels the current one without reporting them,
+ * for callers that give up on what they queued.
+ */
+void SystemdManager::abort()
+{
+    if (!busy())
+        return;
+
+    qCWarning(lcSUM) << "Aborting" << m_jobs.count() << "systemd jobs";
+    m_deadline->stop();
+    if (!m_currentJob.isEmpty()) {
+        cancelJob(m_currentJob);
+        recordJob(m_jobs.first(), QStringLiteral("aborted"));
+        m_currentJob.clear();
+    } else if (m_pendingCall) {
+        recordJob(m_jobs.first(), QStringLiteral("aborted"));
+        m_pendingCall = nullptr; // Deleted when it finishes, the job is cancelled then
+    }
+    m_jobs.clear();
+    emit busyChanged();
+}
+
+// Removal of a cancelled job is not waited for
+void SystemdManager::cancelJob(const QString &path)
+{
+    qCDebug(lcSUM) << "Cancelling systemd job" << path;
+    QDBusConnection::systemBus().asyncCall(QDBusMessage::createMethodCall(Systemd::Service, path,
+                                                                          Systemd::JobInterface,
+                                                                          Systemd::Cancel));
+}
@@ -11,10 +11,13 @@
 
 #include <QObject>
 #include <QString>
+#include <QStringList>
 #include <QDBusObjectPath>
+#include <QElapsedTimer>
 
 class QDBusInterface;
 class QDBusPendingCallWatcher;
+class QTimer;
 
 class SystemdManager : public QObject
 {
@@ -46,8 +49,10 @@ public:
     typedef QList<Job> JobList;
 
     bool busy();
+    void setJobTimeout(int msecs);
     void addUnitJob(Job job);
     void addUnitJobs(JobList &jobs);
+    void abort();
 
 signals:
     void busyChanged();
@@ -58,14 +63,27 @@ signals:
 private slots:
     void pendingCallFinished(QDBusPendingCallWatcher *call);
     void onJobRemoved(uint id, QDBusObjectPath job, QString unit, QString result);
+    void onDeadline();
 
 private:
     void processNextJob();
+    void finishCurrentJob(const QString &unit, const QString &result);
+    static void cancelJob(const QString &path);
+    bool watchUnit(const QString &unit);
+    void unwatchUnit();
+    static QStringList unitMatch(const QString &unit);
+    static QString jobName(const Job &job);
+    void recordJob(const Job &job, const QString &error = QString());
 
     QDBusPendingCallWatcher *m_pendingCall;
     JobList m_jobs;
     QString m_currentJob;
+    QElapsedTimer m_jobTimer;
+    quint64 m_jobId;
     QDBusInterface *m_systemd;
+    QTimer *m_deadline;
+    QString m_watchedUnit;
+    static int s_subscribers;
 };
 
 #endif // SYSTEMDMANAGER_H
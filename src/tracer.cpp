@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#include "tracer.h"
+#include "logging.h"
+
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace {
+
+const char *TRACE_ENVIRONMENT_VARIABLE = "USER_MANAGERD_TRACE";
+
+qint64 threadId()
+{
+    static thread_local qint64 tid = syscall(SYS_gettid);
+    return tid;
+}
+
+QString category(const QString &name)
+{
+    int dot = name.indexOf('.');
+    return dot > 0 ? name.left(dot) : QStringLiteral("default");
+}
+
+QString escape(QString value)
+{
+    value.replace('\\', QLatin1String("\\\\"));
+    value.replace('"', QLatin1String("\\\""));
+    value.replace('\n', QLatin1String("\\n"));
+    return value;
+}
+
+} // namespace
+
+Tracer::Tracer() :
+    m_enabled(false),
+    m_first(true)
+{
+    QByteArray path = qgetenv(TRACE_ENVIRONMENT_VARIABLE);
+    if (!path.isEmpty())
+        start(QString::fromLocal8Bit(path));
+}
+
+Tracer::~Tracer()
+{
+    stop();
+}
+
+Tracer *Tracer::instance()
+{
+    static Tracer tracer;
+    return &tracer;
+}
+
+// Microseconds on monotonic clock
+qint64 Tracer::timestamp()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return qint64(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+bool Tracer::start(const QString &path)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_file.isOpen()) {
+        qCWarning(lcSUM) << "Already tracing to" << m_file.fileName();
+        return false;
+    }
+
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qCWarning(lcSUM) << "Could not open trace file" << path << m_file.errorString();
+        return false;
+    }
+
+    m_file.write("[\n");
+    m_first = true;
+    m_enabled.store(true);
+    qCDebug(lcSUM) << "Tracing to" << path;
+    return true;
+}
+
+void Tracer::stop()
+{
+    QMutexLocker locker(&m_mutex);
+    m_enabled.store(false);
+    if (m_file.isOpen()) {
+        m_file.write("\n]\n");
+        m_file.close();
+    }
+}
+
+void Tracer::write(const QString &name, char phase, qint64 timestamp, const QString &extra)
+{
+    QString event = QLatin1String("{\"name\":\"") + escape(name)
+            + QLatin1String("\",\"cat\":\"") + escape(category(name))
+            + QLatin1String("\",\"ph\":\"") + QLatin1Char(phase)
+            + QLatin1String("\",\"ts\":") + QString::number(timestamp)
+            + QLatin1String(",\"pid\":") + QString::number(getpid())
+            + QLatin1String(",\"tid\":") + QString::number(threadId())
+            + extra + QLatin1Char('}');
+
+    QMutexLocker locker(&m_mutex);
+    if (!m_file.isOpen())
+        return;
+    if (!m_first)
+        m_file.write(",\n");
+    m_first = false;
+    m_file.write(event.toUtf8());
+    m_file.flush();
+}
+
+void Tracer::complete(const QString &name, qint64 start, qint64 duration, const QString &error)
+{
+    if (!enabled())
+        return;
+
+    QString extra = QLatin1String(",\"dur\":") + QString::number(duration);
+    if (!error.isEmpty())
+        extra += QLatin1String(",\"args\":{\"error\":\"") + escape(error) + QLatin1String("\"}");
+    write(name, 'X', start, extra);
+}
+
+void Tracer::asyncBegin(const QString &name, quint64 id)
+{
+    if (!enabled())
+        return;
+
+    write(name, 'b', timestamp(), QLatin1String(",\"id\":") + QString::number(id));
+}
+
+void Tracer::asyncEnd(const QString &name, quint64 id, const QString &result)
+{
+    if (!enabled())
+        return;
+
+    QString extra = QLatin1String(",\"id\":") + QString::number(id);
+    if (!result.isEmpty())
+        extra += QLatin1String(",\"args\":{\"result\":\"") + escape(result) + QLatin1String("\"}");
+    write(name, 'e', timestamp(), extra);
+}
+
+TraceScope::TraceScope(const QString &name) :
+    m_start(-1)
+{
+    if (Tracer::instance()->enabled()) {
+        m_name = name;
+        m_start = Tracer::timestamp();
+    }
+}
+
+TraceScope::TraceScope(const QString &name, const QString &detail) :
+    m_start(-1)
+{
+    if (Tracer::instance()->enabled()) {
+        m_name = name + QLatin1Char(' ') + detail;
+        m_start = Tracer::timestamp();
+    }
+}
+
+TraceScope::~TraceScope()
+{
+    if (m_start >= 0)
+        Tracer::instance()->complete(m_name, m_start, Tracer::timestamp() - m_start);
+}
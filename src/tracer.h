@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <QFile>
+#include <QMutex>
+#include <QString>
+
+#include <atomic>
+
+// Writes Trace Event Format JSON that can be loaded to chrome://tracing or
+// Perfetto. Disabled by default, enabled with USER_MANAGERD_TRACE environment
+// variable pointing to output file or over the debug D-Bus interface.
+class Tracer
+{
+public:
+    static Tracer *instance();
+    static qint64 timestamp();
+
+    bool start(const QString &path);
+    void stop();
+    bool enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+    void complete(const QString &name, qint64 start, qint64 duration, const QString &error = QString());
+    void asyncBegin(const QString &name, quint64 id);
+    void asyncEnd(const QString &name, quint64 id, const QString &result = QString());
+
+private:
+    Tracer();
+    ~Tracer();
+
+    void write(const QString &name, char phase, qint64 timestamp, const QString &extra);
+
+    std::atomic<bool> m_enabled;
+    QMutex m_mutex;
+    QFile m_file;
+    bool m_first;
+};
+
+// Records a complete event for its lifetime, if tracing is enabled. Name
+// and detail are joined only then.
+class TraceScope
+{
+public:
+    explicit TraceScope(const QString &name);
+    TraceScope(const QString &name, const QString &detail);
+    ~TraceScope();
+
+private:
+    Q_DISABLE_COPY(TraceScope)
+
+    QString m_name;
+    qint64 m_start;
+};
+
+#endif // TRACER_H
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#include "uidallocator.h"
+#include "accountlanes.h"
+#include "logging.h"
+
+namespace {
+const int WORD_BITS = 64;
+const quint64 ALL_BITS = ~quint64(0);
+}
+
+UidAllocator::UidAllocator(const AccountLanes *lanes, uint first, uint last) :
+    m_lanes(lanes),
+    m_first(first),
+    m_last(last),
+    m_generation(0),
+    m_next(0)
+{
+    Q_ASSERT(first > 0 && first <= last);
+}
+
+// Marks id as never to be allocated, e.g. guest user's uid
+void UidAllocator::reserve(uint id)
+{
+    if (id < m_first || id > m_last || m_reserved.contains(id))
+        return;
+
+    m_reserved.append(id);
+    if (!m_used.isEmpty())
+        set(id - m_first);
+}
+
+// Returns 0 if all ids are taken
+uint UidAllocator::allocate()
+{
+    refresh();
+
+    int word = findWord(m_next / WORD_BITS);
+    if (word < 0)
+        word = findWord(0);
+    if (word < 0)
+        return 0;
+
+    const int index = word * WORD_BITS + __builtin_ctzll(~m_used.at(word));
+    set(index);
+    m_pending.append(m_first + index);
+    m_next = index + 1 < int(m_last - m_first + 1) ? index + 1 : 0;
+    return m_first + index;
+}
+
+// Id was written to account databases
+void UidAllocator::commit(uint id)
+{
+    m_pending.removeOne(id);
+}
+
+// Returns id that was not taken into use after all
+void UidAllocator::release(uint id)
+{
+    if (!m_pending.removeOne(id) || m_used.isEmpty())
+        return;
+
+    clear(id - m_first);
+    // Failed write may have left a group with the id behind
+    m_generation = 0;
+}
+
+// Frees the bitmaps, they are rebuilt on next allocation
+void UidAllocator::squeeze()
+{
+    m_used.clear();
+    m_used.squeeze();
+    m_full.clear();
+    m_full.squeeze();
+}
+
+void UidAllocator::refresh()
+{
+    const AccountLanes::Snapshot accounts = m_lanes->snapshot();
+    if (!m_used.isEmpty() && (m_generation == accounts->generation()
+                              || m_lanes->written(m_generation, accounts->generation()))) {
+        // Ids of own writes are set already, ids of removed users stay taken until next rebuild
+        m_generation = accounts->generation();
+        return;
+    }
+
+    qCDebug(lcSUM) << "Rebuilding uid allocation bitmap";
+    const int count = m_last - m_first + 1;
+    const int words = (count + WORD_BITS - 1) / WORD_BITS;
+    m_used.fill(0, words);
+    m_full.fill(0, (words + WORD_BITS - 1) / WORD_BITS);
+
+    // Bits past the last id are never free
+    for (int index = count; index < words * WORD_BITS; index++)
+        set(index);
+
+    for (uint id : accounts->userIds()) {
+        if (id >= m_first && id <= m_last)
+            set(id - m_first);
+    }
+
+    for (uint id : accounts->groupIds()) {
+        if (id >= m_first && id <= m_last)
+            set(id - m_first);
+    }
+
+    for (uint id : m_reserved)
+        set(id - m_first);
+
+    for (uint id : m_pending)
+        set(id - m_first);
+
+    m_generation = accounts->generation();
+}
+
+void UidAllocator::set(int index)
+{
+    const int word = index / WORD_BITS;
+    quint64 &bits = m_used[word];
+    bits |= quint64(1) << (index % WORD_BITS);
+    if (bits == ALL_BITS)
+        m_full[word / WORD_BITS] |= quint64(1) << (word % WORD_BITS);
+}
+
+void UidAllocator::clear(int index)
+{
+    const int word = index / WORD_BITS;
+    m_used[word] &= ~(quint64(1) << (index % WORD_BITS));
+    m_full[word / WORD_BITS] &= ~(quint64(1) << (word % WORD_BITS));
+}
+
+// Returns first word at or after from that has a free bit, or -1
+int UidAllocator::findWord(int from) const
+{
+    const int words = m_used.size();
+    for (int summary = from / WORD_BITS; summary < m_full.size(); summary++) {
+        quint64 notFull = ~m_full.at(summary);
+        if (summary == from / WORD_BITS)
+            notFull &= ALL_BITS << (from % WORD_BITS);
+        if (notFull) {
+            const int word = summary * WORD_BITS + __builtin_ctzll(notFull);
+            return word < words ? word : -1;
+        }
+    }
+    return -1;
+}
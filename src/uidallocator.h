@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#ifndef UIDALLOCATOR_H
+#define UIDALLOCATOR_H
+
+#include <QVector>
+
+class AccountLanes;
+
+// Bitmap of ids in [first, last] that are taken by users or groups. Every
+// user gets a group with the same id, so an id is free only if it is free in
+// both. Second level bitmap marks full words and allocation continues from
+// the previous position, which makes it amortised constant time. Bitmaps are
+// rebuilt when account databases are changed outside of the daemon, own
+// writes only take ids that were allocated here. Allocated ids stay taken
+// across rebuilds until they are committed or released, as writes are
+// asynchronous.
+class UidAllocator
+{
+public:
+    UidAllocator(const AccountLanes *lanes, uint first, uint last);
+
+    void reserve(uint id);
+    uint allocate();
+    void commit(uint id);
+    void release(uint id);
+    void squeeze();
+
+private:
+    void refresh();
+    void set(int index);
+    void clear(int index);
+    int findWord(int from) const;
+
+    const AccountLanes *m_lanes;
+    uint m_first;
+    uint m_last;
+    quint64 m_generation;
+    int m_next;
+    QVector<uint> m_reserved;
+    QVector<uint> m_pending;
+    QVector<quint64> m_used;
+    QVector<quint64> m_full;
+};
+
+#endif // UIDALLOCATOR_H
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#include "usernameindex.h"
+#include "accountlanes.h"
+#include "logging.h"
+
+#include <QDir>
+
+#include <sys/stat.h>
+
+namespace {
+const int MAX_SUFFIX_DIGITS = 9; // Fits in int
+}
+
+bool UserNameIndex::FileStamp::operator==(const FileStamp &other) const
+{
+    return device == other.device && inode == other.inode
+            && size == other.size && mtime == other.mtime;
+}
+
+UserNameIndex::UserNameIndex(const AccountLanes *lanes, const QString &homeRoot) :
+    m_lanes(lanes),
+    m_homeRoot(homeRoot),
+    m_generation(0),
+    m_homeStamp()
+{
+}
+
+UserNameIndex::FileStamp UserNameIndex::stamp(const QString &path)
+{
+    FileStamp rv = { 0, 0, 0, 0 };
+    struct stat st;
+    if (stat(path.toUtf8().constData(), &st) == 0) {
+        rv.device = st.st_dev;
+        rv.inode = st.st_ino;
+        rv.size = st.st_size;
+        rv.mtime = qint64(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec;
+    }
+    return rv;
+}
+
+// Frees the index, it is rebuilt on next use
+void UserNameIndex::squeeze()
+{
+    m_taken.clear();
+    m_taken.squeeze();
+    m_highestSuffix.clear();
+    m_highestSuffix.squeeze();
+    m_generation = 0;
+}
+
+void UserNameIndex::refresh()
+{
+    // Home root mtime changes whenever an entry is added or removed there
+    const AccountLanes::Snapshot accounts = m_lanes->snapshot();
+    FileStamp homeStamp = stamp(m_homeRoot);
+    if (m_generation == accounts->generation() && homeStamp == m_homeStamp)
+        return;
+
+    qCDebug(lcSUM) << "Rebuilding user name index";
+    m_taken.clear();
+    m_highestSuffix.clear();
+
+    for (const QString &name : accounts->userNames())
+        insert(name);
+
+    for (const QString &name : accounts->groupNames())
+        insert(name);
+
+    const QDir home(m_homeRoot);
+    for (const QString &entry : home.entryList(QDir::AllEntries | QDir::System | QDir::Hidden | QDir::NoDotAndDotDot))
+        insert(entry);
+
+    for (const QString &name : m_pending)
+        insert(name);
+
+    m_generation = accounts->generation();
+    m_homeStamp = homeStamp;
+}
+
+void UserNameIndex::insert(const QString &name)
+{
+    if (name.isEmpty())
+        return;
+
+    m_taken.insert(name);
+
+    // Record every trailing run of digits that uniqueName() could produce,
+    // e.g. "user12" is suffix 12 of "user" and suffix 2 of "user1"
+    for (int i = name.length() - 1; i > 0 && name.at(i).isDigit(); i--) {
+        const QStringRef suffix = name.midRef(i);
+        if (suffix.length() > MAX_SUFFIX_DIGITS)
+            break;
+        if (suffix.length() > 1 && suffix.at(0) == QLatin1Char('0'))
+            continue; // Never generated, QString::number() has no leading zeros
+
+        const QString base = name.left(i);
+        const int number = suffix.toInt();
+        auto it = m_highestSuffix.find(base);
+        if (it == m_highestSuffix.end())
+            m_highestSuffix.insert(base, number);
+        else if (*it < number)
+            *it = number;
+    }
+}
+
+QString UserNameIndex::uniqueName(const QString &base)
+{
+    refresh();
+
+    // Every taken name with this base has a suffix at most the highest one
+    const QString name = m_taken.contains(base) ? base + QString::number(m_highestSuffix.value(base, -1) + 1)
+                                                : base;
+    insert(name);
+    m_pending.insert(name);
+    return name;
+}
+
+// Name was written to account databases or not used after all
+void UserNameIndex::release(const QString &name)
+{
+    m_pending.remove(name);
+}
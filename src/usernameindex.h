@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#ifndef USERNAMEINDEX_H
+#define USERNAMEINDEX_H
+
+#include <QHash>
+#include <QSet>
+#include <QString>
+
+#include <sys/types.h>
+
+class AccountLanes;
+
+// Index of names that are taken by users, groups or home directories.
+// Highest numeric suffix is recorded for every base name so that the next
+// free name can be computed without probing. The index is rebuilt when
+// account databases or home root change on disk. Names that were handed out
+// stay taken until released, as writes are asynchronous.
+class UserNameIndex
+{
+public:
+    UserNameIndex(const AccountLanes *lanes, const QString &homeRoot);
+
+    QString uniqueName(const QString &base);
+    void release(const QString &name);
+    void squeeze();
+
+private:
+    struct FileStamp {
+        dev_t device;
+        ino_t inode;
+        off_t size;
+        qint64 mtime;
+
+        bool operator==(const FileStamp &other) const;
+    };
+
+    static FileStamp stamp(const QString &path);
+    void refresh();
+    void insert(const QString &name);
+
+    const AccountLanes *m_lanes;
+    QString m_homeRoot;
+    quint64 m_generation;
+    FileStamp m_homeStamp;
+    QSet<QString> m_taken;
+    QSet<QString> m_pending;
+    QHash<QString, int> m_highestSuffix;
+};
+
+#endif // USERNAMEINDEX_H
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#ifndef USERSNAPSHOT_H
+#define USERSNAPSHOT_H
+
+/*
+ * Layout of the user snapshot that the daemon writes to
+ * USER_SNAPSHOT_PATH and the NSS module maps. Plain C so that it can be used
+ * from both.
+ *
+ * The file is written to a temporary file and renamed over the previous one,
+ * it is never modified in place. It starts with a header, all other offsets
+ * are byte offsets from the beginning of the file and string fields are
+ * offsets to the string table. Checksum covers everything after the header.
+ * Snapshot is valid only while passwd and group files still match the
+ * recorded sources, otherwise readers must fall back to the files.
+ *
+ * Users are the managed users, groups are all groups with their members. The
+ * lists array holds group indexes of each user and member name offsets of
+ * each group. Hash indexes are open addressing tables of index_size slots
+ * with linear probing, a slot holds a record index or USER_SNAPSHOT_NONE.
+ */
+
+#include <stdint.h>
+
+#define USER_SNAPSHOT_PATH "/run/user-managerd/users.snapshot"
+#define USER_SNAPSHOT_MAGIC 0x534d5553u /* "SUMS" */
+#define USER_SNAPSHOT_VERSION 1u
+#define USER_SNAPSHOT_NONE 0xffffffffu
+
+struct user_snapshot_source {
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+};
+
+struct user_snapshot_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t generation;
+    struct user_snapshot_source passwd;
+    struct user_snapshot_source group;
+    uint32_t size;
+    uint32_t checksum;
+    uint32_t user_count;
+    uint32_t group_count;
+    uint32_t users;
+    uint32_t groups;
+    uint32_t lists;
+    uint32_t list_count;
+    uint32_t index_size;
+    uint32_t users_by_uid;
+    uint32_t users_by_name;
+    uint32_t groups_by_gid;
+    uint32_t groups_by_name;
+    uint32_t strings;
+    uint32_t strings_size;
+    uint32_t reserved;
+};
+
+struct user_snapshot_user {
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t name;
+    uint32_t gecos;
+    uint32_t home;
+    uint32_t shell;
+    uint32_t uuid;
+    uint32_t groups;
+    uint32_t group_count;
+};
+
+struct user_snapshot_group {
+    uint32_t gid;
+    uint32_t name;
+    uint32_t members;
+    uint32_t member_count;
+};
+
+static inline uint32_t user_snapshot_hash_id(uint32_t id)
+{
+    return id * 2654435761u;
+}
+
+/* FNV-1a, also used for the checksum */
+static inline uint32_t user_snapshot_hash_bytes(uint32_t hash, const void *data, uint32_t length)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+    uint32_t i;
+    for (i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static inline uint32_t user_snapshot_hash_name(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    for (; *name; name++) {
+        hash ^= (unsigned char)*name;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+#endif /* USERSNAPSHOT_H */
@@ -0,0 +1,24 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+/*
+ * NSS module built with account and snapshot paths that the test sets to
+ * its fixture files.
+ */
+
+#include <limits.h>
+
+char nss_test_passwd_path[PATH_MAX];
+char nss_test_group_path[PATH_MAX];
+char nss_test_snapshot_path[PATH_MAX];
+
+#define PASSWD_PATH nss_test_passwd_path
+#define GROUP_PATH nss_test_group_path
+#define SNAPSHOT_PATH nss_test_snapshot_path
+
+#include "nss_sailfish.c"
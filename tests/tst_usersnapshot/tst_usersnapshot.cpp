@@ -0,0 +1,331 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#include "accountreader.h"
+#include "snapshotwriter.h"
+#include "usersnapshot.h"
+
+#include <QFile>
+#include <QTemporaryDir>
+#include <QtTest>
+
+#include <algorithm>
+#include <errno.h>
+#include <grp.h>
+#include <limits.h>
+#include <nss.h>
+#include <pwd.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern "C" {
+extern char nss_test_passwd_path[PATH_MAX];
+extern char nss_test_group_path[PATH_MAX];
+extern char nss_test_snapshot_path[PATH_MAX];
+
+enum nss_status _nss_sailfish_getpwuid_r(uid_t uid, struct passwd *pwd, char *buffer, size_t buflen,
+                                         int *errnop);
+enum nss_status _nss_sailfish_getpwnam_r(const char *name, struct passwd *pwd, char *buffer, size_t buflen,
+                                         int *errnop);
+enum nss_status _nss_sailfish_getgrgid_r(gid_t gid, struct group *grp, char *buffer, size_t buflen,
+                                         int *errnop);
+enum nss_status _nss_sailfish_getgrnam_r(const char *name, struct group *grp, char *buffer, size_t buflen,
+                                         int *errnop);
+enum nss_status _nss_sailfish_initgroups_dyn(const char *name, gid_t skip, long int *start, long int *size,
+                                             gid_t **groupsp, long int limit, int *errnop);
+}
+
+namespace {
+const uint FIRST_UID = 100000;
+const uint LAST_UID = 199999;
+
+const QByteArray PASSWD =
+        "root:x:0:0:root:/root:/bin/sh\n"
+        "nemo:x:100000:100000:Nemo:/home/defaultuser:/bin/bash\n"
+        "alice:x:100001:100001:Alice Example:/home/alice:/bin/bash\n";
+const QByteArray GROUP =
+        "root:x:0:\n"
+        "users:x:100:nemo,alice\n"
+        "audio:x:1005:alice\n"
+        "nemo:x:100000:\n"
+        "alice:x:100001:\n";
+
+void copyPath(char *destination, const QString &path)
+{
+    const QByteArray native = QFile::encodeName(path);
+    QVERIFY(native.size() < PATH_MAX);
+    strcpy(destination, native.constData());
+}
+}
+
+// Writes snapshots from fixture files and reads them with the NSS module
+class tst_UserSnapshot : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void passwd();
+    void group();
+    void initgroups();
+    void outsideRange();
+    void smallBuffer();
+    void staleSources();
+    void truncated();
+    void corrupt();
+
+private:
+    bool writeFile(const QString &path, const QByteArray &data);
+    bool writeSnapshot();
+
+    QTemporaryDir m_dir;
+    QString m_passwd;
+    QString m_group;
+    QString m_snapshot;
+};
+
+// Files are replaced, not modified in place, like the daemon and libuser do
+bool tst_UserSnapshot::writeFile(const QString &path, const QByteArray &data)
+{
+    const QString temporary = path + QStringLiteral(".new");
+    QFile file(temporary);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(data) != data.size())
+        return false;
+    file.close();
+    return ::rename(QFile::encodeName(temporary).constData(), QFile::encodeName(path).constData()) == 0;
+}
+
+bool tst_UserSnapshot::writeSnapshot()
+{
+    AccountReader accounts(m_passwd, m_group);
+    accounts.refresh();
+    QHash<uint, QString> uuids;
+    uuids.insert(100001, QStringLiteral("4a1c2b0e-6d7f-4e8a-9b3c-5d6e7f8a9b0c"));
+    return SnapshotWriter(&accounts, m_passwd, m_group, FIRST_UID, LAST_UID).write(m_snapshot, uuids);
+}
+
+void tst_UserSnapshot::init()
+{
+    QVERIFY(m_dir.isValid());
+    m_passwd = m_dir.filePath(QStringLiteral("passwd"));
+    m_group = m_dir.filePath(QStringLiteral("group"));
+    m_snapshot = m_dir.filePath(QStringLiteral("run/users.snapshot"));
+    copyPath(nss_test_passwd_path, m_passwd);
+    copyPath(nss_test_group_path, m_group);
+    copyPath(nss_test_snapshot_path, m_snapshot);
+
+    QVERIFY(writeFile(m_passwd, PASSWD));
+    QVERIFY(writeFile(m_group, GROUP));
+    QVERIFY(writeSnapshot());
+}
+
+void tst_UserSnapshot::passwd()
+{
+    struct passwd pwd;
+    alignas(char *) char buffer[1024];
+    int error = 0;
+
+    QCOMPARE(_nss_sailfish_getpwnam_r("alice", &pwd, buffer, sizeof(buffer), &error), NSS_STATUS_SUCCESS);
+    QCOMPARE(pwd.pw_uid, uid_t(100001));
+    QCOMPARE(pwd.pw_gid, gid_t(100001));
+    QCOMPARE(pwd.pw_name, "alice");
+    QCOMPARE(pwd.pw_passwd, "x");
+    QCOMPARE(pwd.pw_gecos, "Alice Example");
+    QCOMPARE(pwd.pw_dir, "/home/alice");
+    QCOMPARE(pwd.pw_shell, "/bin/bash");
+
+    QCOMPARE(_nss_sailfish_getpwuid_r(100000, &pwd, buffer, sizeof(buffer), &error), NSS_STATUS_SUCCESS);
+    QCOMPARE(pwd.pw_name, "nemo");
+    QCOMPARE(pwd.pw_dir, "/home/defaultuser");
+
+    QCOMPARE(_nss_sailfish_getpwnam_r("bob", &pwd, buffer, sizeof(buffer), &error), NSS_STATUS_NOTFOUND);
+    QCOMPARE(_nss_sailfish_getpwuid_r(100002, &pwd, buffer, sizeof(buffer), &error), NSS_STATUS_NOTFOUND);
+}
+
+void tst_UserSnapshot::group()
+{
+    struct group grp;
+    alignas(char *) char buffer[1024];
+    int error = 0;
+
+    QCOMPARE(_nss_sailfish_getgrnam_r("users", &grp, buffer, sizeof(buffer), &error), NSS_STATUS_SUCCESS);
+    QCOMPARE(grp.gr_gid, gid_t(100));
+    QCOMPARE(grp.gr_name, "users");
+    QStringList members;
+    for (char **member = grp.gr_mem; *member; member++)
+        members << QString::fromUtf8(*member);
+    QCOMPARE(members, QStringList() << QStringLiteral("nemo") << QStringLiteral("alice"));
+
+    QCOMPARE(_nss_sailfish_getgrgid_r(1005, &grp, buffer, sizeof(buffer), &error), NSS_STATUS_SUCCESS);
+    QCOMPARE(grp.gr_name, "audio");
+    QCOMPARE(grp.gr_mem[0], "alice");
+    QVERIFY(!grp.gr_mem[1]);
+
+    // All groups are included, not only those of managed users
+    QCOMPARE(_nss_sailfish_getgrgid_r(0, &grp, buffer, sizeof(buffer), &error), NSS_STATUS_SUCCESS);
+    QCOMPARE(grp.gr_name, "root");
+    QVERIFY(!grp.gr_mem[0]);
+
+    QCOMPARE(_nss_sailfish_getgrnam_r("video", &grp, buffer, sizeof(buffer), &error), NSS_STATUS_NOTFOUND);
+}
+
+void tst_UserSnapshot::initgroups()
+{
+    long int start = 0;
+    long int size = 0;
+    gid_t *groups = nullptr;
+    int error = 0;
+
+    QCOMPARE(_nss_sailfish_initgroups_dyn("alice", 100001, &start, &size, &groups, 0, &error),
+             NSS_STATUS_SUCCESS);
+    QList<gid_t> gids;
+    for (long int i = 0; i < start; i++)
+        gids << groups[i];
+    free(groups);
+    std::sort(gids.begin(), gids.end());
+    QCOMPARE(gids, QList<gid_t>() << 100 << 1005);
+
+    // Limit is respected
+    start = 0;
+    size = 0;
+    groups = nullptr;
+    QCOMPARE(_nss_sailfish_initgroups_dyn("alice", 100001, &start, &size, &groups, 1, &error),
+             NSS_STATUS_SUCCESS);
+    free(groups);
+    QCOMPARE(start, 1L);
+}
+
+void tst_UserSnapshot::outsideRange()
+{
+    struct passwd pwd;
+    alignas(char *) char buffer[1024];
+    int error = 0;
+
+    // System users are left to files
+    QCOMPARE(_nss_sailfish_getpwuid_r(0, &pwd, buffer, sizeof(buffer), &error), NSS_STATUS_NOTFOUND);
+    QCOMPARE(_nss_sailfish_getpwnam_r("root", &pwd, buffer, sizeof(buffer), &error), NSS_STATUS_NOTFOUND);
+}
+
+void tst_UserSnapshot::smallBuffer()
+{
+    struct passwd pwd;
+    struct group grp;
+    alignas(char *) char buffer[1024];
+    int error = 0;
+
+    QCOMPARE(_nss_sailfish_getpwnam_r("alice", &pwd, buffer, 8, &error), NSS_STATUS_TRYAGAIN);
+    QCOMPARE(error, ERANGE);
+
+    // Room for member pointers but not for the names
+    error = 0;
+    QCOMPARE(_nss_sailfish_getgrnam_r("users", &grp, buffer, 3 * sizeof(char *) + 8, &error),
+             NSS_STATUS_TRYAGAIN);
+    QCOMPARE(error, ERANGE);
+
+    // Not even room for member pointers
+    error = 0;
+    QCOMPARE(_nss_sailfish_getgrgid_r(100, &grp, buffer, sizeof(char *), &error), NSS_STATUS_TRYAGAIN);
+    QCOMPARE(error, ERANGE);
+
+    // Exactly enough, for the strings "alice", "x", "Alice Example", "/home/alice" and "/bin/bash"
+    error = 0;
+    QCOMPARE(_nss_sailfish_getpwnam_r("alice", &pwd, buffer, 6 + 2 + 14 + 12 + 10, &error), NSS_STATUS_SUCCESS);
+    QCOMPARE(_nss_sailfish_getpwnam_r("alice", &pwd, buffer, 6 + 2 + 14 + 12 + 9, &error), NSS_STATUS_TRYAGAIN);
+}
+
+void tst_UserSnapshot::staleSources()
+{
+    struct passwd pwd;
+    struct group grp;
+    alignas(char *) char buffer[1024];
+    int error = 0;
+
+    // Files answer until the daemon writes a snapshot of the new passwd
+    QVERIFY(writeFile(m_passwd, PASSWD + "bob:x:100002:100002:Bob:/home/bob:/bin/bash\n"));
+    QCOMPARE(_nss_sailfish_getpwnam_r("alice", &pwd, buffer, sizeof(buffer), &error), NSS_STATUS_UNAVAIL);
+    QCOMPARE(_nss_sailfish_getpwnam_r("bob", &pwd, buffer, sizeof(buffer), &error), NSS_STATUS_UNAVAIL);
+    QVERIFY(writeSnapshot());
+    QCOMPARE(_nss_sailfish_getpwnam_r("bob", &pwd, buffer, sizeof(buffer), &error), NSS_STATUS_SUCCESS);
+    QCOMPARE(pwd.pw_uid, uid_t(100002));
+
+    QVERIFY(writeFile(m_group, GROUP + "video:x:1006:alice\n"));
+    QCOMPARE(_nss_sailfish_getgrnam_r("users", &grp, buffer, sizeof(buffer), &error), NSS_STATUS_UNAVAIL);
+    QVERIFY(writeSnapshot());
+    QCOMPARE(_nss_sailfish_getgrnam_r("video", &grp, buffer, sizeof(buffer), &error), NSS_STATUS_SUCCESS);
+
+    QVERIFY(QFile::remove(m_passwd));
+    QCOMPARE(_nss_sailfish_getpwnam_r("alice", &pwd, buffer, sizeof(buffer), &error), NSS_STATUS_UNAVAIL);
+    QVERIFY(!writeSnapshot());
+}
+
+void tst_UserSnapshot::truncated()
+{
+    struct passwd pwd;
+    alignas(char *) char buffer[1024];
+    int error = 0;
+
+    QFile file(m_snapshot);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    const QByteArray snapshot = file.readAll();
+    file.close();
+
+    for (int size : { 0, 4, int(sizeof(struct user_snapshot_header)) - 1, snapshot.size() / 2,
+                      snapshot.size() - 1 }) {
+        QVERIFY(writeFile(m_snapshot, snapshot.left(size)));
+        QCOMPARE(_nss_sailfish_getpwnam_r("alice", &pwd, buffer, sizeof(buffer), &error), NSS_STATUS_UNAVAIL);
+    }
+
+    QVERIFY(QFile::remove(m_snapshot));
+    QCOMPARE(_nss_sailfish_getpwnam_r("alice", &pwd, buffer, sizeof(buffer), &error), NSS_STATUS_UNAVAIL);
+
+    QVERIFY(writeFile(m_snapshot, snapshot));
+    QCOMPARE(_nss_sailfish_getpwnam_r("alice", &pwd, buffer, sizeof(buffer), &error), NSS_STATUS_SUCCESS);
+}
+
+void tst_UserSnapshot::corrupt()
+{
+    struct passwd pwd;
+    alignas(char *) char buffer[1024];
+    int error = 0;
+
+    QFile file(m_snapshot);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    const QByteArray snapshot = file.readAll();
+    file.close();
+
+    // Checksum covers the body
+    QByteArray data = snapshot;
+    data[data.size() - 2] = data.at(data.size() - 2) ^ 0x01;
+    QVERIFY(writeFile(m_snapshot, data));
+    QCOMPARE(_nss_sailfish_getpwnam_r("alice", &pwd, buffer, sizeof(buffer), &error), NSS_STATUS_UNAVAIL);
+
+    // Header fields are checked against the file
+    struct user_snapshot_header header;
+    const struct { const char *name; uint32_t user_snapshot_header::*field; uint32_t value; } fields[] = {
+        { "magic", &user_snapshot_header::magic, 0 },
+        { "version", &user_snapshot_header::version, USER_SNAPSHOT_VERSION + 1 },
+        { "size", &user_snapshot_header::size, uint32_t(snapshot.size()) + 1 },
+        { "index_size", &user_snapshot_header::index_size, 12 },
+        { "users", &user_snapshot_header::users, uint32_t(snapshot.size()) },
+        { "user_count", &user_snapshot_header::user_count, 0x10000000 },
+        { "strings_size", &user_snapshot_header::strings_size, uint32_t(snapshot.size()) },
+    };
+    for (const auto &field : fields) {
+        data = snapshot;
+        memcpy(&header, data.constData(), sizeof(header));
+        header.*field.field = field.value;
+        memcpy(data.data(), &header, sizeof(header));
+        QVERIFY(writeFile(m_snapshot, data));
+        QVERIFY2(_nss_sailfish_getpwnam_r("alice", &pwd, buffer, sizeof(buffer), &error) == NSS_STATUS_UNAVAIL,
+                 field.name);
+    }
+}
+
+QTEST_GUILESS_MAIN(tst_UserSnapshot)
+
+#include "tst_usersnapshot.moc"
@@ -0,0 +1,25 @@
+TEMPLATE = app
+TARGET = tst_usersnapshot
+
+QT -= gui
+QT += dbus testlib
+
+CONFIG += c++11 console testcase
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../../src ../../nss
+
+SOURCES += \
+    ../../src/accountreader.cpp \
+    ../../src/logging.cpp \
+    ../../src/snapshotwriter.cpp \
+    nsstestpaths.c \
+    tst_usersnapshot.cpp
+
+HEADERS += \
+    ../../src/accountreader.h \
+    ../../src/logging.h \
+    ../../src/snapshotwriter.h \
+    ../../src/usersnapshot.h
+
+# Run with make check, not installed
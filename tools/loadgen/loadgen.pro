@@ -0,0 +1,21 @@
+TEMPLATE = app
+TARGET = user-managerd-loadgen
+
+QT -= gui
+QT += dbus
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+INCLUDEPATH += ../../src
+
+SOURCES += \
+    loadgenerator.cpp \
+    main.cpp
+
+HEADERS += \
+    loadgenerator.h
+
+# Development tool, not installed
@@ -0,0 +1,459 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#include "loadgenerator.h"
+#include "sailfishusermanagerinterface.h"
+
+#include <QCoreApplication>
+#include <QDBusConnection>
+#include <QDBusConnectionInterface>
+#include <QDBusMessage>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
+#include <QDir>
+#include <QFile>
+#include <QProcessEnvironment>
+#include <QThread>
+#include <QTimer>
+
+#include <algorithm>
+#include <stdio.h>
+
+namespace {
+const char *OPERATION_NAMES[LoadGenerator::OperationCount] = {
+    "add", "remove", "modify", "groups", "read"
+};
+const auto DEBUG_INTERFACE = QStringLiteral("org.sailfishos.usermanager.Debug");
+const auto DEBUG_OBJECT_PATH = QStringLiteral("/debug");
+const auto LOAD_GROUP = QStringLiteral("sailfish-loadgen");
+const int STARTUP_TIMEOUT = 10 * 1000;
+const int POLL_INTERVAL = 50;
+// Per-client limits high enough not to be hit, see --rate-limits
+const int UNLIMITED_RATE = 100000;
+
+// Call count of operation in daemon metrics text
+quint64 metricCalls(const QString &metrics, const QString &operation)
+{
+    const QString prefix = operation + QStringLiteral(" calls=");
+    for (const QString &line : metrics.split(QLatin1Char('\n'))) {
+        if (line.startsWith(prefix))
+            return line.mid(prefix.length()).section(QLatin1Char(' '), 0, 0).toULongLong();
+    }
+    return 0;
+}
+}
+
+LoadGenerator::LoadGenerator(const Options &options, QObject *parent) :
+    QObject(parent),
+    m_options(options),
+    m_temporary(nullptr),
+    m_duration(0),
+    m_running(0),
+    m_bursts(0),
+    m_callsBefore(0),
+    m_computationsBefore(0)
+{
+    for (Result &result : m_results)
+        result.limited = 0;
+}
+
+LoadGenerator::~LoadGenerator()
+{
+    stop();
+    delete m_temporary;
+    m_temporary = nullptr;
+}
+
+// Parses "add=3,remove=2,..." into weights, missing operations get zero
+bool LoadGenerator::parseMix(const QString &mix, int *weights)
+{
+    std::fill(weights, weights + OperationCount, 0);
+    int total = 0;
+    for (const QString &item : mix.split(QLatin1Char(','), QString::SkipEmptyParts)) {
+        const QStringList pair = item.split(QLatin1Char('='));
+        bool ok = false;
+        const int weight = pair.count() == 2 ? pair.at(1).trimmed().toInt(&ok) : 0;
+        int operation = 0;
+        while (operation < OperationCount && pair.at(0).trimmed() != QLatin1String(OPERATION_NAMES[operation]))
+            operation++;
+        if (!ok || weight < 0 || operation == OperationCount) {
+            fprintf(stderr, "Invalid mix item: %s\n", qPrintable(item));
+            return false;
+        }
+        weights[operation] = weight;
+        total += weight;
+    }
+    return total > 0;
+}
+
+bool LoadGenerator::start()
+{
+    if (m_options.sandbox.isEmpty()) {
+        m_temporary = new QTemporaryDir;
+        if (!m_temporary->isValid()) {
+            fprintf(stderr, "Could not create temporary directory\n");
+            return false;
+        }
+        m_sandbox = m_temporary->path();
+    } else {
+        m_sandbox = QDir(m_options.sandbox).absolutePath();
+    }
+
+    if (!seedSandbox() || !startBus() || !startDaemon())
+        return false;
+
+    m_clients.resize(m_options.clients);
+    for (int i = 0; i < m_clients.count(); i++) {
+        Client &client = m_clients[i];
+        client.connection = QStringLiteral("loadgen-client-%1").arg(i);
+        client.remaining = m_options.operations;
+        client.serial = 0;
+        client.random.seed(i + 1);
+        QDBusConnection connection = QDBusConnection::connectToBus(m_address, client.connection);
+        if (!connection.isConnected()) {
+            fprintf(stderr, "Client %d could not connect: %s\n", i, qPrintable(connection.lastError().message()));
+            return false;
+        }
+    }
+
+    if (m_options.mode == BurstMode) {
+        printf("Running %d bursts of %d simultaneous users calls against %s\n",
+               m_options.operations, m_options.clients, qPrintable(m_sandbox));
+        const QString metrics = daemonMetrics();
+        m_callsBefore = metricCalls(metrics, QStringLiteral("dbus.users"));
+        m_computationsBefore = metricCalls(metrics, QStringLiteral("coalesced.users"));
+        m_bursts = m_options.operations;
+        m_clock.start();
+        nextBurst();
+        return true;
+    }
+
+    printf("Running %d clients with %d operations each against %s\n",
+           m_options.clients, m_options.operations, qPrintable(m_sandbox));
+    m_clock.start();
+    m_running = m_clients.count();
+    for (int i = 0; i < m_clients.count(); i++)
+        next(i);
+    return true;
+}
+
+// Sandbox files are created by the daemon, only what the load needs is seeded here
+bool LoadGenerator::seedSandbox()
+{
+    const QString etc = m_sandbox + QStringLiteral("/etc");
+    if (!QDir().mkpath(etc)) {
+        fprintf(stderr, "Could not create %s\n", qPrintable(etc));
+        return false;
+    }
+
+    const QList<QPair<QString, QByteArray>> files = QList<QPair<QString, QByteArray>>()
+            << qMakePair(QStringLiteral("/group"), QByteArray("root:x:0:\nusers:x:100:\n")
+                         + LOAD_GROUP.toUtf8() + ":x:1000:\n")
+            << qMakePair(QStringLiteral("/gshadow"), QByteArray("root:*::\nusers:*::\n")
+                         + LOAD_GROUP.toUtf8() + ":*::\n");
+    for (const auto &file : files) {
+        QFile out(etc + file.first);
+        if (out.exists())
+            continue;
+        if (!out.open(QIODevice::WriteOnly) || out.write(file.second) != file.second.size()) {
+            fprintf(stderr, "Could not write %s\n", qPrintable(out.fileName()));
+            return false;
+        }
+    }
+
+    // Configuration is always rewritten, it depends on options
+    QByteArray config = "[General]\nMaxUsers=" + QByteArray::number(m_options.maxUsers) + "\n";
+    if (!m_options.rateLimits) {
+        const QByteArray rate = QByteArray::number(UNLIMITED_RATE);
+        config += "ReadRate=" + rate + "\nReadBurst=" + rate + "\nWriteRate=" + rate + "\nWriteBurst=" + rate + "\n";
+    }
+    if (m_options.sequentialAdd)
+        config += "SequentialUserCreation=true\n";
+    QFile out(etc + QStringLiteral("/user-managerd.conf"));
+    if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate) || out.write(config) != config.size()) {
+        fprintf(stderr, "Could not write %s\n", qPrintable(out.fileName()));
+        return false;
+    }
+    return true;
+}
+
+bool LoadGenerator::startBus()
+{
+    m_bus.start(QStringLiteral("dbus-daemon"), QStringList()
+                << QStringLiteral("--session")
+                << QStringLiteral("--nofork")
+                << QStringLiteral("--print-address")
+                << QStringLiteral("--address=unix:path=%1/bus").arg(m_sandbox));
+    if (!m_bus.waitForStarted() || !m_bus.waitForReadyRead(STARTUP_TIMEOUT)) {
+        fprintf(stderr, "Could not start dbus-daemon\n");
+        return false;
+    }
+    m_address = QString::fromUtf8(m_bus.readLine().trimmed());
+    return !m_address.isEmpty();
+}
+
+bool LoadGenerator::startDaemon()
+{
+    QProcessEnvironment environment = QProcessEnvironment::systemEnvironment();
+    environment.insert(QStringLiteral("DBUS_SESSION_BUS_ADDRESS"), m_address);
+    m_daemon.setProcessEnvironment(environment);
+    if (m_options.verbose)
+        m_daemon.setProcessChannelMode(QProcess::ForwardedChannels);
+    else
+        m_daemon.setStandardErrorFile(m_sandbox + QStringLiteral("/user-managerd.log"));
+    m_daemon.start(m_options.daemon, QStringList() << QStringLiteral("--sandbox") << m_sandbox);
+    if (!m_daemon.waitForStarted()) {
+        fprintf(stderr, "Could not start %s\n", qPrintable(m_options.daemon));
+        return false;
+    }
+
+    QDBusConnection connection = QDBusConnection::connectToBus(m_address, QStringLiteral("loadgen"));
+    QElapsedTimer timer;
+    timer.start();
+    while (!connection.interface()->isServiceRegistered(SAILFISH_USERMANAGER_DBUS_INTERFACE)) {
+        if (timer.hasExpired(STARTUP_TIMEOUT) || m_daemon.state() != QProcess::Running) {
+            fprintf(stderr, "Daemon did not register its service\n");
+            return false;
+        }
+        QThread::msleep(POLL_INTERVAL);
+    }
+    return true;
+}
+
+LoadGenerator::Operation LoadGenerator::pick(Client &client)
+{
+    int total = 0;
+    for (int weight : m_options.weights)
+        total += weight;
+
+    std::uniform_int_distribution<int> distribution(0, total - 1);
+    int value = distribution(client.random);
+    int operation = 0;
+    while (value >= m_options.weights[operation])
+        value -= m_options.weights[operation++];
+
+    // Operations on users need one, create it first
+    if (operation != AddUser && operation != Read && client.users.isEmpty())
+        return AddUser;
+    return Operation(operation);
+}
+
+void LoadGenerator::next(int index)
+{
+    Client &client = m_clients[index];
+    if (client.remaining == 0) {
+        if (--m_running == 0)
+            finish();
+        return;
+    }
+    client.remaining--;
+
+    const Operation operation = pick(client);
+    const uint uid = client.users.isEmpty() ? 0 : client.users.at(client.serial % client.users.count());
+    QString method;
+    QVariantList arguments;
+    switch (operation) {
+    case AddUser:
+        method = QStringLiteral("addUser");
+        arguments << QStringLiteral("Load %1 %2").arg(index).arg(client.serial);
+        break;
+    case RemoveUser:
+        method = QStringLiteral("removeUser");
+        arguments << uid;
+        client.users.removeOne(uid);
+        break;
+    case ModifyUser:
+        method = QStringLiteral("modifyUser");
+        arguments << uid << QStringLiteral("Load %1 %2").arg(index).arg(client.serial);
+        break;
+    case AddToGroups:
+        method = QStringLiteral("addToGroups");
+        arguments << uid << QStringList(LOAD_GROUP);
+        break;
+    default:
+        method = QStringLiteral("users");
+        break;
+    }
+    client.serial++;
+
+    QDBusMessage message = QDBusMessage::createMethodCall(SAILFISH_USERMANAGER_DBUS_INTERFACE,
+                                                          SAILFISH_USERMANAGER_DBUS_OBJECT_PATH,
+                                                          SAILFISH_USERMANAGER_DBUS_INTERFACE,
+                                                          method);
+    message.setArguments(arguments);
+
+    const qint64 started = m_clock.nsecsElapsed();
+    QDBusPendingCall call = QDBusConnection(client.connection).asyncCall(message);
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(call, this);
+    connect(watcher, &QDBusPendingCallWatcher::finished,
+            this, [this, index, operation, started](QDBusPendingCallWatcher *watcher) {
+        onReply(index, operation, started, watcher);
+    });
+}
+
+/*
+ * Sends one users() call from every client at once and starts the next
+ * burst when all of them have been replied.
+ */
+void LoadGenerator::nextBurst()
+{
+    if (m_bursts == 0) {
+        finish();
+        return;
+    }
+    m_bursts--;
+
+    m_running = m_clients.count();
+    const qint64 started = m_clock.nsecsElapsed();
+    for (const Client &client : m_clients) {
+        QDBusMessage message = QDBusMessage::createMethodCall(SAILFISH_USERMANAGER_DBUS_INTERFACE,
+                                                              SAILFISH_USERMANAGER_DBUS_OBJECT_PATH,
+                                                              SAILFISH_USERMANAGER_DBUS_INTERFACE,
+                                                              QStringLiteral("users"));
+        QDBusPendingCall call = QDBusConnection(client.connection).asyncCall(message);
+        QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(call, this);
+        connect(watcher, &QDBusPendingCallWatcher::finished,
+                this, [this, started](QDBusPendingCallWatcher *watcher) {
+            onBurstReply(started, watcher);
+        });
+    }
+}
+
+void LoadGenerator::onBurstReply(qint64 started, QDBusPendingCallWatcher *watcher)
+{
+    record(Read, started, watcher);
+    watcher->deleteLater();
+
+    if (--m_running == 0)
+        nextBurst();
+}
+
+void LoadGenerator::finish()
+{
+    m_duration = m_clock.nsecsElapsed();
+    report();
+    stop();
+    emit finished(EXIT_SUCCESS);
+}
+
+void LoadGenerator::onReply(int index, Operation operation, qint64 started, QDBusPendingCallWatcher *watcher)
+{
+    const qint64 elapsed = m_clock.nsecsElapsed() - started;
+    if (record(operation, started, watcher) && operation == AddUser) {
+        QDBusPendingReply<uint> reply = *watcher;
+        m_clients[index].users.append(reply.value());
+    }
+    // Wall time of every addUser call, from sending the call to its reply
+    if (m_options.mode == AddMode)
+        printf("add client=%d call=%d ms=%.2f%s\n", index, m_clients[index].serial, elapsed / 1e6,
+               watcher->isError() ? qPrintable(QStringLiteral(" error=") + watcher->error().name()) : "");
+    watcher->deleteLater();
+
+    next(index);
+}
+
+// Records the result of a call, returns true if it succeeded
+bool LoadGenerator::record(Operation operation, qint64 started, QDBusPendingCallWatcher *watcher)
+{
+    Result &result = m_results[operation];
+    if (watcher->isError() && watcher->error().name() == QLatin1String(SailfishUserManagerErrorRateLimited)) {
+        result.limited++;
+        return false;
+    }
+
+    result.latencies.append(m_clock.nsecsElapsed() - started);
+    if (watcher->isError()) {
+        result.errors[watcher->error().name()]++;
+        return false;
+    }
+    return true;
+}
+
+static qint64 percentile(const QVector<qint64> &sorted, int percent)
+{
+    if (sorted.isEmpty())
+        return 0;
+    int index = (sorted.count() * percent + 99) / 100 - 1;
+    return sorted.at(qBound(0, index, sorted.count() - 1));
+}
+
+void LoadGenerator::report()
+{
+    const double seconds = m_duration / 1e9;
+    int total = 0;
+    printf("\n%-8s %8s %8s %8s %10s %10s %10s %10s\n", "op", "count", "errors", "limited",
+           "p50 ms", "p90 ms", "p99 ms", "max ms");
+    for (int operation = 0; operation < OperationCount; operation++) {
+        Result &result = m_results[operation];
+        if (result.latencies.isEmpty() && !result.limited)
+            continue;
+
+        std::sort(result.latencies.begin(), result.latencies.end());
+        int errors = 0;
+        for (int count : result.errors)
+            errors += count;
+        total += result.latencies.count();
+        printf("%-8s %8d %8d %8d %10.2f %10.2f %10.2f %10.2f\n", OPERATION_NAMES[operation],
+               result.latencies.count(), errors, result.limited,
+               percentile(result.latencies, 50) / 1e6, percentile(result.latencies, 90) / 1e6,
+               percentile(result.latencies, 99) / 1e6,
+               result.latencies.isEmpty() ? 0.0 : result.latencies.last() / 1e6);
+        for (auto it = result.errors.constBegin(); it != result.errors.constEnd(); ++it)
+            printf("         %8d %s\n", it.value(), qPrintable(it.key()));
+    }
+    printf("\n%d operations in %.2f s, %.1f operations/s\n", total, seconds, seconds > 0 ? total / seconds : 0.0);
+
+    const QVector<qint64> &adds = m_results[AddUser].latencies;
+    if (m_options.mode == AddMode && !adds.isEmpty()) {
+        qint64 sum = 0;
+        for (qint64 latency : adds)
+            sum += latency;
+        printf("addUser wall time %.2f ms per call on average\n", sum / double(adds.count()) / 1e6);
+    }
+
+    // Coalesced calls share one computation of the reply
+    if (m_options.mode == BurstMode) {
+        const QString metrics = daemonMetrics();
+        const quint64 calls = metricCalls(metrics, QStringLiteral("dbus.users")) - m_callsBefore;
+        const quint64 computations = metricCalls(metrics, QStringLiteral("coalesced.users")) - m_computationsBefore;
+        printf("%llu users calls answered by %llu computations, %.1f calls per computation\n",
+               calls, computations, computations ? double(calls) / computations : 0.0);
+    }
+
+    if (m_options.daemonMetrics)
+        printf("\n%s", qPrintable(daemonMetrics()));
+    fflush(stdout);
+}
+
+QString LoadGenerator::daemonMetrics()
+{
+    QDBusMessage message = QDBusMessage::createMethodCall(SAILFISH_USERMANAGER_DBUS_INTERFACE,
+                                                          DEBUG_OBJECT_PATH, DEBUG_INTERFACE,
+                                                          QStringLiteral("metrics"));
+    QDBusMessage reply = QDBusConnection(QStringLiteral("loadgen")).call(message);
+    if (reply.type() != QDBusMessage::ReplyMessage || reply.arguments().isEmpty()) {
+        fprintf(stderr, "Could not get daemon metrics: %s\n", qPrintable(reply.errorMessage()));
+        return QString();
+    }
+    return reply.arguments().first().toString();
+}
+
+void LoadGenerator::stop()
+{
+    for (const Client &client : m_clients)
+        QDBusConnection::disconnectFromBus(client.connection);
+    QDBusConnection::disconnectFromBus(QStringLiteral("loadgen"));
+
+    for (QProcess *process : { &m_daemon, &m_bus }) {
+        if (process->state() != QProcess::NotRunning) {
+            process->terminate();
+            if (!process->waitForFinished())
+                process->kill();
+        }
+    }
+}
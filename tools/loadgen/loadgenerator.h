@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#ifndef LOADGENERATOR_H
+#define LOADGENERATOR_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QObject>
+#include <QProcess>
+#include <QString>
+#include <QTemporaryDir>
+#include <QVector>
+
+#include <random>
+
+class QDBusPendingCallWatcher;
+
+// Starts user-managerd in sandbox mode on a private bus and drives it from
+// many concurrent clients. Every client is a separate bus connection with
+// one call in flight at a time.
+class LoadGenerator : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Operation {
+        AddUser,
+        RemoveUser,
+        ModifyUser,
+        AddToGroups,
+        Read,
+        OperationCount
+    };
+
+    enum Mode {
+        MixMode,
+        AddMode,
+        BurstMode
+    };
+
+    struct Options {
+        QString daemon;
+        QString sandbox;
+        Mode mode;
+        int clients;
+        int operations;
+        int maxUsers;
+        int weights[OperationCount];
+        bool daemonMetrics;
+        bool rateLimits;
+        bool sequentialAdd;
+        bool verbose;
+    };
+
+    explicit LoadGenerator(const Options &options, QObject *parent = nullptr);
+    ~LoadGenerator();
+
+    static bool parseMix(const QString &mix, int *weights);
+    bool start();
+
+signals:
+    void finished(int exitCode);
+
+private:
+    struct Client {
+        QString connection;
+        int remaining;
+        int serial;
+        QList<uint> users;
+        std::mt19937 random;
+    };
+
+    // Rate limited calls are counted apart, they would hide daemon latency
+    struct Result {
+        QVector<qint64> latencies;
+        QHash<QString, int> errors;
+        int limited;
+    };
+
+    bool seedSandbox();
+    bool startBus();
+    bool startDaemon();
+    void next(int index);
+    void nextBurst();
+    void onBurstReply(qint64 started, QDBusPendingCallWatcher *watcher);
+    void finish();
+    QString daemonMetrics();
+    void onReply(int index, Operation operation, qint64 started, QDBusPendingCallWatcher *watcher);
+    bool record(Operation operation, qint64 started, QDBusPendingCallWatcher *watcher);
+    Operation pick(Client &client);
+    void report();
+    void stop();
+
+    Options m_options;
+    QTemporaryDir *m_temporary;
+    QString m_sandbox;
+    QString m_address;
+    QProcess m_bus;
+    QProcess m_daemon;
+    QVector<Client> m_clients;
+    Result m_results[OperationCount];
+    QElapsedTimer m_clock;
+    qint64 m_duration;
+    int m_running;
+    // Burst mode, users() calls and computations before the run
+    int m_bursts;
+    quint64 m_callsBefore;
+    quint64 m_computationsBefore;
+};
+
+#endif // LOADGENERATOR_H
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+
+#include <stdio.h>
+
+#include "loadgenerator.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral(
+            "Runs user-managerd in a sandbox on a private bus and measures it under load. "
+            "Mix operations are add, remove, modify, groups and read. "
+            "Mode add only adds users and prints wall time of every call. "
+            "Mode burst sends one users call from every client at once, operations times."));
+    parser.addHelpOption();
+    QCommandLineOption daemon(QStringLiteral("daemon"), QStringLiteral("Daemon executable."),
+                              QStringLiteral("path"), QStringLiteral("user-managerd"));
+    QCommandLineOption sandbox(QStringLiteral("sandbox"),
+                               QStringLiteral("Sandbox directory, temporary if not given."),
+                               QStringLiteral("dir"));
+    QCommandLineOption mode(QStringLiteral("mode"), QStringLiteral("Load to run: mix, add or burst."),
+                            QStringLiteral("mode"), QStringLiteral("mix"));
+    QCommandLineOption clients(QStringLiteral("clients"), QStringLiteral("Number of concurrent clients."),
+                               QStringLiteral("n"), QStringLiteral("8"));
+    QCommandLineOption operations(QStringLiteral("operations"), QStringLiteral("Operations per client."),
+                                  QStringLiteral("n"), QStringLiteral("100"));
+    QCommandLineOption mix(QStringLiteral("mix"), QStringLiteral("Relative weights of operations."),
+                           QStringLiteral("mix"), QStringLiteral("add=3,remove=2,modify=2,groups=1,read=4"));
+    QCommandLineOption maxUsers(QStringLiteral("max-users"), QStringLiteral("User limit of the daemon."),
+                                QStringLiteral("n"), QStringLiteral("99999"));
+    QCommandLineOption metrics(QStringLiteral("daemon-metrics"), QStringLiteral("Print daemon metrics at the end."));
+    QCommandLineOption rateLimits(QStringLiteral("rate-limits"),
+                                  QStringLiteral("Keep the daemon's default per-client rate limits."));
+    QCommandLineOption sequentialAdd(QStringLiteral("sequential-add"),
+                                     QStringLiteral("Make the daemon run user creation stages one after another."));
+    QCommandLineOption verbose(QStringLiteral("verbose"), QStringLiteral("Show daemon output."));
+    parser.addOptions(QList<QCommandLineOption>() << daemon << sandbox << mode << clients << operations
+                      << mix << maxUsers << metrics << rateLimits << sequentialAdd << verbose);
+    parser.process(app);
+
+    LoadGenerator::Options options;
+    options.daemon = parser.value(daemon);
+    options.sandbox = parser.value(sandbox);
+    if (parser.value(mode) == QLatin1String("mix")) {
+        options.mode = LoadGenerator::MixMode;
+    } else if (parser.value(mode) == QLatin1String("add")) {
+        options.mode = LoadGenerator::AddMode;
+    } else if (parser.value(mode) == QLatin1String("burst")) {
+        options.mode = LoadGenerator::BurstMode;
+    } else {
+        fprintf(stderr, "Invalid mode: %s\n", qPrintable(parser.value(mode)));
+        return EXIT_FAILURE;
+    }
+    options.clients = parser.value(clients).toInt();
+    options.operations = parser.value(operations).toInt();
+    options.maxUsers = parser.value(maxUsers).toInt();
+    options.daemonMetrics = parser.isSet(metrics);
+    options.rateLimits = parser.isSet(rateLimits);
+    options.sequentialAdd = parser.isSet(sequentialAdd);
+    options.verbose = parser.isSet(verbose);
+    if (options.clients <= 0 || options.operations <= 0 || options.maxUsers <= 0
+            || !LoadGenerator::parseMix(options.mode == LoadGenerator::AddMode ? QStringLiteral("add=1")
+                                                                                : parser.value(mix),
+                                        options.weights)) {
+        fprintf(stderr, "Invalid arguments\n");
+        return EXIT_FAILURE;
+    }
+
+    LoadGenerator generator(options);
+    QObject::connect(&generator, &LoadGenerator::finished, &app, &QCoreApplication::exit);
+    if (!generator.start())
+        return EXIT_FAILURE;
+
+    return app.exec();
+}
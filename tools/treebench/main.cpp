@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2020 Open Mobile Platform LLC.
+ *
+ * All rights reserved.
+ *
+ * BSD 3-Clause License, see LICENSE.
+ */
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTemporaryDir>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "filetree.h"
+
+namespace {
+
+// Leaf directories per middle level directory
+const int FANOUT = 100;
+const char FILE_CONTENT[] = "user-managerd\n";
+
+/*
+ * Creates small files spread to leaf directories of perDirectory files,
+ * similar to caches and thumbnails under a home directory. Returns the
+ * number of files created.
+ */
+int createTree(const QString &root, int files, int perDirectory)
+{
+    int created = 0;
+    for (int middle = 0; created < files; middle++) {
+        for (int leaf = 0; leaf < FANOUT && created < files; leaf++) {
+            QString dir = QStringLiteral("%1/d%2/s%3").arg(root).arg(middle).arg(leaf);
+            if (!QDir().mkpath(dir)) {
+                fprintf(stderr, "Could not create %s\n", qPrintable(dir));
+                return created;
+            }
+            const QByteArray nativeDir = QFile::encodeName(dir);
+            for (int i = 0; i < perDirectory && created < files; i++) {
+                QByteArray path = nativeDir + "/f" + QByteArray::number(i);
+                int fd = open(path.constData(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+                if (fd < 0 || write(fd, FILE_CONTENT, sizeof(FILE_CONTENT) - 1) < 0) {
+                    fprintf(stderr, "Could not create %s\n", path.constData());
+                    if (fd >= 0)
+                        close(fd);
+                    return created;
+                }
+                close(fd);
+                created++;
+            }
+        }
+    }
+    return created;
+}
+
+bool run(const QString &method, const QString &root, int files, int perDirectory)
+{
+    const QString tree = root + QStringLiteral("/") + method;
+    fprintf(stderr, "Creating %d files for %s...\n", files, qPrintable(method));
+    int created = createTree(tree, files, perDirectory);
+    if (created != files)
+        return false;
+    sync();
+
+    QElapsedTimer timer;
+    timer.start();
+    bool removed;
+    if (method == QLatin1String("qdir"))
+        removed = QDir(tree).removeRecursively();
+    else
+        removed = FileTree::remove(tree);
+    qint64 elapsed = timer.elapsed();
+
+    if (!removed || QFile::exists(tree)) {
+        fprintf(stderr, "%s failed to remove the tree\n", qPrintable(method));
+        return false;
+    }
+    printf("%-8s %10d files %8lld ms %10.0f files/s\n", qPrintable(method), created,
+           elapsed, elapsed > 0 ? created * 1000.0 / elapsed : 0.0);
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral(
+            "Creates a synthetic tree of small files and measures how long removing it takes "
+            "with QDir::removeRecursively() (qdir) and with the daemon's descriptor based "
+            "remover (filetree)."));
+    parser.addHelpOption();
+    QCommandLineOption dir(QStringLiteral("dir"),
+                           QStringLiteral("Directory to create trees in, temporary if not given. "
+                                          "Use the file system to be measured, e.g. /home."),
+                           QStringLiteral("dir"));
+    QCommandLineOption files(QStringLiteral("files"), QStringLiteral("Number of files in the tree."),
+                             QStringLiteral("n"), QStringLiteral("1000000"));
+    QCommandLineOption perDirectory(QStringLiteral("per-directory"), QStringLiteral("Files per leaf directory."),
+                                    QStringLiteral("n"), QStringLiteral("100"));
+    QCommandLineOption method(QStringLiteral("method"), QStringLiteral("qdir, filetree or both."),
+                              QStringLiteral("method"), QStringLiteral("both"));
+    parser.addOptions(QList<QCommandLineOption>() << dir << files << perDirectory << method);
+    parser.process(app);
+
+    int fileCount = parser.value(files).toInt();
+    int perDirectoryCount = parser.value(perDirectory).toInt();
+    QString methodName = parser.value(method);
+    QStringList methods;
+    if (methodName == QLatin1String("both"))
+        methods << QStringLiteral("qdir") << QStringLiteral("filetree");
+    else if (methodName == QLatin1String("qdir") || methodName == QLatin1String("filetree"))
+        methods << methodName;
+    if (fileCount <= 0 || perDirectoryCount <= 0 || methods.isEmpty()) {
+        fprintf(stderr, "Invalid arguments\n");
+        return EXIT_FAILURE;
+    }
+
+    QTemporaryDir temporary(parser.isSet(dir) ? parser.value(dir) + QStringLiteral("/treebench-XXXXXX")
+                                              : QDir::tempPath() + QStringLiteral("/treebench-XXXXXX"));
+    if (!temporary.isValid()) {
+        fprintf(stderr, "Could not create working directory\n");
+        return EXIT_FAILURE;
+    }
+
+#ifdef HAVE_LIBURING
+    printf("filetree uses %d threads and io_uring\n", FileTree::maxThreads());
+#else
+    printf("filetree uses %d threads\n", FileTree::maxThreads());
+#endif
+    for (const QString &name : methods) {
+        if (!run(name, temporary.path(), fileCount, perDirectoryCount))
+            return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
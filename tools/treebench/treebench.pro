@@ -0,0 +1,27 @@
+TEMPLATE = app
+TARGET = user-managerd-treebench
+
+QT -= gui
+
+CONFIG += c++11 console link_pkgconfig
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+packagesExist(liburing) {
+    PKGCONFIG += liburing
+    DEFINES += HAVE_LIBURING
+}
+
+INCLUDEPATH += ../../src
+
+SOURCES += \
+    ../../src/filetree.cpp \
+    ../../src/logging.cpp \
+    main.cpp
+
+HEADERS += \
+    ../../src/filetree.h \
+    ../../src/logging.h
+
+# Development tool, not installed
@@ -1,6 +1,6 @@
 TEMPLATE = subdirs
 
-SUBDIRS = doc service src
+SUBDIRS = doc lib nss service src tests tools/loadgen tools/treebench
 
 DISTFILES += \
     LICENSE \